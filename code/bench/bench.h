@@ -0,0 +1,161 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+//
+// Shared by the benchmarks. Each benchmark is a single translation unit that includes this file
+// once, it replaces the global operator new to count the allocations.
+//
+// Every measurement is printed as one line of space separated key=value pairs, the same as
+// FormatStats() in the dynamics, so that runs can be compared with a script:
+//   bench=<name> <parameters> ops=<count> ns_per_op=<time> allocs_per_op=<count>
+//
+
+#ifndef bench__h
+#define bench__h
+
+#include "../types.h"
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+//
+// Allocation counting
+//
+
+static std::atomic<u64> GAllocationCount(0);
+
+void *operator new(size_t Size)
+{
+    GAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    
+    void *Result = malloc(Size ? Size : 1);
+    if (!Result)
+    {
+        throw std::bad_alloc();
+    }
+    return Result;
+}
+
+void operator delete(void *Memory) noexcept
+{
+    free(Memory);
+}
+
+void operator delete(void *Memory, size_t) noexcept
+{
+    free(Memory);
+}
+
+
+
+//
+// Measurements
+//
+
+struct bench_measurement
+{
+    u64 Nanoseconds = 0;
+    u64 AllocationCount = 0;
+    u64 OperationCount = 0;
+    
+    u64 StartNanoseconds = 0;
+    u64 StartAllocationCount = 0;
+};
+
+inline u64 GetNanoseconds()
+{
+    u64 Result = static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    return Result;
+}
+
+// Begin() and End() may be called any number of times, the time and the allocations between
+// them are added up. Only what is between them is measured, so setting up is left outside.
+inline void Begin(bench_measurement *Measurement)
+{
+    Measurement->StartAllocationCount = GAllocationCount.load(std::memory_order_relaxed);
+    Measurement->StartNanoseconds = GetNanoseconds();
+}
+
+inline void End(bench_measurement *Measurement, u64 OperationCount)
+{
+    u64 Nanoseconds = GetNanoseconds();
+    Measurement->Nanoseconds += Nanoseconds - Measurement->StartNanoseconds;
+    Measurement->AllocationCount += GAllocationCount.load(std::memory_order_relaxed) - Measurement->StartAllocationCount;
+    Measurement->OperationCount += OperationCount;
+}
+
+// Parameters is a printf format for the key=value pairs that tell the cases apart
+inline void Report(bench_measurement const *Measurement, char const *Name, char const *Parameters, ...)
+{
+    char Buffer[256];
+    va_list Arguments;
+    va_start(Arguments, Parameters);
+    vsnprintf(Buffer, sizeof(Buffer), Parameters, Arguments);
+    va_end(Arguments);
+    
+    double OperationCount = Measurement->OperationCount ? static_cast<double>(Measurement->OperationCount) : 1.0;
+    printf("bench=%s %s ops=%llu ns_per_op=%.1f allocs_per_op=%.3f\n", Name, Buffer,
+           (unsigned long long)Measurement->OperationCount,
+           static_cast<double>(Measurement->Nanoseconds) / OperationCount,
+           static_cast<double>(Measurement->AllocationCount) / OperationCount);
+    fflush(stdout);
+}
+
+
+//
+// Random numbers, the same sequence on every platform so that runs are comparable
+//
+
+struct bench_random
+{
+    u32 State = 0x12345678;
+};
+
+inline u32 NextU32(bench_random *Random)
+{
+    // xorshift32
+    u32 x = Random->State;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    Random->State = x;
+    return x;
+}
+
+inline f32 RandomBetween(bench_random *Random, f32 Min, f32 Max)
+{
+    f32 t = static_cast<f32>(NextU32(Random) >> 8) / static_cast<f32>(1 << 24);
+    f32 Result = Min + t*(Max - Min);
+    return Result;
+}
+
+
+
+#endif
@@ -0,0 +1,412 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+//
+// Benchmarks of the dynamics, see bench.h for the output. Built with the Makefile in this
+// directory, not by build.bat.
+//
+
+#include "bench.h"
+#include "../dynamics.h"
+#include "../snapshot_ring.h"
+#include <math.h>
+
+// Internal to dynamics.cpp
+b32 Intersects(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info); // Closed-form or GJK/EPA
+b32 IntersectsGJK(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info);
+void UpdateBroadphase(dynamics_state *State);
+
+
+
+//
+// Scenes
+//
+
+enum scene_density
+{
+    SceneDensity_Sparse,
+    SceneDensity_Dense,
+    
+    SceneDensity_Count,
+};
+
+static char const *kSceneDensityNames[SceneDensity_Count] = { "sparse", "dense" };
+
+// Average distance between the bodies, which are 5 to 15 units across
+static f32 const kSceneSpacing[SceneDensity_Count] = { 40.0f, 15.0f };
+
+// Count bodies, half circles and half rectangles, moving in random directions in a square
+static void AddBodies(dynamics_state *State, u32 Count, scene_density Density, bench_random *Random)
+{
+    f32 Size = sqrtf(static_cast<f32>(Count))*kSceneSpacing[Density];
+    
+    for (u32 Index = 0; Index < Count; ++Index)
+    {
+        body_handle Handle;
+        if (Index & 1)
+        {
+            Handle = NewCircleBody(State, RandomBetween(Random, 2.5f, 7.5f));
+        }
+        else
+        {
+            Handle = NewRectangleBody(State, V2(RandomBetween(Random, 5.0f, 15.0f), RandomBetween(Random, 5.0f, 15.0f)));
+        }
+        
+        SetP(State, Handle, V2(RandomBetween(Random, 0.0f, Size), RandomBetween(Random, 0.0f, Size)));
+        GetBody(State, Handle).dP = V2(RandomBetween(Random, -50.0f, 50.0f), RandomBetween(Random, -50.0f, 50.0f));
+    }
+}
+
+
+
+//
+// Steps
+//
+
+// Update() per body, DetectCollisions() per step and ResolveCollisions() per collision, for a
+// few body counts and densities. The phases are measured separately in the same steps.
+static void BenchStep()
+{
+    u32 const kBodyCounts[] = { 100, 1000, 10000 };
+    f32 const dt = 1.0f / 60.0f;
+    
+    for (u32 BodyCount : kBodyCounts)
+    {
+        for (u32 Density = 0; Density < SceneDensity_Count; ++Density)
+        {
+            dynamics_state State;
+            Init(&State);
+            
+            bench_random Random;
+            AddBodies(&State, BodyCount, static_cast<scene_density>(Density), &Random);
+            
+            std::vector<collision_info> Collisions;
+            bench_measurement UpdateMeasurement;
+            bench_measurement DetectMeasurement;
+            bench_measurement ResolveMeasurement;
+            u64 PairCount = 0;
+            
+            // The first steps fill the arrays and the contact cache, they are not measured
+            u32 const kWarmUpStepCount = 3;
+            u32 StepCount = kWarmUpStepCount + (BodyCount >= 10000 ? 20 : 100);
+            for (u32 Step = 0; Step < StepCount; ++Step)
+            {
+                b32 Measure = (Step >= kWarmUpStepCount);
+                Collisions.clear();
+                
+                Begin(&UpdateMeasurement);
+                Update(&State, dt);
+                End(&UpdateMeasurement, BodyCount);
+                
+                Begin(&DetectMeasurement);
+                DetectCollisions(&State, Collisions);
+                End(&DetectMeasurement, 1);
+                
+                Begin(&ResolveMeasurement);
+                ResolveCollisions(&State, Collisions, dt);
+                End(&ResolveMeasurement, Collisions.size());
+                
+                PairCount += State.Stats.PairTestCount;
+                if (!Measure)
+                {
+                    UpdateMeasurement = bench_measurement();
+                    DetectMeasurement = bench_measurement();
+                    ResolveMeasurement = bench_measurement();
+                    PairCount = 0;
+                }
+            }
+            
+            char const *DensityName = kSceneDensityNames[Density];
+            u64 MeasuredStepCount = DetectMeasurement.OperationCount;
+            Report(&UpdateMeasurement, "update", "bodies=%u density=%s", BodyCount, DensityName);
+            Report(&DetectMeasurement, "detect_collisions", "bodies=%u density=%s pairs_per_step=%.1f", 
+                   BodyCount, DensityName, static_cast<double>(PairCount) / static_cast<double>(MeasuredStepCount));
+            Report(&ResolveMeasurement, "resolve_collisions", "bodies=%u density=%s", BodyCount, DensityName);
+            
+            Shutdown(&State);
+        }
+    }
+}
+
+
+
+//
+// Broadphase
+//
+
+// The sweep-and-prune on its own, per step. The AABB tests it does are compared to the
+// N(N - 1)/2 of testing all the pairs.
+static void BenchBroadphase()
+{
+    u32 const kBodyCounts[] = { 5, 100, 1000, 5000, 10000 };
+    f32 const dt = 1.0f / 60.0f;
+    
+    for (u32 BodyCount : kBodyCounts)
+    {
+        for (u32 Density = 0; Density < SceneDensity_Count; ++Density)
+        {
+            dynamics_state State;
+            Init(&State);
+            
+            bench_random Random;
+            AddBodies(&State, BodyCount, static_cast<scene_density>(Density), &Random);
+            
+            // Sorts the proxies the first time, which is not what a step costs
+            UpdateBroadphase(&State);
+            
+            bench_measurement Measurement;
+            u64 TestCount = 0;
+            u64 PairCount = 0;
+            u32 const kStepCount = 50;
+            for (u32 Step = 0; Step < kStepCount; ++Step)
+            {
+                Update(&State, dt);
+                
+                Begin(&Measurement);
+                UpdateBroadphase(&State);
+                End(&Measurement, 1);
+                
+                TestCount += State.Stats.BroadphaseTestCount;
+                PairCount += State.Broadphase.Pairs.size();
+            }
+            
+            double AllPairCount = 0.5*static_cast<double>(BodyCount)*static_cast<double>(BodyCount - 1);
+            Report(&Measurement, "broadphase", "bodies=%u density=%s tests_per_step=%.1f all_pairs=%.0f pairs_per_step=%.1f", 
+                   BodyCount, kSceneDensityNames[Density], static_cast<double>(TestCount) / kStepCount, AllPairCount, 
+                   static_cast<double>(PairCount) / kStepCount);
+            
+            Shutdown(&State);
+        }
+    }
+}
+
+
+
+//
+// Integration
+//
+
+// The integration kernels on their own, per body. Fixed point is the DYNAMICS_FIXED_POINT
+// experiment, it converts every body from f32 and back on each step.
+static void BenchIntegrate()
+{
+    struct kernel
+    {
+        char const *Name;
+        integrate_function *Integrate;
+    };
+    
+    simd_level Supported = GetSupportedSimdLevel();
+    kernel Kernels[] = 
+    {
+        { "scalar", IntegrateScalar },
+        { "sse2", Supported >= SimdLevel_SSE2 ? IntegrateSSE2 : nullptr },
+        { "avx2", Supported >= SimdLevel_AVX2 ? IntegrateAVX2 : nullptr },
+        { "fixed", IntegrateFixed },
+    };
+    
+    u32 const kBodyCount = 10000;
+    u32 const kStepCount = 200;
+    f32 const dt = 1.0f / 60.0f;
+    
+    for (kernel const& Kernel : Kernels)
+    {
+        if (!Kernel.Integrate)
+        {
+            continue;
+        }
+        
+        dynamics_state State;
+        Init(&State);
+        
+        bench_random Random;
+        AddBodies(&State, kBodyCount, SceneDensity_Sparse, &Random);
+        
+        bench_measurement Measurement;
+        Begin(&Measurement);
+        for (u32 Step = 0; Step < kStepCount; ++Step)
+        {
+            Kernel.Integrate(&State.Bodies, 0, State.Bodies.Count, dt);
+        }
+        End(&Measurement, kStepCount*kBodyCount);
+        
+        Report(&Measurement, "integrate", "kernel=%s bodies=%u", Kernel.Name, kBodyCount);
+        
+        Shutdown(&State);
+    }
+}
+
+
+
+//
+// Narrowphase
+//
+
+// Intersects() for each pair of shape types, with random positions of which about half overlap.
+// The pairs with a closed-form test are also timed through GJK/EPA, which they replaced.
+static void BenchIntersects()
+{
+    dynamics_state State;
+    Init(&State);
+    
+    v2 const Triangle[] = { V2(-6.0f, -5.0f), V2(6.0f, -5.0f), V2(0.0f, 6.0f) };
+    
+    shape Shapes[ShapeType_Count];
+    Shapes[ShapeType_Rectangle].Type = ShapeType_Rectangle;
+    Shapes[ShapeType_Rectangle].HalfSize = V2(6.0f, 4.0f);
+    Shapes[ShapeType_Circle].Type = ShapeType_Circle;
+    Shapes[ShapeType_Circle].Radius = 5.0f;
+    Shapes[ShapeType_Convex].Type = ShapeType_Convex;
+    Shapes[ShapeType_Convex].Convex = NewPolygonShape(&State, Triangle, ArrayCount(Triangle));
+    
+    char const *ShapeNames[ShapeType_Count] = { "rectangle", "circle", "convex" };
+    
+    u32 const kPositionCount = 1024;
+    u32 const kRepeatCount = 200;
+    static v2 Positions[kPositionCount];
+    
+    bench_random Random;
+    for (u32 Index = 0; Index < kPositionCount; ++Index)
+    {
+        Positions[Index] = V2(RandomBetween(&Random, -14.0f, 14.0f), RandomBetween(&Random, -14.0f, 14.0f));
+    }
+    
+    typedef b32 intersect_function(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info);
+    intersect_function * const Functions[] = { Intersects, IntersectsGJK };
+    char const *FunctionNames[] = { "dispatch", "gjk" };
+    
+    for (u32 A = 0; A < ShapeType_Count; ++A)
+    {
+        for (u32 B = 0; B < ShapeType_Count; ++B)
+        {
+            for (u32 Function = 0; Function < ArrayCount(Functions); ++Function)
+            {
+                // The convex shapes always go through GJK/EPA
+                if ((Functions[Function] == IntersectsGJK) && ((A == ShapeType_Convex) || (B == ShapeType_Convex)))
+                {
+                    continue;
+                }
+                
+                bench_measurement Measurement;
+                u32 HitCount = 0;
+                
+                Begin(&Measurement);
+                for (u32 Repeat = 0; Repeat < kRepeatCount; ++Repeat)
+                {
+                    for (u32 Index = 0; Index < kPositionCount; ++Index)
+                    {
+                        collision_info Info;
+                        HitCount += Functions[Function](v2_zero, &Shapes[A], Positions[Index], &Shapes[B], &Info) ? 1 : 0;
+                    }
+                }
+                End(&Measurement, kRepeatCount*kPositionCount);
+                
+                Report(&Measurement, "intersects", "a=%s b=%s path=%s hit_rate=%.2f", ShapeNames[A], ShapeNames[B], 
+                       FunctionNames[Function], static_cast<double>(HitCount) / static_cast<double>(kRepeatCount*kPositionCount));
+            }
+        }
+    }
+    
+    Shutdown(&State);
+}
+
+
+
+//
+// Snapshots
+//
+
+// SaveSnapshot(), RestoreSnapshot() and pushing the snapshot into a snapshot_ring, per call, for a
+// few body counts. The scene is stepped first so that the contact cache and the impulses are in
+// the snapshot too.
+static void BenchSnapshots()
+{
+    u32 const kBodyCounts[] = { 100, 1000, 10000 };
+    u32 const kRepeatCount = 200;
+    f32 const dt = 1.0f / 60.0f;
+    
+    for (u32 BodyCount : kBodyCounts)
+    {
+        dynamics_state State;
+        Init(&State);
+        
+        bench_random Random;
+        AddBodies(&State, BodyCount, SceneDensity_Dense, &Random);
+        for (u32 Step = 0; Step < 10; ++Step)
+        {
+            Simulate(&State, dt);
+        }
+        
+        // Room for the contacts to grow between the steps
+        size_t Capacity = 2*GetSnapshotSize(&State);
+        std::vector<u8> Snapshot(Capacity);
+        
+        snapshot_ring Ring;
+        Init(&Ring, 16, Capacity, 16*Capacity);
+        
+        bench_measurement SaveMeasurement;
+        bench_measurement RestoreMeasurement;
+        bench_measurement PushMeasurement;
+        size_t Size = 0;
+        for (u32 Repeat = 0; Repeat < kRepeatCount; ++Repeat)
+        {
+            Begin(&SaveMeasurement);
+            Size = SaveSnapshot(&State, Snapshot.data(), Capacity);
+            End(&SaveMeasurement, 1);
+            
+            Begin(&RestoreMeasurement);
+            RestoreSnapshot(&State, Snapshot.data(), Size);
+            End(&RestoreMeasurement, 1);
+            
+            // A step between the pushes, so that the deltas aren't all zero
+            Simulate(&State, dt);
+            Size = SaveSnapshot(&State, Snapshot.data(), Capacity);
+            
+            Begin(&PushMeasurement);
+            Push(&Ring, Snapshot.data(), Size);
+            End(&PushMeasurement, 1);
+        }
+        
+        Report(&SaveMeasurement, "save_snapshot", "bodies=%u bytes=%zu", BodyCount, Size);
+        Report(&RestoreMeasurement, "restore_snapshot", "bodies=%u bytes=%zu", BodyCount, Size);
+        Report(&PushMeasurement, "snapshot_ring_push", "bodies=%u bytes=%zu", BodyCount, Size);
+        
+        Shutdown(&Ring);
+        Shutdown(&State);
+    }
+}
+
+
+
+int main()
+{
+    BenchStep();
+    BenchBroadphase();
+    BenchIntegrate();
+    BenchIntersects();
+    BenchSnapshots();
+    
+    return 0;
+}
@@ -0,0 +1,339 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+//
+// Benchmarks of the memory arenas, see bench.h for the output. Built with the Makefile in this
+// directory, not by build.bat.
+//
+
+#include "bench.h"
+#include "../memory_arena.h"
+#include "../mathematics.h"
+#include <stddef.h> // offsetof
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BENCH_X86 1
+#include <emmintrin.h>
+#endif
+
+
+
+//
+// Draw calls
+//
+
+// The same layout as the draw calls in draw_calls.h, which can't be included here because it
+// pulls in the platform headers
+struct alignas(16) bench_draw_call_header
+{
+    size_t Size;
+    u32 Type;
+};
+
+struct bench_draw_call_text
+{
+    bench_draw_call_header Header;
+    wchar_t *Text;
+    v2 P;
+};
+
+struct bench_draw_call_textured_mesh
+{
+    bench_draw_call_header Header;
+    m4 ObjectToWorld;
+    v4 Colour;
+    u32 MeshIndex;
+    u32 TextureIndex;
+};
+
+#if BENCH_X86
+// Adds up the matrices, so that the loads can't be left out
+template<bool Aligned>
+static f32 LoadMatrices(std::vector<f32 const *> const& Matrices, u32 RepeatCount)
+{
+    __m128 Sum = _mm_setzero_ps();
+    for (u32 Repeat = 0; Repeat < RepeatCount; ++Repeat)
+    {
+        for (f32 const *M : Matrices)
+        {
+            __m128 Row0 = Aligned ? _mm_load_ps(M + 0) : _mm_loadu_ps(M + 0);
+            __m128 Row1 = Aligned ? _mm_load_ps(M + 4) : _mm_loadu_ps(M + 4);
+            __m128 Row2 = Aligned ? _mm_load_ps(M + 8) : _mm_loadu_ps(M + 8);
+            __m128 Row3 = Aligned ? _mm_load_ps(M + 12) : _mm_loadu_ps(M + 12);
+            Sum = _mm_add_ps(Sum, _mm_add_ps(_mm_add_ps(Row0, Row1), _mm_add_ps(Row2, Row3)));
+        }
+    }
+    
+    f32 Result[4];
+    _mm_storeu_ps(Result, Sum);
+    return Result[0] + Result[1] + Result[2] + Result[3];
+}
+#endif
+
+// Loading the ObjectToWorld matrices of a stream of text and mesh draw calls. The aligned stream
+// is pushed the way draw_calls.cpp does it now, every draw call on a 16 byte boundary. The packed
+// stream is pushed back to back like before, with the text after a text draw call, so most of the
+// matrices are misaligned and have to be loaded with unaligned loads.
+static void BenchMatrixLoads()
+{
+#if BENCH_X86
+    u32 const kDrawCallCount = 4096;
+    u32 const kRepeatCount = 2000;
+    
+    memory_arena AlignedMemory;
+    memory_arena PackedMemory;
+    Init(&AlignedMemory, 1 << 22);
+    Init(&PackedMemory, 1 << 22);
+    
+    std::vector<f32 const *> AlignedMatrices;
+    std::vector<f32 const *> PackedMatrices;
+    
+    bench_random Random;
+    for (u32 Index = 0; Index < kDrawCallCount; ++Index)
+    {
+        if (Index % 3 == 0)
+        {
+            size_t Length = 1 + NextU32(&Random) % 20;
+            
+            PushStruct<bench_draw_call_text>(&AlignedMemory);
+            PushArray<wchar_t>(&AlignedMemory, Length);
+            
+            // The old text draw calls with 2-byte wchar_t and without the padding
+            Push(&PackedMemory, sizeof(bench_draw_call_text) - 8 + 2*Length);
+        }
+        
+        bench_draw_call_textured_mesh *Mesh = PushStruct<bench_draw_call_textured_mesh>(&AlignedMemory);
+        AlignedMatrices.push_back(&Mesh->ObjectToWorld.E[0][0]);
+        
+        u8 *Packed = Push(&PackedMemory, sizeof(bench_draw_call_textured_mesh));
+        PackedMatrices.push_back(reinterpret_cast<f32 const *>(Packed + offsetof(bench_draw_call_textured_mesh, ObjectToWorld)));
+    }
+    
+    u32 MisalignedCount = 0;
+    for (f32 const *M : PackedMatrices)
+    {
+        MisalignedCount += (reinterpret_cast<uintptr_t>(M) & 15) ? 1 : 0;
+    }
+    
+    struct load_case
+    {
+        char const *Layout;
+        char const *Load;
+        std::vector<f32 const *> *Matrices;
+        b32 Aligned;
+    };
+    
+    load_case Cases[] =
+    {
+        { "aligned", "aligned", &AlignedMatrices, true },
+        { "aligned", "unaligned", &AlignedMatrices, false },
+        { "packed", "unaligned", &PackedMatrices, false },
+    };
+    
+    for (load_case const& Case : Cases)
+    {
+        bench_measurement Measurement;
+        Begin(&Measurement);
+        f32 Sum = Case.Aligned ? LoadMatrices<true>(*Case.Matrices, kRepeatCount) : LoadMatrices<false>(*Case.Matrices, kRepeatCount);
+        End(&Measurement, u64(kRepeatCount)*Case.Matrices->size());
+        
+        u32 Misaligned = (Case.Matrices == &PackedMatrices) ? MisalignedCount : 0;
+        Report(&Measurement, "matrix_load", "layout=%s load=%s matrices=%u misaligned=%u sum=%g", Case.Layout, Case.Load,
+               kDrawCallCount, Misaligned, static_cast<double>(Sum));
+    }
+    
+    Free(&AlignedMemory);
+    Free(&PackedMemory);
+#endif
+}
+
+
+
+//
+// Growth
+//
+
+// Growing an arena from 64 KB to Size by doubling it, per Resize(). A heap arena allocates and
+// copies on every resize, a virtual one commits the new pages in place. The virtual arena is also
+// timed with the new pages touched, since that is where the OS actually hands out the pages.
+static void BenchGrowth()
+{
+    size_t const kInitialSize = 64 << 10;
+    
+    for (size_t Size = 1 << 20; Size <= (size_t(1) << 30); Size <<= 2)
+    {
+        bench_measurement HeapMeasurement;
+        memory_arena Heap;
+        Init(&Heap, kInitialSize);
+        for (size_t NewSize = 2*kInitialSize; NewSize <= Size; NewSize <<= 1)
+        {
+            Begin(&HeapMeasurement);
+            Resize(&Heap, NewSize);
+            End(&HeapMeasurement, 1);
+        }
+        Free(&Heap);
+        
+        bench_measurement VirtualMeasurement;
+        bench_measurement TouchedMeasurement;
+        memory_arena Virtual;
+        InitVirtual(&Virtual, size_t(1) << 31, kInitialSize);
+        for (size_t NewSize = 2*kInitialSize; NewSize <= Size; NewSize <<= 1)
+        {
+            size_t OldSize = Virtual.Size;
+            
+            Begin(&TouchedMeasurement);
+            Begin(&VirtualMeasurement);
+            Resize(&Virtual, NewSize);
+            End(&VirtualMeasurement, 1);
+            for (size_t Offset = OldSize; Offset < NewSize; Offset += GetPageSize())
+            {
+                Virtual.Ptr[Offset] = 1;
+            }
+            End(&TouchedMeasurement, 1);
+        }
+        Free(&Virtual);
+        
+        size_t Megabytes = Size >> 20;
+        Report(&HeapMeasurement, "arena_growth", "arena=heap size_mb=%zu", Megabytes);
+        Report(&VirtualMeasurement, "arena_growth", "arena=virtual size_mb=%zu", Megabytes);
+        Report(&TouchedMeasurement, "arena_growth", "arena=virtual_touched size_mb=%zu", Megabytes);
+    }
+}
+
+
+
+//
+// Contention
+//
+
+enum contention_arena
+{
+    ContentionArena_Shared, // PushAtomic() on one shared_arena
+    ContentionArena_Mutex,  // Push() on one memory_arena behind a mutex
+    ContentionArena_Thread, // Push() on each thread's GetThreadArena()
+    
+    ContentionArena_Count,
+};
+
+static char const *kContentionArenaNames[ContentionArena_Count] = { "shared", "mutex", "thread" };
+
+// The same number of 32 byte pushes split over 1 to 64 threads, per push. Starting and joining
+// the threads is included. Each case runs twice and only the second run is measured, so that the
+// pages have already been touched.
+static void BenchContention()
+{
+    u32 const kPushCount = 1500000;
+    size_t const kPushSize = 32;
+    size_t const kArenaSize = size_t(kPushCount)*kPushSize + (1 << 20);
+    
+    for (u32 ThreadCount = 1; ThreadCount <= 64; ThreadCount *= 2)
+    {
+        u32 PushesPerThread = kPushCount / ThreadCount;
+        
+        for (u32 Kind = 0; Kind < ContentionArena_Count; ++Kind)
+        {
+            shared_arena Shared;
+            memory_arena Locked;
+            std::mutex Mutex;
+            Init(&Shared, kArenaSize);
+            Init(&Locked, kArenaSize);
+            
+            bench_measurement Measurement;
+            for (u32 Run = 0; Run < 2; ++Run)
+            {
+                BeginArenaFrame();
+                Clear(&Shared);
+                Clear(&Locked);
+                Measurement = bench_measurement();
+                
+                std::vector<std::thread> Threads;
+                Threads.reserve(ThreadCount);
+                
+                Begin(&Measurement);
+                for (u32 Thread = 0; Thread < ThreadCount; ++Thread)
+                {
+                    Threads.emplace_back([&]()
+                    {
+                        memory_arena *ThreadArena = nullptr;
+                        if (Kind == ContentionArena_Thread)
+                        {
+                            ThreadArena = GetThreadArena(PushesPerThread*kPushSize);
+                        }
+                        
+                        for (u32 Index = 0; Index < PushesPerThread; ++Index)
+                        {
+                            u8 *Ptr = nullptr;
+                            switch (Kind)
+                            {
+                                case ContentionArena_Shared:
+                                {
+                                    Ptr = PushAtomic(&Shared, kPushSize);
+                                } break;
+                                
+                                case ContentionArena_Mutex:
+                                {
+                                    std::lock_guard<std::mutex> Lock(Mutex);
+                                    Ptr = Push(&Locked, kPushSize);
+                                } break;
+                                
+                                default:
+                                {
+                                    Ptr = Push(ThreadArena, kPushSize);
+                                } break;
+                            }
+                            
+                            Ptr[0] = 1;
+                        }
+                    });
+                }
+                
+                for (std::thread& Thread : Threads)
+                {
+                    Thread.join();
+                }
+                End(&Measurement, u64(PushesPerThread)*ThreadCount);
+            }
+            
+            Report(&Measurement, "arena_contention", "arena=%s threads=%u", kContentionArenaNames[Kind], ThreadCount);
+            
+            Free(&Shared);
+            Free(&Locked);
+        }
+    }
+}
+
+
+
+int main()
+{
+    BenchMatrixLoads();
+    BenchGrowth();
+    BenchContention();
+    
+    return 0;
+}
@@ -9,6 +9,7 @@ SET CompileShaders=0
 IF "%1"=="d" SET BuildMode="debug"
 IF "%1"=="f" SET BuildMode="fastdebug"
 IF "%1"=="r" SET BuildMode="release"
+IF "%1"=="l" SET BuildMode="lockstep"
 IF "%2"=="s" SET CompileShaders=1
 
 IF %CompileShaders%==1 (
@@ -23,14 +24,22 @@ REM ----------------------------------------------------------------------------
 REM Compiler Options
 REM https://docs.microsoft.com/en-us/cpp/build/reference/compiler-options-listed-alphabetically?view=vs-2017
 
-SET IgnoredWarnings=/wd4100 /wd4201 /wd4505
-SET GeneralCompilerOptions=/nologo /MP /WL /fp:fast /fp:except- /EHsc /Gm- /Oi /FC /WX /W4 !IgnoredWarnings!
+SET IgnoredWarnings=/wd4100 /wd4201 /wd4324 /wd4505
+SET FloatingPoint=/fp:fast /fp:except-
+IF %BuildMode%=="lockstep" SET FloatingPoint=/fp:strict /fp:except-
+
+SET GeneralCompilerOptions=/nologo /MP /WL !FloatingPoint! /EHsc /Gm- /Oi /FC /WX /W4 !IgnoredWarnings!
 
 IF %BuildMode%=="release" (
   ECHO Release mode
   SET CompilerOptions=/O2 !GeneralCompilerOptions!
   SET CompilerOptions=/DRELEASE=1 /D_WIN32=1 /DOPTIMIZATION=2 !CompilerOptions!
 ) 
+IF %BuildMode%=="lockstep" (
+  ECHO Lockstep mode, deterministic floating point
+  SET CompilerOptions=/O2 !GeneralCompilerOptions!
+  SET CompilerOptions=/DRELEASE=1 /DDETERMINISTIC=1 /D_WIN32=1 /DOPTIMIZATION=2 !CompilerOptions!
+) 
 IF %BuildMode%=="fastdebug" (
   ECHO Fast debug mode
   SET CompilerOptions=/O2 !GeneralCompilerOptions! /Zi
@@ -46,6 +55,7 @@ IF  %BuildMode%=="debug" (
 REM WL		 One line diagonostics
 REM Ox		 Code generation x E [d = Debug, 1 = small code, 2 = fast code]
 REM fp:fast    Fast floating point code generated
+REM fp:strict  No contractions (FMA) or reordering, used by the lockstep build together with DETERMINISTIC
 REM fp:except- No floating point exceptions
 REM EHsc       Catches C++ exceptions only
 REM GM-		Enables minimal rebuild (- disables it, we want all files compiled all the time)
@@ -57,6 +67,7 @@ REM W4		 All warnings
 REM wx		 Except...
 REM			  4100 'identifier': unreferenced formal parameter
 REM			  4201 nonstandard extension used: nameless struct/union
+REM			  4324 structure was padded due to alignment specifier, the padding is what alignas is used for
 REM			  4505 unreferenced local function
 REM FC		 Display full path of source code files passed to cl.exe in diagnostic text
 REM GS		 Buffer security check
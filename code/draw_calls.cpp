@@ -47,15 +47,23 @@ void Init(draw_calls *DrawCalls, size_t MemorySize, display_metrics DisplayMetri
     DrawCalls->DisplayMetrics = DisplayMetrics;
     
     Init(&DrawCalls->Memory, MemorySize);
+    Register(&DrawCalls->Memory, "draw_calls");
     
-    Init(&DrawCalls->PrimitiveLinesMemory, 1 << 10); // @debug
-    Init(&DrawCalls->PrimitiveTrianglesMemory, 1 << 10); // @debug
+    // The vertices grow in place, PushLine() and PushTriangleFilled() double them when they are full
+    InitVirtual(&DrawCalls->PrimitiveLinesMemory, 64 << 20, 1 << 10); // @debug
+    InitVirtual(&DrawCalls->PrimitiveTrianglesMemory, 64 << 20, 1 << 10); // @debug
+    Register(&DrawCalls->PrimitiveLinesMemory, "draw_calls_lines");
+    Register(&DrawCalls->PrimitiveTrianglesMemory, "draw_calls_triangles");
 }
 
 
 void Shutdown(draw_calls *DrawCalls)
 {
     assert(DrawCalls);
+    Unregister(&DrawCalls->Memory);
+    Unregister(&DrawCalls->PrimitiveLinesMemory);
+    Unregister(&DrawCalls->PrimitiveTrianglesMemory);
+    
     Free(&DrawCalls->Memory);
     Free(&DrawCalls->PrimitiveLinesMemory);
     Free(&DrawCalls->PrimitiveTrianglesMemory);
@@ -97,7 +105,9 @@ void PushLine(draw_calls *DrawCalls, v3 P0, v3 P1, v4 Colour)
         assert(Result);
     }
     
-    vertex_PC *Vertices = reinterpret_cast<vertex_PC *>(Push(&DrawCalls->PrimitiveLinesMemory, Size));
+    vertex_PC *Vertices = PushArray<vertex_PC>(&DrawCalls->PrimitiveLinesMemory, 2, "line");
+    assert(Vertices);
+    
     Vertices[0].P = P0;
     Vertices[0].C = Colour;
     Vertices[1].P = P1;
@@ -124,7 +134,7 @@ void PushTriangleFilled(draw_calls *DrawCalls, v3 P0, v3 P1, v3 P2, v4 Colour)
         assert(Result);
     }
     
-    vertex_PC *Vertices = reinterpret_cast<vertex_PC *>(Push(&DrawCalls->PrimitiveTrianglesMemory, Size));
+    vertex_PC *Vertices = PushArray<vertex_PC>(&DrawCalls->PrimitiveTrianglesMemory, 3, "triangle");
     assert(Vertices);
     
     Vertices[0].P = P0;
@@ -214,26 +224,35 @@ void PushCircleFilled(draw_calls *DrawCalls, v3 P, f32 Radius, v4 Colour, u32 Sl
 // Draw calls
 //
 
+// Pads the end of the draw call up to where the next one starts, and returns its size
+static size_t EndDrawCall(draw_calls *DrawCalls, void *DrawCall)
+{
+    u8 *End = PushAligned(&DrawCalls->Memory, 0, alignof(draw_call_header), "padding");
+    assert(End);
+    
+    size_t Result = static_cast<size_t>(End - static_cast<u8 *>(DrawCall));
+    return Result;
+}
+
+
 void PushText(draw_calls *DrawCalls, v2 P, wchar_t const *Text, size_index SizeIndex, colour_index ColourIndex)
 {
-    size_t DrawCallSize = sizeof(draw_call_text);
-    size_t TextSize = (wcslen(Text) + 1) * sizeof(wchar_t);
-    size_t TotalSize = DrawCallSize + TextSize;
+    size_t TextLength = wcslen(Text) + 1;
     
-    draw_call_text *DrawCall = reinterpret_cast<draw_call_text *>(Push(&DrawCalls->Memory, TotalSize));
+    draw_call_text *DrawCall = PushStruct<draw_call_text>(&DrawCalls->Memory, "text");
     assert(DrawCall);
     
-    DrawCall->Header.Size = TotalSize;
+    // We store the text in memory, after the draw call struct
+    DrawCall->Text = PushArray<wchar_t>(&DrawCalls->Memory, TextLength, "text");
+    assert(DrawCall->Text);
+    wcsncpy_s(DrawCall->Text, TextLength, Text, TextLength);
+    
+    DrawCall->Header.Size = EndDrawCall(DrawCalls, DrawCall);
     DrawCall->Header.Type = DrawCallType_Text;
     
     DrawCall->P = P;
     DrawCall->ColourIndex = ColourIndex;
     DrawCall->SizeIndex = SizeIndex;
-    
-    // We store the text in memory, after the draw call struct
-    //DrawCall->Text = reinterpret_cast<wchar_t *>(DrawCall + DrawCallSize); 
-    DrawCall->Text = reinterpret_cast<wchar_t *>(reinterpret_cast<size_t>(DrawCall) + DrawCallSize); 
-    wcsncpy_s(DrawCall->Text, TextSize, Text, TextSize);
 }
 
 
@@ -248,12 +267,10 @@ void PushShadowedText(draw_calls *DrawCalls, v2 P, wchar_t const *Text, size_ind
 void PushTexturedMesh(draw_calls *DrawCalls, v3 P, mesh_index MeshIndex, texture_index TextureIndex, v2 Size, v4 Colour)
 {
     assert(DrawCalls);
-    size_t DrawCallSize = sizeof(draw_call_textured_mesh);
-    
-    draw_call_textured_mesh *DrawCall = reinterpret_cast<draw_call_textured_mesh *>(Push(&DrawCalls->Memory, DrawCallSize));
+    draw_call_textured_mesh *DrawCall = PushStruct<draw_call_textured_mesh>(&DrawCalls->Memory, "textured_mesh");
     assert(DrawCall);
     
-    DrawCall->Header.Size = DrawCallSize;
+    DrawCall->Header.Size = EndDrawCall(DrawCalls, DrawCall);
     DrawCall->Header.Type = DrawCallType_TexturedMesh;
     
     DrawCall->ObjectToWorld = M4Scale(Size.x, Size.y, 1.0f) * M4Translation(P.x, P.y, P.z);
@@ -106,7 +106,9 @@ enum draw_call_type
 };
 
 
-struct draw_call_header
+// Every draw call starts on a 16 byte boundary, so that the matrices and vectors in them can be
+// loaded with aligned SIMD loads. Size includes the padding up to the next draw call.
+struct alignas(16) draw_call_header
 {
     size_t Size;
     draw_call_type Type;
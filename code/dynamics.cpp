@@ -23,6 +23,12 @@
 //
 
 #include "dynamics.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
 
 #ifdef DEBUG
 #include <assert.h>
@@ -30,12 +36,65 @@
 #define assert(x)
 #endif
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define DYNAMICS_X86 1
+#include <emmintrin.h>
+#endif
+
+
+
+//
+// Constants
+//
+
+// GJK only ever needs three vertices, the rest of the capacity is used by EPA when it expands
+// the simplex into a polytope. EPA adds one vertex per iteration, so the capacity is also what
+// bounds the number of EPA iterations.
+u32 constexpr kMaxPolytopeVertexCount = 32;
+u32 constexpr kMaxEPAIterations = kMaxPolytopeVertexCount - 3;
+u32 constexpr kMaxGJKIterations = 32;
+
+// GJKDistance() stops when the next support point gets it less than this fraction closer, and
+// CastConvex() when the shapes are closer than kCastTolerance or it has advanced this many times.
+// The normal is the direction between the closest points, so the tolerance can't be much smaller
+// without the rounding of the positions showing up in the normal.
+f32 constexpr kGJKDistanceTolerance = 1e-5f;
+f32 constexpr kCastTolerance = 0.01f;
+u32 constexpr kMaxCastIterations = 32;
+
+// How far two bodies may move relative to each other before the cached EPA result is recomputed,
+// and how much the depth along the cached normal may differ from the support along it
+f32 constexpr kContactCacheMaxMotion = 0.1f;
+f32 constexpr kContactCacheTolerance = 0.001f;
+
+// How the work is split up when running on a worker_pool, the chunk sizes are part of what makes
+// the result independent of the thread count, so they must not depend on it.
+u32 constexpr kIntegrateChunkSize = 4096;
+u32 constexpr kSweepChunkSize = 512;
+u32 constexpr kNarrowphaseChunkSize = 256;
+u32 constexpr kResolveChunkSize = 128;
+
+// A dynamic body that moves slower than kSleepSpeed for kTimeToSleep seconds is put to sleep
+f32 constexpr kSleepSpeed = 5.0f;
+f32 constexpr kTimeToSleep = 0.5f;
+
+// Contacts that close slower than this don't bounce, so that resting bodies come to rest
+f32 constexpr kRestitutionThreshold = 1.0f;
+
+
 
 
 //
 // Structs
 //
 
+struct polytope
+{
+    v2 Vertices[kMaxPolytopeVertexCount];
+    u32 Count = 0;
+};
+
+
 struct edge
 {
     v2 N;
@@ -44,6 +103,13 @@ struct edge
 };
 
 
+struct phase_timer
+{
+    u64 Start;
+    u64 ArrayBytes;
+};
+
+
 
 
 //
@@ -51,22 +117,80 @@ struct edge
 //
 
 //
-// Simulation
-void UpdateBody(body& Body, f32 dt);
+// Body storage
+body_index AddBody(body_arrays *Bodies);
+void RemoveBody(body_arrays *Bodies, body_index Index);
+void Clear(body_arrays *Bodies);
+aabb GetAABB(dynamics_state *State, body_index BodyIndex);
+
+
+//
+// Stats
+phase_timer StartPhase(dynamics_state *State);
+void EndPhase(dynamics_state *State, phase_timer const& Timer, dynamics_phase_stats *Phase);
+u64 GetArrayBytes(dynamics_state *State);
+
+//
+// Sleeping
+void Sleep(dynamics_state *State, body_index Index);
+void WakeUp(dynamics_state *State, body_index BodyIndex);
+void UpdateSleep(dynamics_state *State, f32 dt);
+
+
+//
+// Broadphase
+void UpdateBroadphase(dynamics_state *State);
+u32 Sweep(broadphase *Broadphase, u32 First, u32 Count, std::vector<body_pair>& Output);
+b32 Overlaps(aabb const& A, aabb const& B);
+aabb Union(aabb const& A, aabb const& B);
+
+//
+// Contact batches
+void BuildContactBatches(dynamics_state *State, std::vector<collision_info>& Contacts);
+void UpdateContactCache(dynamics_state *State, u32 ChunkCount);
+contact_cache_entry const *FindContact(contact_cache *Cache, u64 Key, u32 GenerationLo, u32 GenerationHi);
+void UpdateContactEvents(dynamics_state *State, std::vector<collision_info>& Collisions, size_t First);
+b32 IsImmovable(body_arrays *Bodies, body_index Index);
+
+//
+// Solver
+void PrepareContact(dynamics_state *State, collision_info const *Collision, contact_constraint *Constraint);
+void WarmStart(body_arrays *Bodies, contact_constraint *Constraint);
+void SolveVelocity(body_arrays *Bodies, contact_constraint *Constraint);
+void SolvePosition(body_arrays *Bodies, contact_constraint *Constraint, f32 Baumgarte, f32 Slop);
+void StoreImpulses(dynamics_state *State, std::vector<collision_info>& Contacts);
 
 //
 // Collisions
 void DetectAndResolveCollisions(dynamics_state *State, f32 dt);
-b32 Intersects(body *A, body *B, collision_info *Info);
-collision_info GetCollisionInfo(std::vector<v2>& Simplex, v2 Poa, shape *A, v2 Pob, shape *B);
+b32 Intersects(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info);
+b32 IntersectsGJK(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info);
+b32 IntersectsCached(dynamics_state *State, body_index A, body_index B, collision_info *Info, 
+                     std::vector<contact_cache_entry>& NewEntries, contact_cache_stats *Stats);
+b32 UsesGJK(shape *A, shape *B);
+b32 GJK(v2 Pa, shape *A, v2 Pb, shape *B, v2 Direction, polytope *Simplex);
+f32 GJKDistance(v2 Pa, shape *A, v2 Pb, shape *B, v2 *N);
+b32 CastConvex(shape *Cast, v2 S, v2 D, shape *Shape, f32 *t, v2 *N);
+b32 IntersectsSwept(body_arrays *Bodies, body_index A, body_index B, collision_info *Info);
+b32 IntersectRectangles(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info);
+b32 IntersectRectangleCircle(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info);
+b32 IntersectCircleRectangle(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info);
+b32 IntersectCircles(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info);
+collision_info GetCollisionInfo(polytope *Simplex, v2 Poa, shape *A, v2 Pob, shape *B);
 
 // 
 // Geometry related
-b32 ContainsOrigin(std::vector<v2>& Simplex, v2 *Direction);
-edge FindEdgeClosestToOrigin(std::vector<v2>& Simplex);
+b32 ContainsOrigin(polytope *Simplex, v2 *Direction);
+edge FindEdgeClosestToOrigin(polytope *Polytope);
+b32 RectangleVsCircle(v2 Pr, v2 HalfSize, v2 Pc, f32 Radius, v2 *N, f32 *Depth);
+b32 SweepCircleRectangle(v2 S, v2 D, v2 HalfSize, f32 Radius, f32 *TOI, v2 *N);
+b32 SweepCircleCorner(v2 S, v2 D, v2 Corner, f32 Radius, f32 *TOI);
+void Insert(polytope *Polytope, u32 Index, v2 P);
+void Remove(polytope *Polytope, u32 Index);
 v2 FurthestPointInShape(v2 Po, shape *Shape, v2 Direction);
 v2 FurthestPointInCircle(v2 Po, shape *Circle, v2 Direction);
 v2 FurthestPointInRectangle(v2 Po, shape *Rectangle, v2 Direction);
+v2 FurthestPointInConvex(v2 Po, shape *Convex, v2 Direction);
 
 
 
@@ -77,272 +201,2730 @@ v2 FurthestPointInRectangle(v2 Po, shape *Rectangle, v2 Direction);
 
 void Init(dynamics_state *State)
 {
-    State->Bodies.clear();
+    Clear(&State->Bodies);
+    State->Broadphase.Proxies.clear();
+    State->Broadphase.RestingProxies.clear();
+    State->Broadphase.Pairs.clear();
+    State->Broadphase.Rebuild = true;
+    State->ContactCache.Entries.clear();
+    State->ContactEvents.Events.clear();
+    State->ContactEvents.Pairs.clear();
+    State->Solver.Impulses.clear();
+    State->ConvexShapes.clear();
+    State->QueryTree.Rebuild = true;
+    State->Stats = dynamics_stats();
+    State->Timestep.Accumulator = 0.0f;
+    State->Timestep.Alpha = 0.0f;
+#ifdef DYNAMICS_FIXED_POINT
+    State->Integrate = IntegrateFixed;
+#else
+    State->Integrate = GetIntegrateFunction(GetSupportedSimdLevel());
+#endif
 }
 
 
 void Shutdown(dynamics_state *State)
 {
-    State->Bodies.clear();
+    Clear(&State->Bodies);
+    State->Broadphase.Proxies.clear();
+    State->Broadphase.RestingProxies.clear();
+    State->Broadphase.Pairs.clear();
+    State->ContactCache.Entries.clear();
+    State->ContactEvents.Events.clear();
+    State->ContactEvents.Pairs.clear();
+    State->Solver.Constraints.clear();
+    State->Solver.Impulses.clear();
+    State->Collisions.clear();
+    State->ConvexShapes.clear();
+}
+
+
+struct integrate_job
+{
+    dynamics_state *State;
+    f32 dt;
+};
+
+// Integrates the runs of awake bodies in the chunk, sleeping bodies are skipped
+static void IntegrateChunk(void *Data, u32 First, u32 Count)
+{
+    integrate_job *Job = static_cast<integrate_job *>(Data);
+    body_arrays *Bodies = &Job->State->Bodies;
+    u32 const *Flags = Bodies->Flags.data();
+    
+    u32 const End = First + Count;
+    u32 Index = First;
+    while (Index < End)
+    {
+        while ((Index < End) && (Flags[Index] & BodyFlag_Sleeping))
+        {
+            ++Index;
+        }
+        
+        u32 RunStart = Index;
+        while ((Index < End) && !(Flags[Index] & BodyFlag_Sleeping))
+        {
+            ++Index;
+        }
+        
+        if (Index > RunStart)
+        {
+            Job->State->Integrate(Bodies, RunStart, Index - RunStart, Job->dt);
+        }
+    }
+}
+
+
+void Update(dynamics_state *State, f32 dt)
+{
+    assert(State);
+    assert(dt > 0.0f);
+    
+    assert(State->Integrate);
+    
+    phase_timer Timer = StartPhase(State);
+    
+    //
+    // A force wakes a sleeping body up
+    body_arrays *Bodies = &State->Bodies;
+    for (u32 Index = 0; Index < Bodies->Count; ++Index)
+    {
+        if ((Bodies->Flags[Index] & BodyFlag_Sleeping) &&
+            ((Bodies->F[Index].x != 0.0f) || (Bodies->F[Index].y != 0.0f)))
+        {
+            WakeUp(State, Index);
+        }
+    }
+    
+    integrate_job Job = {State, dt};
+    ParallelFor(State->Workers, State->Bodies.Count, kIntegrateChunkSize, IntegrateChunk, &Job);
+    
+    State->QueryTree.Refit = true;
+    
+    EndPhase(State, Timer, &State->Stats.Update);
+}
+
+
+u32 Simulate(dynamics_state *State, f32 dt, pre_step_function *PreStep, collisions_function *OnCollisions, void *Data)
+{
+    assert(State);
+    assert(dt >= 0.0f);
+    
+    dynamics_timestep *Timestep = &State->Timestep;
+    assert(Timestep->StepTime > 0.0f);
+    
+    Timestep->Accumulator = Min(Timestep->Accumulator + dt, Timestep->MaxStepCount * Timestep->StepTime);
+    
+    u32 StepCount = 0;
+    while (Timestep->Accumulator >= Timestep->StepTime)
+    {
+        f32 const StepTime = Timestep->StepTime;
+        
+        if (PreStep)
+        {
+            PreStep(State, StepTime, Data);
+        }
+        
+        Update(State, StepTime);
+        
+        State->Collisions.clear();
+        DetectCollisions(State, State->Collisions);
+        
+        if (OnCollisions)
+        {
+            OnCollisions(State, State->Collisions, Data);
+        }
+        
+        ResolveCollisions(State, State->Collisions, StepTime);
+        
+        Timestep->Accumulator -= StepTime;
+        ++StepCount;
+    }
+    
+    Timestep->Alpha = Timestep->Accumulator / Timestep->StepTime;
+    
+    return StepCount;
+}
+
+
+v2 GetInterpolatedP(dynamics_state *State, body_handle Handle)
+{
+    body_index Index = GetBodyIndex(State, Handle);
+    
+    body_arrays *Bodies = &State->Bodies;
+    v2 Result = Lerp(Bodies->PrevP[Index], Bodies->P[Index], State->Timestep.Alpha);
+    return Result;
+}
+
+
+// Cost per operation, 0 when there were none
+static double PerOp(u64 Nanoseconds, u32 Count)
+{
+    double Result = Count ? (static_cast<double>(Nanoseconds) / Count) : 0.0;
+    return Result;
+}
+
+
+size_t FormatStats(dynamics_stats const *Stats, char *Buffer, size_t Size)
+{
+    assert(Stats);
+    assert(Buffer || (Size == 0));
+    
+    int Length = snprintf(Buffer, Size,
+                          "bodies=%u sleeping=%u broadphase_tests=%u pairs=%u collisions=%u batches=%u "
+                          "cache_lookups=%u cache_hits=%u epa_skips=%u "
+                          "update_ns=%llu update_ns_per_body=%.1f update_alloc_bytes=%llu "
+                          "broadphase_ns=%llu broadphase_ns_per_test=%.1f broadphase_alloc_bytes=%llu "
+                          "narrowphase_ns=%llu narrowphase_ns_per_pair=%.1f narrowphase_alloc_bytes=%llu "
+                          "resolve_ns=%llu resolve_ns_per_collision=%.1f resolve_alloc_bytes=%llu "
+                          "array_bytes=%llu",
+                          Stats->BodyCount, Stats->SleepingBodyCount, Stats->BroadphaseTestCount,
+                          Stats->PairTestCount, Stats->CollisionCount, Stats->ContactBatchCount,
+                          Stats->ContactCache.LookupCount, Stats->ContactCache.HitCount, Stats->ContactCache.EPASkipCount,
+                          (unsigned long long)Stats->Update.Nanoseconds, PerOp(Stats->Update.Nanoseconds, Stats->BodyCount),
+                          (unsigned long long)Stats->Update.AllocatedBytes,
+                          (unsigned long long)Stats->Broadphase.Nanoseconds, PerOp(Stats->Broadphase.Nanoseconds, Stats->BroadphaseTestCount),
+                          (unsigned long long)Stats->Broadphase.AllocatedBytes,
+                          (unsigned long long)Stats->Narrowphase.Nanoseconds, PerOp(Stats->Narrowphase.Nanoseconds, Stats->PairTestCount),
+                          (unsigned long long)Stats->Narrowphase.AllocatedBytes,
+                          (unsigned long long)Stats->Resolve.Nanoseconds, PerOp(Stats->Resolve.Nanoseconds, Stats->CollisionCount),
+                          (unsigned long long)Stats->Resolve.AllocatedBytes,
+                          (unsigned long long)Stats->ArrayBytes);
+    
+    size_t Result = Length > 0 ? static_cast<size_t>(Length) : 0;
+    return Result;
+}
+
+
+body_handle NewRectangleBody(dynamics_state *State, v2 Size, void *UserData)
+{
+    assert(State);
+    
+    body_arrays *Bodies = &State->Bodies;
+    body_index Index = AddBody(Bodies);
+    
+    Bodies->Shapes[Index].Type = ShapeType_Rectangle;
+    Bodies->Shapes[Index].HalfSize = 0.5f*Size;
+    Bodies->UserData[Index] = UserData;
+    
+    body_handle Result = GetBodyHandle(State, Index);
+    return Result;
+}
+
+
+body_handle NewCircleBody(dynamics_state *State, f32 Radius, void *UserData)
+{
+    assert(State);
+    
+    body_arrays *Bodies = &State->Bodies;
+    body_index Index = AddBody(Bodies);
+    
+    Bodies->Shapes[Index].Type = ShapeType_Circle;
+    Bodies->Shapes[Index].Radius = Radius;
+    Bodies->UserData[Index] = UserData;
+    
+    body_handle Result = GetBodyHandle(State, Index);
+    return Result;
+}
+
+
+body_handle NewConvexBody(dynamics_state *State, convex_shape const *Shape, void *UserData)
+{
+    assert(State);
+    assert(Shape);
+    
+    body_arrays *Bodies = &State->Bodies;
+    body_index Index = AddBody(Bodies);
+    
+    Bodies->Shapes[Index].Type = ShapeType_Convex;
+    Bodies->Shapes[Index].Convex = Shape;
+    Bodies->UserData[Index] = UserData;
+    
+    body_handle Result = GetBodyHandle(State, Index);
+    return Result;
+}
+
+
+static b32 LessXY(v2 const& A, v2 const& B)
+{
+    return (A.x < B.x) || ((A.x == B.x) && (A.y < B.y));
+}
+
+
+convex_shape const *NewPolygonShape(dynamics_state *State, v2 const *Vertices, u32 Count, f32 Angle, f32 Radius)
+{
+    assert(State);
+    assert(Vertices);
+    assert((Count > 0) && (Count <= kMaxConvexVertexCount));
+    assert(Radius >= 0.0f);
+    
+    //
+    // Rotate and sort the vertices for the hull
+    f32 const c = Cos(Angle);
+    f32 const s = Sin(Angle);
+    
+    v2 Points[kMaxConvexVertexCount];
+    for (u32 Index = 0; Index < Count; ++Index)
+    {
+        v2 V = Vertices[Index];
+        Points[Index] = V2(c*V.x - s*V.y, s*V.x + c*V.y);
+    }
+    std::sort(Points, Points + Count, LessXY);
+    Count = static_cast<u32>(std::unique(Points, Points + Count, [](v2 const& A, v2 const& B) { return (A.x == B.x) && (A.y == B.y); }) - Points);
+    
+    //
+    // Monotone chain, the lower hull from left to right and then the upper one back. Collinear and
+    // duplicate vertices are dropped, they would only slow down the support function.
+    v2 Hull[2 * kMaxConvexVertexCount];
+    u32 HullCount = 0;
+    
+    for (u32 Pass = 0; Pass < 2; ++Pass)
+    {
+        u32 const Start = HullCount;
+        for (u32 Step = 0; Step < Count; ++Step)
+        {
+            v2 P = Points[Pass == 0 ? Step : (Count - 1 - Step)];
+            while ((HullCount >= Start + 2) && (Cross(Hull[HullCount - 1] - Hull[HullCount - 2], P - Hull[HullCount - 2]) <= 0.0f))
+            {
+                --HullCount;
+            }
+            Hull[HullCount++] = P;
+        }
+        
+        // The last vertex is the first one of the other chain
+        --HullCount;
+    }
+    
+    // All the vertices were the same
+    if (HullCount == 0)
+    {
+        Hull[HullCount++] = Points[0];
+    }
+    
+    convex_shape Shape;
+    Shape.VertexCount = HullCount;
+    Shape.Radius = Radius;
+    Shape.Bounds.Min = Hull[0];
+    Shape.Bounds.Max = Hull[0];
+    
+    for (u32 Index = 0; Index < kMaxConvexVertexCount; ++Index)
+    {
+        v2 V = Hull[Index < HullCount ? Index : 0];
+        Shape.X[Index] = V.x;
+        Shape.Y[Index] = V.y;
+        
+        Shape.Bounds.Min = V2(Min(Shape.Bounds.Min.x, V.x), Min(Shape.Bounds.Min.y, V.y));
+        Shape.Bounds.Max = V2(Max(Shape.Bounds.Max.x, V.x), Max(Shape.Bounds.Max.y, V.y));
+    }
+    
+    Shape.Bounds.Min -= V2(Radius, Radius);
+    Shape.Bounds.Max += V2(Radius, Radius);
+    
+    State->ConvexShapes.push_back(Shape);
+    return &State->ConvexShapes.back();
+}
+
+
+convex_shape const *NewCapsuleShape(dynamics_state *State, f32 Length, f32 Radius, f32 Angle)
+{
+    v2 Vertices[2] = {V2(-0.5f * Length, 0.0f), V2(0.5f * Length, 0.0f)};
+    
+    convex_shape const *Result = NewPolygonShape(State, Vertices, 2, Angle, Radius);
+    return Result;
+}
+
+
+void DestroyBody(dynamics_state *State, body_handle Handle)
+{
+    body_index Index = GetBodyIndex(State, Handle);
+    
+    RemoveBody(&State->Bodies, Index);
+    
+    // The proxies refer to the body indices, and the last body was moved
+    State->Broadphase.Rebuild = true;
+    State->QueryTree.Rebuild = true;
+}
+
+
+b32 IsValid(dynamics_state *State, body_handle Handle)
+{
+    assert(State);
+    
+    body_arrays *Bodies = &State->Bodies;
+    b32 Result = (Handle.Slot < Bodies->Slots.size()) && (Bodies->Slots[Handle.Slot].Generation == Handle.Generation);
+    return Result;
+}
+
+
+body GetBody(dynamics_state *State, body_handle Handle)
+{
+    body_index BodyIndex = GetBodyIndex(State, Handle);
+    
+    body_arrays *Bodies = &State->Bodies;
+    body Result = 
+    {
+        Bodies->UserData[BodyIndex],
+        Bodies->Shapes[BodyIndex],
+        Bodies->P[BodyIndex],
+        Bodies->PrevP[BodyIndex],
+        Bodies->dP[BodyIndex],
+        Bodies->dPMax[BodyIndex],
+        Bodies->dPMask[BodyIndex],
+        Bodies->F[BodyIndex],
+        Bodies->Damping[BodyIndex],
+        Bodies->InverseMass[BodyIndex],
+        Bodies->Restitution[BodyIndex],
+        Bodies->Friction[BodyIndex],
+        Bodies->Flags[BodyIndex],
+    };
+    
+    return Result;
+}
+
+
+body_index GetBodyIndex(dynamics_state *State, body_handle Handle)
+{
+    assert(IsValid(State, Handle));
+    
+    body_index Result = static_cast<body_index>(State->Bodies.Slots[Handle.Slot].Index);
+    return Result;
+}
+
+
+body_handle GetBodyHandle(dynamics_state *State, body_index BodyIndex)
+{
+    assert(State);
+    assert((BodyIndex >= 0) && (static_cast<u32>(BodyIndex) < State->Bodies.Count));
+    
+    body_arrays *Bodies = &State->Bodies;
+    
+    body_handle Result;
+    Result.Slot = Bodies->SlotIndices[BodyIndex];
+    Result.Generation = Bodies->Slots[Result.Slot].Generation;
+    
+    return Result;
+}
+
+
+void SetP(dynamics_state *State, body_handle Handle, v2 Po)
+{
+    body_index BodyIndex = GetBodyIndex(State, Handle);
+    
+    body_arrays *Bodies = &State->Bodies;
+    Bodies->P[BodyIndex] = Po;
+    Bodies->PrevP[BodyIndex] = Po;
+    
+    Bodies->dP[BodyIndex] = v2_zero;
+    Bodies->F[BodyIndex] = v2_zero;
+    
+    State->QueryTree.Refit = true;
+    
+    // Resting bodies are only put into the broadphase when it is rebuilt
+    if (Bodies->Flags[BodyIndex] & BodyFlag_Sleeping)
+    {
+        WakeUp(State, BodyIndex);
+        State->Broadphase.Rebuild = true;
+    }
+}
+
+
+void SetType(dynamics_state *State, body_handle Handle, body_type Type)
+{
+    body_index BodyIndex = GetBodyIndex(State, Handle);
+    
+    body_arrays *Bodies = &State->Bodies;
+    Bodies->Types[BodyIndex] = Type;
+    
+    if (Type == BodyType_Dynamic)
+    {
+        WakeUp(State, BodyIndex);
+    }
+    else
+    {
+        Bodies->InverseMass[BodyIndex] = 0.0f;
+        
+        if (Type == BodyType_Static)
+        {
+            Sleep(State, BodyIndex);
+        }
+        else if (Bodies->Flags[BodyIndex] & BodyFlag_Sleeping)
+        {
+            Bodies->Flags[BodyIndex] &= ~BodyFlag_Sleeping;
+            State->Broadphase.Rebuild = true;
+        }
+    }
+}
+
+
+body_type GetType(dynamics_state *State, body_handle Handle)
+{
+    body_type Result = State->Bodies.Types[GetBodyIndex(State, Handle)];
+    return Result;
+}
+
+
+void SetCollisionFilter(dynamics_state *State, body_handle Handle, u32 Layer, u32 Mask)
+{
+    body_index BodyIndex = GetBodyIndex(State, Handle);
+    
+    body_arrays *Bodies = &State->Bodies;
+    Bodies->Layers[BodyIndex] = Layer;
+    Bodies->Masks[BodyIndex] = Mask;
+    
+    // The resting proxies only get the filter when they are rebuilt
+    if (Bodies->Flags[BodyIndex] & BodyFlag_Sleeping)
+    {
+        State->Broadphase.Rebuild = true;
+    }
+}
+
+
+u32 GetCollisionLayer(dynamics_state *State, body_handle Handle)
+{
+    u32 Result = State->Bodies.Layers[GetBodyIndex(State, Handle)];
+    return Result;
+}
+
+
+u32 GetCollisionMask(dynamics_state *State, body_handle Handle)
+{
+    u32 Result = State->Bodies.Masks[GetBodyIndex(State, Handle)];
+    return Result;
+}
+
+
+aabb GetAABB(v2 P, shape *Shape)
+{
+    assert(Shape);
+    
+    v2 HalfSize;
+    
+    switch (Shape->Type)
+    {
+        case ShapeType_Rectangle:
+        {
+            HalfSize = Shape->HalfSize;
+        } break;
+        
+        case ShapeType_Circle:
+        {
+            HalfSize = V2(Shape->Radius, Shape->Radius);
+        } break;
+        
+        case ShapeType_Convex:
+        {
+            aabb Result;
+            Result.Min = P + Shape->Convex->Bounds.Min;
+            Result.Max = P + Shape->Convex->Bounds.Max;
+            return Result;
+        }
+        
+        default:
+        {
+            HalfSize = v2_zero;
+            assert(0);
+        } break;
+    }
+    
+    aabb Result;
+    Result.Min = P - HalfSize;
+    Result.Max = P + HalfSize;
+    
+    return Result;
+}
+
+
+aabb GetAABB(dynamics_state *State, body_handle Handle)
+{
+    aabb Result = GetAABB(State, GetBodyIndex(State, Handle));
+    return Result;
+}
+
+
+aabb GetAABB(dynamics_state *State, body_index BodyIndex)
+{
+    assert(State);
+    
+    aabb Result = GetAABB(State->Bodies.P[BodyIndex], &State->Bodies.Shapes[BodyIndex]);
+    return Result;
+}
+
+
+// FNV-1a, byte by byte so that it doesn't depend on the alignment or the endianness of the words
+static u64 HashBytes(u64 Hash, void const *Data, size_t Size)
+{
+    u8 const *Bytes = static_cast<u8 const *>(Data);
+    for (size_t Index = 0; Index < Size; ++Index)
+    {
+        Hash ^= Bytes[Index];
+        Hash *= 0x100000001b3ull;
+    }
+    
+    return Hash;
+}
+
+
+template <typename T>
+static u64 HashArray(u64 Hash, std::vector<T> const& Array, u32 Count)
+{
+    return HashBytes(Hash, Array.data(), Count * sizeof(T));
+}
+
+
+u64 Checksum(dynamics_state *State)
+{
+    assert(State);
+    
+    body_arrays *Bodies = &State->Bodies;
+    u32 const Count = Bodies->Count;
+    
+    u64 Hash = 0xcbf29ce484222325ull;
+    Hash = HashBytes(Hash, &Count, sizeof(Count));
+    
+    //
+    // The bodies in index order, the user data is left out since it is usually a pointer. So is
+    // the pointer to the convex shapes, their vertices are hashed instead.
+    for (u32 Index = 0; Index < Count; ++Index)
+    {
+        shape const& Shape = Bodies->Shapes[Index];
+        Hash = HashBytes(Hash, &Shape.Type, sizeof(Shape.Type));
+        
+        if (Shape.Type == ShapeType_Convex)
+        {
+            convex_shape const *Convex = Shape.Convex;
+            Hash = HashBytes(Hash, Convex->X, sizeof(Convex->X));
+            Hash = HashBytes(Hash, Convex->Y, sizeof(Convex->Y));
+            Hash = HashBytes(Hash, &Convex->Radius, sizeof(Convex->Radius));
+        }
+        else
+        {
+            Hash = HashBytes(Hash, &Shape.HalfSize, sizeof(Shape.HalfSize));
+        }
+    }
+    
+    Hash = HashArray(Hash, Bodies->P, Count);
+    Hash = HashArray(Hash, Bodies->PrevP, Count);
+    Hash = HashArray(Hash, Bodies->dP, Count);
+    Hash = HashArray(Hash, Bodies->dPMax, Count);
+    Hash = HashArray(Hash, Bodies->dPMask, Count);
+    Hash = HashArray(Hash, Bodies->F, Count);
+    Hash = HashArray(Hash, Bodies->Damping, Count);
+    Hash = HashArray(Hash, Bodies->InverseMass, Count);
+    Hash = HashArray(Hash, Bodies->Restitution, Count);
+    Hash = HashArray(Hash, Bodies->Friction, Count);
+    Hash = HashArray(Hash, Bodies->Flags, Count);
+    Hash = HashArray(Hash, Bodies->Types, Count);
+    Hash = HashArray(Hash, Bodies->SleepTimes, Count);
+    Hash = HashArray(Hash, Bodies->Layers, Count);
+    Hash = HashArray(Hash, Bodies->Masks, Count);
+    Hash = HashArray(Hash, Bodies->SlotIndices, Count);
+    
+    //
+    // The handles, a different free list gives different handles to new bodies
+    for (body_slot const& Slot : Bodies->Slots)
+    {
+        Hash = HashBytes(Hash, &Slot.Generation, sizeof(Slot.Generation));
+        Hash = HashBytes(Hash, &Slot.Index, sizeof(Slot.Index));
+    }
+    Hash = HashBytes(Hash, &Bodies->FirstFreeSlot, sizeof(Bodies->FirstFreeSlot));
+    
+    //
+    // The contact cache decides when EPA is skipped, so it changes the next result as well.
+    // Field by field, the entries have padding.
+    for (contact_cache_entry const& Entry : State->ContactCache.Entries)
+    {
+        Hash = HashBytes(Hash, &Entry.Key, sizeof(Entry.Key));
+        Hash = HashBytes(Hash, Entry.Generations, sizeof(Entry.Generations));
+        Hash = HashBytes(Hash, &Entry.N, sizeof(Entry.N));
+        Hash = HashBytes(Hash, &Entry.Depth, sizeof(Entry.Depth));
+        Hash = HashBytes(Hash, &Entry.D, sizeof(Entry.D));
+    }
+    
+    // The impulses that the next step starts out from
+    for (contact_impulse const& Impulse : State->Solver.Impulses)
+    {
+        Hash = HashBytes(Hash, &Impulse, sizeof(Impulse));
+    }
+    
+    Hash = HashBytes(Hash, &State->Timestep.Accumulator, sizeof(State->Timestep.Accumulator));
+    
+    return Hash;
+}
+
+
+//
+// Snapshots
+//
+
+// Calls Function for each of the per-body arrays, in the order they are stored in a snapshot.
+// Adding, removing and clearing bodies go through it as well, so a new array only goes here.
+template <typename function>
+static void ForEachBodyArray(body_arrays *Bodies, function Function)
+{
+    Function(Bodies->UserData);
+    Function(Bodies->Shapes);
+    Function(Bodies->P);
+    Function(Bodies->PrevP);
+    Function(Bodies->dP);
+    Function(Bodies->dPMax);
+    Function(Bodies->dPMask);
+    Function(Bodies->F);
+    Function(Bodies->Damping);
+    Function(Bodies->InverseMass);
+    Function(Bodies->Restitution);
+    Function(Bodies->Friction);
+    Function(Bodies->Flags);
+    Function(Bodies->Types);
+    Function(Bodies->SleepTimes);
+    Function(Bodies->Layers);
+    Function(Bodies->Masks);
+    Function(Bodies->SlotIndices);
+}
+
+
+size_t GetSnapshotSize(dynamics_state *State)
+{
+    assert(State);
+    
+    body_arrays *Bodies = &State->Bodies;
+    
+    size_t Result = sizeof(dynamics_snapshot_header);
+    ForEachBodyArray(Bodies, [&](auto& Array) { Result += Bodies->Count * sizeof(Array[0]); });
+    Result += Bodies->Slots.size() * sizeof(body_slot);
+    Result += State->ContactCache.Entries.size() * sizeof(contact_cache_entry);
+    Result += State->Solver.Impulses.size() * sizeof(contact_impulse);
+    Result += State->ContactEvents.Pairs.size() * sizeof(contact_event_pair);
+    
+    return Result;
+}
+
+
+size_t SaveSnapshot(dynamics_state *State, void *Memory, size_t Size)
+{
+    assert(State);
+    assert(Memory);
+    
+    size_t Result = GetSnapshotSize(State);
+    if (Result > Size)
+    {
+        return 0;
+    }
+    
+    body_arrays *Bodies = &State->Bodies;
+    std::vector<contact_cache_entry>& Contacts = State->ContactCache.Entries;
+    std::vector<contact_impulse>& Impulses = State->Solver.Impulses;
+    std::vector<contact_event_pair>& EventPairs = State->ContactEvents.Pairs;
+    
+    dynamics_snapshot_header Header;
+    Header.Size = static_cast<u32>(Result);
+    Header.BodyCount = Bodies->Count;
+    Header.SlotCount = static_cast<u32>(Bodies->Slots.size());
+    Header.FirstFreeSlot = Bodies->FirstFreeSlot;
+    Header.ContactCount = static_cast<u32>(Contacts.size());
+    Header.ImpulseCount = static_cast<u32>(Impulses.size());
+    Header.EventPairCount = static_cast<u32>(EventPairs.size());
+    Header.Accumulator = State->Timestep.Accumulator;
+    Header.Alpha = State->Timestep.Alpha;
+    
+    u8 *At = static_cast<u8 *>(Memory);
+    memcpy(At, &Header, sizeof(Header));
+    At += sizeof(Header);
+    
+    ForEachBodyArray(Bodies, [&](auto& Array)
+    {
+        size_t ArraySize = Bodies->Count * sizeof(Array[0]);
+        memcpy(At, Array.data(), ArraySize);
+        At += ArraySize;
+    });
+    
+    memcpy(At, Bodies->Slots.data(), Header.SlotCount * sizeof(body_slot));
+    At += Header.SlotCount * sizeof(body_slot);
+    
+    memcpy(At, Contacts.data(), Header.ContactCount * sizeof(contact_cache_entry));
+    At += Header.ContactCount * sizeof(contact_cache_entry);
+    
+    memcpy(At, Impulses.data(), Header.ImpulseCount * sizeof(contact_impulse));
+    At += Header.ImpulseCount * sizeof(contact_impulse);
+    
+    memcpy(At, EventPairs.data(), Header.EventPairCount * sizeof(contact_event_pair));
+    
+    return Result;
+}
+
+
+b32 RestoreSnapshot(dynamics_state *State, void const *Memory, size_t Size)
+{
+    assert(State);
+    assert(Memory);
+    
+    dynamics_snapshot_header Header;
+    if (Size < sizeof(Header))
+    {
+        return false;
+    }
+    
+    u8 const *At = static_cast<u8 const *>(Memory);
+    memcpy(&Header, At, sizeof(Header));
+    At += sizeof(Header);
+    
+    if (Header.Size > Size)
+    {
+        return false;
+    }
+    
+    body_arrays *Bodies = &State->Bodies;
+    Bodies->Count = Header.BodyCount;
+    
+    ForEachBodyArray(Bodies, [&](auto& Array)
+    {
+        size_t ArraySize = Bodies->Count * sizeof(Array[0]);
+        Array.resize(Bodies->Count);
+        memcpy(Array.data(), At, ArraySize);
+        At += ArraySize;
+    });
+    
+    Bodies->Slots.resize(Header.SlotCount);
+    memcpy(Bodies->Slots.data(), At, Header.SlotCount * sizeof(body_slot));
+    At += Header.SlotCount * sizeof(body_slot);
+    Bodies->FirstFreeSlot = Header.FirstFreeSlot;
+    
+    std::vector<contact_cache_entry>& Contacts = State->ContactCache.Entries;
+    Contacts.resize(Header.ContactCount);
+    memcpy(Contacts.data(), At, Header.ContactCount * sizeof(contact_cache_entry));
+    At += Header.ContactCount * sizeof(contact_cache_entry);
+    
+    std::vector<contact_impulse>& Impulses = State->Solver.Impulses;
+    Impulses.resize(Header.ImpulseCount);
+    memcpy(Impulses.data(), At, Header.ImpulseCount * sizeof(contact_impulse));
+    At += Header.ImpulseCount * sizeof(contact_impulse);
+    
+    std::vector<contact_event_pair>& EventPairs = State->ContactEvents.Pairs;
+    EventPairs.resize(Header.EventPairCount);
+    memcpy(EventPairs.data(), At, Header.EventPairCount * sizeof(contact_event_pair));
+    
+    State->Timestep.Accumulator = Header.Accumulator;
+    State->Timestep.Alpha = Header.Alpha;
+    
+    assert(GetSnapshotSize(State) == Header.Size);
+    
+    // The proxies and the query tree are derived from the bodies, they are not part of the snapshot.
+    // The events are the output of the last call and are left as they are.
+    State->Broadphase.Rebuild = true;
+    State->QueryTree.Rebuild = true;
+    
+    return true;
+}
+
+
+struct narrowphase_job
+{
+    dynamics_state *State;
+};
+
+static void NarrowphaseChunk(void *Data, u32 First, u32 Count)
+{
+    narrowphase_job *Job = static_cast<narrowphase_job *>(Data);
+    body_arrays *Bodies = &Job->State->Bodies;
+    body_pair *Pairs = Job->State->Broadphase.Pairs.data();
+    
+    u32 const Chunk = First / kNarrowphaseChunkSize;
+    
+    std::vector<collision_info>& Output = Job->State->ChunkCollisions[Chunk];
+    Output.clear();
+    
+    std::vector<contact_cache_entry>& CacheEntries = Job->State->ContactCache.ChunkEntries[Chunk];
+    CacheEntries.clear();
+    
+    contact_cache_stats *CacheStats = &Job->State->ContactCache.ChunkStats[Chunk];
+    *CacheStats = contact_cache_stats();
+    
+    for (u32 Index = First; Index < (First + Count); ++Index)
+    {
+        body_pair Pair = Pairs[Index];
+        
+        //
+        // Continuous bodies are swept first, the discrete test at the end position is still
+        // needed for when they are already touching at the start of the step.
+        b32 Continuous = ((Bodies->Flags[Pair.A] | Bodies->Flags[Pair.B]) & BodyFlag_Continuous) != 0;
+        
+        collision_info Collision;
+        b32 Hit = Continuous && IntersectsSwept(Bodies, Pair.A, Pair.B, &Collision);
+        
+        if (!Hit)
+        {
+            shape *A = &Bodies->Shapes[Pair.A];
+            shape *B = &Bodies->Shapes[Pair.B];
+            
+            if (UsesGJK(A, B))
+            {
+                Hit = IntersectsCached(Job->State, Pair.A, Pair.B, &Collision, CacheEntries, CacheStats);
+            }
+            else
+            {
+                Hit = Intersects(Bodies->P[Pair.A], A, Bodies->P[Pair.B], B, &Collision);
+            }
+        }
+        
+        if (Hit)
+        {
+            Collision.BodiesInvolved[0] = Pair.A;
+            Collision.BodiesInvolved[1] = Pair.B;
+            Collision.Handles[0] = GetBodyHandle(Job->State, Pair.A);
+            Collision.Handles[1] = GetBodyHandle(Job->State, Pair.B);
+            Collision.UserData[0] = Bodies->UserData[Pair.A];
+            Collision.UserData[1] = Bodies->UserData[Pair.B];
+            Output.push_back(Collision);
+        }
+    }
+}
+
+
+void DetectCollisions(dynamics_state *State, std::vector<collision_info>& Output)
+{
+    assert(State);
+    
+    phase_timer Timer = StartPhase(State);
+    UpdateBroadphase(State);
+    EndPhase(State, Timer, &State->Stats.Broadphase);
+    
+    Timer = StartPhase(State);
+    
+    u32 PairCount = static_cast<u32>(State->Broadphase.Pairs.size());
+    u32 ChunkCount = (PairCount + kNarrowphaseChunkSize - 1) / kNarrowphaseChunkSize;
+    if (State->ChunkCollisions.size() < ChunkCount)
+    {
+        State->ChunkCollisions.resize(ChunkCount);
+        State->ContactCache.ChunkEntries.resize(ChunkCount);
+        State->ContactCache.ChunkStats.resize(ChunkCount);
+    }
+    
+    narrowphase_job Job = {State};
+    ParallelFor(State->Workers, PairCount, kNarrowphaseChunkSize, NarrowphaseChunk, &Job);
+    
+    size_t FirstNew = Output.size();
+    for (u32 Chunk = 0; Chunk < ChunkCount; ++Chunk)
+    {
+        std::vector<collision_info>& Collisions = State->ChunkCollisions[Chunk];
+        Output.insert(Output.end(), Collisions.begin(), Collisions.end());
+    }
+    
+    UpdateContactCache(State, ChunkCount);
+    
+    //
+    // Awake bodies wake up the sleeping bodies they touch. Resting bodies are never paired with
+    // each other, so one of the two is always awake.
+    for (size_t Index = FirstNew; Index < Output.size(); ++Index)
+    {
+        WakeUp(State, Output[Index].BodiesInvolved[0]);
+        WakeUp(State, Output[Index].BodiesInvolved[1]);
+    }
+    
+    UpdateContactEvents(State, Output, FirstNew);
+    
+    State->Stats.PairTestCount = PairCount;
+    State->Stats.CollisionCount = static_cast<u32>(Output.size() - FirstNew);
+    
+    EndPhase(State, Timer, &State->Stats.Narrowphase);
+}
+
+
+enum solver_pass
+{
+    SolverPass_WarmStart,
+    SolverPass_Velocity,
+    SolverPass_Position,
+};
+
+struct solve_job
+{
+    body_arrays *Bodies;
+    contact_solver *Solver;
+    u32 *Order;
+    solver_pass Pass;
+};
+
+static void SolveChunk(void *Data, u32 First, u32 Count)
+{
+    solve_job *Job = static_cast<solve_job *>(Data);
+    contact_solver *Solver = Job->Solver;
+    
+    for (u32 Index = First; Index < (First + Count); ++Index)
+    {
+        contact_constraint *Constraint = &Solver->Constraints[Job->Order[Index]];
+        
+        switch (Job->Pass)
+        {
+            case SolverPass_WarmStart: WarmStart(Job->Bodies, Constraint); break;
+            case SolverPass_Velocity:  SolveVelocity(Job->Bodies, Constraint); break;
+            case SolverPass_Position:  SolvePosition(Job->Bodies, Constraint, Solver->Baumgarte, Solver->Slop); break;
+        }
+    }
+}
+
+
+// One pass over all the contacts. The batches are always done in order, so that the result is
+// the same no matter if, and on how many threads, the contacts within a batch are solved.
+static void SolveBatches(dynamics_state *State, solver_pass Pass)
+{
+    contact_batches *Batches = &State->Batches;
+    for (u32 Batch = 0; Batch <= kMaxContactBatchCount; ++Batch)
+    {
+        u32 First = Batches->Offsets[Batch];
+        u32 Count = Batches->Offsets[Batch + 1] - First;
+        
+        // The last batch might have several contacts involving the same body
+        u32 ChunkSize = Batch < kMaxContactBatchCount ? kResolveChunkSize : Max(Count, 1u);
+        
+        solve_job Job = {&State->Bodies, &State->Solver, Batches->Order.data() + First, Pass};
+        ParallelFor(State->Workers, Count, ChunkSize, SolveChunk, &Job);
+    }
+}
+
+
+struct prepare_job
+{
+    dynamics_state *State;
+    collision_info *Contacts;
+};
+
+static void PrepareChunk(void *Data, u32 First, u32 Count)
+{
+    prepare_job *Job = static_cast<prepare_job *>(Data);
+    
+    for (u32 Index = First; Index < (First + Count); ++Index)
+    {
+        PrepareContact(Job->State, &Job->Contacts[Index], &Job->State->Solver.Constraints[Index]);
+    }
+}
+
+
+void ResolveCollisions(dynamics_state *State, std::vector<collision_info>& Input, f32 dt)
+{
+    assert(State);
+    
+    phase_timer Timer = StartPhase(State);
+    
+    BuildContactBatches(State, Input);
+    
+    //
+    // Setting up only reads the bodies, so it is done for all the contacts at once
+    contact_solver *Solver = &State->Solver;
+    u32 const ContactCount = static_cast<u32>(Input.size());
+    Solver->Constraints.resize(ContactCount);
+    
+    prepare_job PrepareJob = {State, Input.data()};
+    ParallelFor(State->Workers, ContactCount, kResolveChunkSize, PrepareChunk, &PrepareJob);
+    
+    SolveBatches(State, SolverPass_WarmStart);
+    
+    for (u32 Iteration = 0; Iteration < Solver->VelocityIterations; ++Iteration)
+    {
+        SolveBatches(State, SolverPass_Velocity);
+    }
+    
+    for (u32 Iteration = 0; Iteration < Solver->PositionIterations; ++Iteration)
+    {
+        SolveBatches(State, SolverPass_Position);
+    }
+    
+    StoreImpulses(State, Input);
+    
+    // The bodies were pushed apart
+    State->QueryTree.Refit = true;
+    
+    UpdateSleep(State, dt);
+    
+    EndPhase(State, Timer, &State->Stats.Resolve);
+}
+
+
+
+
+//
+// Stats
+//
+
+phase_timer StartPhase(dynamics_state *State)
+{
+    phase_timer Result;
+    Result.Start = static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    Result.ArrayBytes = GetArrayBytes(State);
+    return Result;
+}
+
+
+void EndPhase(dynamics_state *State, phase_timer const& Timer, dynamics_phase_stats *Phase)
+{
+    u64 End = static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    u64 ArrayBytes = GetArrayBytes(State);
+    
+    Phase->Nanoseconds = End - Timer.Start;
+    Phase->AllocatedBytes = ArrayBytes > Timer.ArrayBytes ? (ArrayBytes - Timer.ArrayBytes) : 0;
+    State->Stats.ArrayBytes = ArrayBytes;
+}
+
+
+template <typename T>
+static u64 GetCapacityBytes(std::vector<T> const& Array)
+{
+    u64 Result = Array.capacity() * sizeof(T);
+    return Result;
+}
+
+
+template <typename T>
+static u64 GetCapacityBytes(std::vector<std::vector<T>> const& Arrays)
+{
+    u64 Result = Arrays.capacity() * sizeof(std::vector<T>);
+    for (std::vector<T> const& Array : Arrays)
+    {
+        Result += GetCapacityBytes(Array);
+    }
+    return Result;
+}
+
+
+// The arrays that the steps use, the ones owned by the query tree and the collisions passed in
+// by the caller are left out
+u64 GetArrayBytes(dynamics_state *State)
+{
+    u64 Result = 0;
+    
+    ForEachBodyArray(&State->Bodies, [&](auto const& Array)
+    {
+        Result += GetCapacityBytes(Array);
+    });
+    Result += GetCapacityBytes(State->Bodies.Slots);
+    
+    broadphase *Broadphase = &State->Broadphase;
+    Result += GetCapacityBytes(Broadphase->Proxies);
+    Result += GetCapacityBytes(Broadphase->RestingProxies);
+    Result += GetCapacityBytes(Broadphase->Pairs);
+    Result += GetCapacityBytes(Broadphase->ChunkPairs);
+    Result += GetCapacityBytes(Broadphase->ChunkTestCounts);
+    
+    contact_batches *Batches = &State->Batches;
+    Result += GetCapacityBytes(Batches->BodyColours);
+    Result += GetCapacityBytes(Batches->Colours);
+    Result += GetCapacityBytes(Batches->Order);
+    
+    contact_solver *Solver = &State->Solver;
+    Result += GetCapacityBytes(Solver->Constraints);
+    Result += GetCapacityBytes(Solver->Impulses);
+    Result += GetCapacityBytes(Solver->NewImpulses);
+    
+    contact_cache *Cache = &State->ContactCache;
+    Result += GetCapacityBytes(Cache->Entries);
+    Result += GetCapacityBytes(Cache->NewEntries);
+    Result += GetCapacityBytes(Cache->ChunkEntries);
+    Result += GetCapacityBytes(Cache->ChunkStats);
+    
+    contact_events *Events = &State->ContactEvents;
+    Result += GetCapacityBytes(Events->Events);
+    Result += GetCapacityBytes(Events->Pairs);
+    Result += GetCapacityBytes(Events->NewPairs);
+    
+    Result += GetCapacityBytes(State->ChunkCollisions);
+    
+    return Result;
+}
+
+
+
+
+//
+// Body storage
+//
+
+body_index AddBody(body_arrays *Bodies)
+{
+    assert(Bodies);
+    
+    body_index Result = static_cast<body_index>(Bodies->Count);
+    
+    // Zero in every array, then the defaults that aren't
+    ForEachBodyArray(Bodies, [](auto& Array) { Array.emplace_back(); });
+    
+    Bodies->Shapes[Result].BodyIndex = Result;
+    Bodies->dPMax[Result] = V2(f32Max, f32Max);
+    Bodies->dPMask[Result] = v2_one;
+    Bodies->InverseMass[Result] = 1.0f;
+    Bodies->Restitution[Result] = 1.0f;
+    Bodies->Types[Result] = BodyType_Dynamic;
+    Bodies->Layers[Result] = kDefaultCollisionLayer;
+    Bodies->Masks[Result] = kAllCollisionLayers;
+    
+    //
+    // Reuse a free slot if there is one, it keeps the generation it got when it was freed
+    u32 Slot = Bodies->FirstFreeSlot;
+    if (Slot != kInvalidBodySlot)
+    {
+        Bodies->FirstFreeSlot = Bodies->Slots[Slot].Index;
+    }
+    else
+    {
+        Slot = static_cast<u32>(Bodies->Slots.size());
+        Bodies->Slots.push_back(body_slot());
+    }
+    
+    Bodies->Slots[Slot].Index = static_cast<u32>(Result);
+    Bodies->SlotIndices[Result] = Slot;
+    
+    ++Bodies->Count;
+    
+    return Result;
+}
+
+
+template <typename T>
+static void MoveLastTo(std::vector<T>& Array, body_index Index)
+{
+    Array[Index] = Array.back();
+    Array.pop_back();
+}
+
+
+// Moves the last body into the place of the removed one, so that the arrays stay packed
+void RemoveBody(body_arrays *Bodies, body_index Index)
+{
+    assert(Bodies);
+    assert((Index >= 0) && (static_cast<u32>(Index) < Bodies->Count));
+    
+    //
+    // Free the slot, the new generation makes the handles to it invalid
+    u32 Slot = Bodies->SlotIndices[Index];
+    ++Bodies->Slots[Slot].Generation;
+    Bodies->Slots[Slot].Index = Bodies->FirstFreeSlot;
+    Bodies->FirstFreeSlot = Slot;
+    
+    ForEachBodyArray(Bodies, [Index](auto& Array) { MoveLastTo(Array, Index); });
+    
+    --Bodies->Count;
+    
+    //
+    // Point the slot of the moved body to its new place
+    if (static_cast<u32>(Index) < Bodies->Count)
+    {
+        Bodies->Shapes[Index].BodyIndex = Index;
+        Bodies->Slots[Bodies->SlotIndices[Index]].Index = static_cast<u32>(Index);
+    }
+}
+
+
+void Clear(body_arrays *Bodies)
+{
+    assert(Bodies);
+    
+    //
+    // Free all the slots, with new generations for the ones in use so that no old handle can
+    // refer to a new body.
+    for (u32 Index = 0; Index < Bodies->Count; ++Index)
+    {
+        ++Bodies->Slots[Bodies->SlotIndices[Index]].Generation;
+    }
+    
+    ForEachBodyArray(Bodies, [](auto& Array) { Array.clear(); });
+    
+    Bodies->FirstFreeSlot = kInvalidBodySlot;
+    for (u32 Slot = static_cast<u32>(Bodies->Slots.size()); Slot > 0; --Slot)
+    {
+        Bodies->Slots[Slot - 1].Index = Bodies->FirstFreeSlot;
+        Bodies->FirstFreeSlot = Slot - 1;
+    }
+    
+    Bodies->Count = 0;
+}
+
+
+
+
+//
+// Sleeping
+//
+
+void WakeUp(dynamics_state *State, body_handle Handle)
+{
+    WakeUp(State, GetBodyIndex(State, Handle));
+}
+
+
+void WakeUp(dynamics_state *State, body_index BodyIndex)
+{
+    assert(State);
+    
+    body_arrays *Bodies = &State->Bodies;
+    if ((Bodies->Flags[BodyIndex] & BodyFlag_Sleeping) && (Bodies->Types[BodyIndex] == BodyType_Dynamic))
+    {
+        Bodies->Flags[BodyIndex] &= ~BodyFlag_Sleeping;
+        Bodies->SleepTimes[BodyIndex] = 0.0f;
+        State->Broadphase.Rebuild = true;
+    }
+}
+
+
+b32 IsSleeping(dynamics_state *State, body_handle Handle)
+{
+    b32 Result = (State->Bodies.Flags[GetBodyIndex(State, Handle)] & BodyFlag_Sleeping) != 0;
+    return Result;
+}
+
+
+void Sleep(dynamics_state *State, body_index Index)
+{
+    body_arrays *Bodies = &State->Bodies;
+    
+    Bodies->Flags[Index] |= BodyFlag_Sleeping;
+    Bodies->SleepTimes[Index] = 0.0f;
+    Bodies->dP[Index] = v2_zero;
+    Bodies->PrevP[Index] = Bodies->P[Index]; // Nothing to interpolate while sleeping
+    
+    State->Broadphase.Rebuild = true;
+}
+
+
+// Puts the dynamic bodies that have been still for long enough to sleep, done after each step
+void UpdateSleep(dynamics_state *State, f32 dt)
+{
+    body_arrays *Bodies = &State->Bodies;
+    u32 SleepingCount = 0;
+    
+    for (u32 Index = 0; Index < Bodies->Count; ++Index)
+    {
+        if (Bodies->Flags[Index] & BodyFlag_Sleeping)
+        {
+            ++SleepingCount;
+            continue;
+        }
+        
+        if (Bodies->Types[Index] != BodyType_Dynamic)
+        {
+            continue;
+        }
+        
+        if (LengthSq(Bodies->dP[Index]) < Square(kSleepSpeed))
+        {
+            Bodies->SleepTimes[Index] += dt;
+            if (Bodies->SleepTimes[Index] >= kTimeToSleep)
+            {
+                Sleep(State, Index);
+                ++SleepingCount;
+            }
+        }
+        else
+        {
+            Bodies->SleepTimes[Index] = 0.0f;
+        }
+    }
+    
+    State->Stats.SleepingBodyCount = SleepingCount;
+}
+
+
+
+
+//
+// Contact cache
+//
+
+// The key is on the slots, so that the entries sort on them. The generations, of the body in the
+// lowest and the highest slot, are part of the key as well: a body in a reused slot is another pair.
+static u64 GetContactKey(body_handle A, body_handle B, u32 *Generations)
+{
+    b32 Swapped = A.Slot > B.Slot;
+    Generations[0] = Swapped ? B.Generation : A.Generation;
+    Generations[1] = Swapped ? A.Generation : B.Generation;
+    
+    u64 Result = (static_cast<u64>(Min(A.Slot, B.Slot)) << 32) | Max(A.Slot, B.Slot);
+    return Result;
+}
+
+
+static b32 LessKey(contact_cache_entry const& A, contact_cache_entry const& B)
+{
+    return A.Key < B.Key;
+}
+
+
+// Only reads the cache, so it is safe to call from the narrowphase jobs
+contact_cache_entry const *FindContact(contact_cache *Cache, u64 Key, u32 GenerationLo, u32 GenerationHi)
+{
+    contact_cache_entry Search;
+    Search.Key = Key;
+    
+    auto It = std::lower_bound(Cache->Entries.begin(), Cache->Entries.end(), Search, LessKey);
+    if ((It == Cache->Entries.end()) || (It->Key != Key) ||
+        (It->Generations[0] != GenerationLo) || (It->Generations[1] != GenerationHi))
+    {
+        return nullptr;
+    }
+    
+    return &*It;
+}
+
+
+// Replaces the entries with the ones from this frame, pairs that were not tested are dropped
+void UpdateContactCache(dynamics_state *State, u32 ChunkCount)
+{
+    contact_cache *Cache = &State->ContactCache;
+    contact_cache_stats Stats;
+    
+    Cache->NewEntries.clear();
+    for (u32 Chunk = 0; Chunk < ChunkCount; ++Chunk)
+    {
+        Cache->NewEntries.insert(Cache->NewEntries.end(), Cache->ChunkEntries[Chunk].begin(), Cache->ChunkEntries[Chunk].end());
+        
+        Stats.LookupCount += Cache->ChunkStats[Chunk].LookupCount;
+        Stats.HitCount += Cache->ChunkStats[Chunk].HitCount;
+        Stats.EPASkipCount += Cache->ChunkStats[Chunk].EPASkipCount;
+    }
+    
+    std::sort(Cache->NewEntries.begin(), Cache->NewEntries.end(), LessKey);
+    Cache->Entries.swap(Cache->NewEntries);
+    
+    State->Stats.ContactCache = Stats;
+}
+
+
+
+
+//
+// Contact events
+//
+
+// On the slots and then the generations, a reused slot is a different pair
+static b32 LessEventPair(contact_event_pair const& A, contact_event_pair const& B)
+{
+    if (A.Key != B.Key)
+    {
+        return A.Key < B.Key;
+    }
+    
+    if (A.Generations[0] != B.Generations[0])
+    {
+        return A.Generations[0] < B.Generations[0];
+    }
+    
+    return A.Generations[1] < B.Generations[1];
+}
+
+
+// Merges the sorted pairs of this call with the ones of the previous call
+void UpdateContactEvents(dynamics_state *State, std::vector<collision_info>& Collisions, size_t First)
+{
+    body_arrays *Bodies = &State->Bodies;
+    contact_events *Events = &State->ContactEvents;
+    
+    std::vector<contact_event_pair>& NewPairs = Events->NewPairs;
+    NewPairs.clear();
+    
+    for (size_t Index = First; Index < Collisions.size(); ++Index)
+    {
+        collision_info const& Collision = Collisions[Index];
+        
+        contact_event_pair Pair;
+        Pair.Key = GetContactKey(Collision.Handles[0], Collision.Handles[1], Pair.Generations);
+        
+        contact_event& Event = Pair.Event;
+        Event.Type = ContactEvent_Begin;
+        Event.Collision = static_cast<u32>(Index);
+        
+        for (u32 Body = 0; Body < 2; ++Body)
+        {
+            Event.Layers[Body] = Bodies->Layers[Collision.BodiesInvolved[Body]];
+            Event.Handles[Body] = Collision.Handles[Body];
+            Event.UserData[Body] = Collision.UserData[Body];
+        }
+        
+        NewPairs.push_back(Pair);
+    }
+    
+    std::sort(NewPairs.begin(), NewPairs.end(), LessEventPair);
+    
+    //
+    // Both are sorted, so one pass finds the pairs that are only in one of them
+    std::vector<contact_event_pair> const& Pairs = Events->Pairs;
+    Events->Events.clear();
+    
+    size_t Old = 0;
+    size_t New = 0;
+    while ((Old < Pairs.size()) || (New < NewPairs.size()))
+    {
+        if ((New == NewPairs.size()) || ((Old < Pairs.size()) && LessEventPair(Pairs[Old], NewPairs[New])))
+        {
+            contact_event Event = Pairs[Old].Event;
+            Event.Type = ContactEvent_End;
+            Event.Collision = kNoCollision;
+            Events->Events.push_back(Event);
+            ++Old;
+        }
+        else if ((Old == Pairs.size()) || LessEventPair(NewPairs[New], Pairs[Old]))
+        {
+            Events->Events.push_back(NewPairs[New].Event);
+            ++New;
+        }
+        else
+        {
+            contact_event Event = NewPairs[New].Event;
+            Event.Type = ContactEvent_Stay;
+            Events->Events.push_back(Event);
+            ++Old;
+            ++New;
+        }
+    }
+    
+    Events->Pairs.swap(Events->NewPairs);
+}
+
+
+
+
+//
+// Contacts
+//
+
+// Bodies that can't be moved by contacts (static, kinematic or fully masked) are never written
+// to when resolving the contacts, so they are allowed to be part of several contacts in the
+// same batch.
+b32 IsImmovable(body_arrays *Bodies, body_index Index)
+{
+    v2 Mask = Bodies->dPMask[Index];
+    b32 Result = (Bodies->Types[Index] != BodyType_Dynamic) || ((Mask.x == 0.0f) && (Mask.y == 0.0f));
+    return Result;
+}
+
+
+void BuildContactBatches(dynamics_state *State, std::vector<collision_info>& Contacts)
+{
+    body_arrays *Bodies = &State->Bodies;
+    contact_batches *Batches = &State->Batches;
+    
+    u32 const ContactCount = static_cast<u32>(Contacts.size());
+    u32 const OverflowBatch = kMaxContactBatchCount;
+    
+    Batches->BodyColours.assign(Bodies->Count, 0);
+    Batches->Colours.resize(ContactCount);
+    Batches->Order.resize(ContactCount);
+    
+    u32 Counts[kMaxContactBatchCount + 1] = {};
+    
+    //
+    // Greedy colouring, each contact gets the lowest colour that none of its bodies has yet
+    for (u32 Index = 0; Index < ContactCount; ++Index)
+    {
+        body_index A = Contacts[Index].BodiesInvolved[0];
+        body_index B = Contacts[Index].BodiesInvolved[1];
+        
+        b32 ImmovableA = IsImmovable(Bodies, A);
+        b32 ImmovableB = IsImmovable(Bodies, B);
+        
+        u64 Used = (ImmovableA ? 0 : Batches->BodyColours[A]) | (ImmovableB ? 0 : Batches->BodyColours[B]);
+        
+        u32 Colour = 0;
+        while ((Colour < kMaxContactBatchCount) && (Used & (1ull << Colour)))
+        {
+            ++Colour;
+        }
+        
+        if (Colour < kMaxContactBatchCount)
+        {
+            if (!ImmovableA)  Batches->BodyColours[A] |= (1ull << Colour);
+            if (!ImmovableB)  Batches->BodyColours[B] |= (1ull << Colour);
+        }
+        else
+        {
+            Colour = OverflowBatch;
+        }
+        
+        Batches->Colours[Index] = Colour;
+        ++Counts[Colour];
+    }
+    
+    //
+    // Counting sort on colour, keeps the original order within each batch
+    u32 Offset = 0;
+    u32 BatchCount = 0;
+    for (u32 Colour = 0; Colour <= kMaxContactBatchCount; ++Colour)
+    {
+        Batches->Offsets[Colour] = Offset;
+        Offset += Counts[Colour];
+        BatchCount += Counts[Colour] > 0 ? 1 : 0;
+    }
+    Batches->Offsets[kMaxContactBatchCount + 1] = Offset;
+    
+    u32 Next[kMaxContactBatchCount + 1];
+    for (u32 Colour = 0; Colour <= kMaxContactBatchCount; ++Colour)
+    {
+        Next[Colour] = Batches->Offsets[Colour];
+    }
+    
+    for (u32 Index = 0; Index < ContactCount; ++Index)
+    {
+        Batches->Order[Next[Batches->Colours[Index]]++] = Index;
+    }
+    
+    State->Stats.ContactBatchCount = BatchCount;
+}
+
+
+
+
+//
+// Solver
+//
+
+// 1 / the change of the relative velocity along Direction that a unit impulse along it gives.
+// The dPMasks are taken into account, a paddle that only moves along y is immovable along x.
+static f32 GetEffectiveMass(f32 InverseMassA, v2 dPMaskA, f32 InverseMassB, v2 dPMaskB, v2 Direction)
+{
+    f32 K = InverseMassA * Dot(Direction, Hadamard(dPMaskA, Direction)) + 
+        InverseMassB * Dot(Direction, Hadamard(dPMaskB, Direction));
+    
+    f32 Result = K > 0.0f ? 1.0f / K : 0.0f;
+    return Result;
+}
+
+
+// Impulse is applied to B, and the opposite one to A
+static void ApplyImpulse(body_arrays *Bodies, contact_constraint const *Constraint, v2 Impulse)
+{
+    body_index A = Constraint->A;
+    body_index B = Constraint->B;
+    
+    if (Constraint->InverseMassA != 0.0f)  Bodies->dP[A] -= Constraint->InverseMassA * Hadamard(Bodies->dPMask[A], Impulse);
+    if (Constraint->InverseMassB != 0.0f)  Bodies->dP[B] += Constraint->InverseMassB * Hadamard(Bodies->dPMask[B], Impulse);
+}
+
+
+// The impulses are stored for the pair ordered on slots, the tangent flips with the normal when
+// the broadphase pairs the bodies the other way around
+static b32 IsSwapped(collision_info const *Collision)
+{
+    return Collision->Handles[0].Slot > Collision->Handles[1].Slot;
+}
+
+
+static b32 LessImpulseKey(contact_impulse const& A, contact_impulse const& B)
+{
+    return A.Key < B.Key;
+}
+
+
+static contact_impulse const *FindImpulse(contact_solver *Solver, collision_info const *Collision)
+{
+    contact_impulse Search;
+    Search.Key = GetContactKey(Collision->Handles[0], Collision->Handles[1], Search.Generations);
+    
+    auto It = std::lower_bound(Solver->Impulses.begin(), Solver->Impulses.end(), Search, LessImpulseKey);
+    if ((It == Solver->Impulses.end()) || (It->Key != Search.Key) ||
+        (It->Generations[0] != Search.Generations[0]) || (It->Generations[1] != Search.Generations[1]))
+    {
+        return nullptr;
+    }
+    
+    return &*It;
+}
+
+
+// Only reads the bodies and the impulses of the last step
+void PrepareContact(dynamics_state *State, collision_info const *Collision, contact_constraint *Constraint)
+{
+    body_arrays *Bodies = &State->Bodies;
+    
+    body_index A = Collision->BodiesInvolved[0];
+    body_index B = Collision->BodiesInvolved[1];
+    
+    Constraint->A = A;
+    Constraint->B = B;
+    Constraint->N = Collision->N;
+    Constraint->T = Perp(Collision->N);
+    Constraint->D = Bodies->P[B] - Bodies->P[A];
+    Constraint->Depth = Collision->Depth;
+    Constraint->InverseMassA = IsImmovable(Bodies, A) ? 0.0f : Bodies->InverseMass[A];
+    Constraint->InverseMassB = IsImmovable(Bodies, B) ? 0.0f : Bodies->InverseMass[B];
+    Constraint->SkipInterpenetration = Collision->SkipInterpenetration;
+    Constraint->SkipForceApplication = Collision->SkipForceApplication;
+    
+    v2 dPMaskA = Bodies->dPMask[A];
+    v2 dPMaskB = Bodies->dPMask[B];
+    Constraint->NormalMass = GetEffectiveMass(Constraint->InverseMassA, dPMaskA, Constraint->InverseMassB, dPMaskB, Constraint->N);
+    Constraint->TangentMass = GetEffectiveMass(Constraint->InverseMassA, dPMaskA, Constraint->InverseMassB, dPMaskB, Constraint->T);
+    
+    Constraint->Friction = SquareRoot(Bodies->Friction[A] * Bodies->Friction[B]);
+    
+    //
+    // The bounce is decided by the velocities before any impulse is applied
+    f32 Restitution = Max(Max(Bodies->Restitution[A], Bodies->Restitution[B]) + Collision->ForceModifier, 0.0f);
+    f32 Speed = Dot(Bodies->dP[B] - Bodies->dP[A], Constraint->N);
+    Constraint->TargetSpeed = Speed < -kRestitutionThreshold ? -Restitution * Speed : 0.0f;
+    
+    //
+    // Warm starting
+    Constraint->NormalImpulse = 0.0f;
+    Constraint->TangentImpulse = 0.0f;
+    
+    contact_impulse const *Impulse = Collision->SkipForceApplication ? nullptr : FindImpulse(&State->Solver, Collision);
+    if (Impulse)
+    {
+        Constraint->NormalImpulse = Impulse->NormalImpulse;
+        Constraint->TangentImpulse = IsSwapped(Collision) ? -Impulse->TangentImpulse : Impulse->TangentImpulse;
+    }
+}
+
+
+void WarmStart(body_arrays *Bodies, contact_constraint *Constraint)
+{
+    v2 Impulse = Constraint->NormalImpulse * Constraint->N + Constraint->TangentImpulse * Constraint->T;
+    ApplyImpulse(Bodies, Constraint, Impulse);
+}
+
+
+void SolveVelocity(body_arrays *Bodies, contact_constraint *Constraint)
+{
+    if (Constraint->SkipForceApplication)
+    {
+        return;
+    }
+    
+    body_index A = Constraint->A;
+    body_index B = Constraint->B;
+    
+    //
+    // Friction first, it is limited by the normal impulse of the previous iteration
+    {
+        f32 Speed = Dot(Bodies->dP[B] - Bodies->dP[A], Constraint->T);
+        f32 MaxImpulse = Constraint->Friction * Constraint->NormalImpulse;
+        
+        f32 Total = Clamp(Constraint->TangentImpulse - Constraint->TangentMass * Speed, -MaxImpulse, MaxImpulse);
+        f32 Impulse = Total - Constraint->TangentImpulse;
+        Constraint->TangentImpulse = Total;
+        
+        ApplyImpulse(Bodies, Constraint, Impulse * Constraint->T);
+    }
+    
+    //
+    // Normal, the total is never negative, i.e. the bodies are never pulled together
+    {
+        f32 Speed = Dot(Bodies->dP[B] - Bodies->dP[A], Constraint->N);
+        
+        f32 Total = Max(Constraint->NormalImpulse + Constraint->NormalMass * (Constraint->TargetSpeed - Speed), 0.0f);
+        f32 Impulse = Total - Constraint->NormalImpulse;
+        Constraint->NormalImpulse = Total;
+        
+        ApplyImpulse(Bodies, Constraint, Impulse * Constraint->N);
+    }
+}
+
+
+// Moves the bodies apart along the normal without changing the velocities, so the correction
+// doesn't add to the bounce
+void SolvePosition(body_arrays *Bodies, contact_constraint *Constraint, f32 Baumgarte, f32 Slop)
+{
+    if (Constraint->SkipInterpenetration)
+    {
+        return;
+    }
+    
+    body_index A = Constraint->A;
+    body_index B = Constraint->B;
+    
+    // The depth with how far the bodies have been moved apart by the earlier passes
+    f32 Depth = Constraint->Depth - Dot((Bodies->P[B] - Bodies->P[A]) - Constraint->D, Constraint->N);
+    f32 Correction = Baumgarte * Max(Depth - Slop, 0.0f);
+    
+    v2 dP = (Correction * Constraint->NormalMass) * Constraint->N;
+    if (Constraint->InverseMassA != 0.0f)  Bodies->P[A] -= Constraint->InverseMassA * Hadamard(Bodies->dPMask[A], dP);
+    if (Constraint->InverseMassB != 0.0f)  Bodies->P[B] += Constraint->InverseMassB * Hadamard(Bodies->dPMask[B], dP);
+}
+
+
+// Keeps the accumulated impulses for warm starting the next step, pairs that are not touching
+// anymore are dropped
+void StoreImpulses(dynamics_state *State, std::vector<collision_info>& Contacts)
+{
+    contact_solver *Solver = &State->Solver;
+    Solver->NewImpulses.clear();
+    
+    for (size_t Index = 0; Index < Contacts.size(); ++Index)
+    {
+        collision_info const *Collision = &Contacts[Index];
+        contact_constraint const& Constraint = Solver->Constraints[Index];
+        
+        b32 Swapped = IsSwapped(Collision);
+        
+        contact_impulse Impulse;
+        Impulse.Key = GetContactKey(Collision->Handles[0], Collision->Handles[1], Impulse.Generations);
+        Impulse.NormalImpulse = Constraint.NormalImpulse;
+        Impulse.TangentImpulse = Swapped ? -Constraint.TangentImpulse : Constraint.TangentImpulse;
+        
+        Solver->NewImpulses.push_back(Impulse);
+    }
+    
+    std::sort(Solver->NewImpulses.begin(), Solver->NewImpulses.end(), LessImpulseKey);
+    Solver->Impulses.swap(Solver->NewImpulses);
+}
+
+
+
+
+//
+// Broadphase
+//
+
+b32 Overlaps(aabb const& A, aabb const& B)
+{
+    b32 Result = (A.Min.x <= B.Max.x) && (A.Max.x >= B.Min.x) &&
+        (A.Min.y <= B.Max.y) && (A.Max.y >= B.Min.y);
+    return Result;
+}
+
+
+aabb Union(aabb const& A, aabb const& B)
+{
+    aabb Result;
+    Result.Min = V2(Min(A.Min.x, B.Min.x), Min(A.Min.y, B.Min.y));
+    Result.Max = V2(Max(A.Max.x, B.Max.x), Max(A.Max.y, B.Max.y));
+    return Result;
+}
+
+
+static void SweepChunk(void *Data, u32 First, u32 Count)
+{
+    broadphase *Broadphase = static_cast<broadphase *>(Data);
+    u32 Chunk = First / kSweepChunkSize;
+    
+    std::vector<body_pair>& Output = Broadphase->ChunkPairs[Chunk];
+    Output.clear();
+    
+    Broadphase->ChunkTestCounts[Chunk] = Sweep(Broadphase, First, Count, Output);
+}
+
+
+// Ties are broken on the body index, so that the order doesn't depend on the sort implementation
+static b32 LessMinX(broadphase_proxy const& A, broadphase_proxy const& B)
+{
+    if (A.Bounds.Min.x != B.Bounds.Min.x)
+    {
+        return A.Bounds.Min.x < B.Bounds.Min.x;
+    }
+    
+    return A.BodyIndex < B.BodyIndex;
+}
+
+
+#ifdef DETERMINISTIC
+static b32 LessPair(body_pair const& A, body_pair const& B)
+{
+    if (A.A != B.A)
+    {
+        return A.A < B.A;
+    }
+    
+    return A.B < B.B;
+}
+#endif
+
+
+void UpdateBroadphase(dynamics_state *State)
+{
+    broadphase *Broadphase = &State->Broadphase;
+    std::vector<broadphase_proxy>& Proxies = Broadphase->Proxies;
+    std::vector<broadphase_proxy>& Resting = Broadphase->RestingProxies;
+    
+    body_arrays *Bodies = &State->Bodies;
+    body_index const BodyCount = static_cast<body_index>(Bodies->Count);
+    
+    //
+    // Split the bodies into awake and resting proxies, when bodies have been added or have fallen
+    // asleep or woken up since the last frame. The bounds of the resting bodies are only updated
+    // here since they don't move.
+    b32 FullSort = false;
+    
+    if (Broadphase->Rebuild || (static_cast<body_index>(Proxies.size() + Resting.size()) != BodyCount))
+    {
+        Proxies.clear();
+        Resting.clear();
+        Broadphase->RestingMaxWidth = 0.0f;
+        
+        for (body_index Index = 0; Index < BodyCount; ++Index)
+        {
+            broadphase_proxy Proxy;
+            Proxy.BodyIndex = Index;
+            Proxy.Layer = Bodies->Layers[Index];
+            Proxy.Mask = Bodies->Masks[Index];
+            
+            if (Bodies->Flags[Index] & BodyFlag_Sleeping)
+            {
+                Proxy.Bounds = GetAABB(State, Index);
+                Broadphase->RestingMaxWidth = Max(Broadphase->RestingMaxWidth, Proxy.Bounds.Max.x - Proxy.Bounds.Min.x);
+                Resting.push_back(Proxy);
+            }
+            else
+            {
+                Proxies.push_back(Proxy);
+            }
+        }
+        
+        std::sort(Resting.begin(), Resting.end(), LessMinX);
+        
+        Broadphase->Rebuild = false;
+        FullSort = true;
+    }
+    
+    //
+    // Continuous bodies get the bounds of the whole sweep from PrevP to P, only their own motion
+    // is covered so the other body in a pair is assumed to move much slower.
+    for (auto& Proxy : Proxies)
+    {
+        body_index Index = Proxy.BodyIndex;
+        Proxy.Bounds = GetAABB(State, Index);
+        Proxy.Layer = Bodies->Layers[Index];
+        Proxy.Mask = Bodies->Masks[Index];
+        
+        if (Bodies->Flags[Index] & BodyFlag_Continuous)
+        {
+            Proxy.Bounds = Union(Proxy.Bounds, GetAABB(Bodies->PrevP[Index], &Bodies->Shapes[Index]));
+        }
+    }
+    
+    
+    //
+    // Sort on MinX, the order rarely changes much between two frames so an insertion sort
+    // is close to linear in the common case.
+    if (FullSort)
+    {
+        std::sort(Proxies.begin(), Proxies.end(), LessMinX);
+    }
+    else
+    {
+        for (size_t Index = 1; Index < Proxies.size(); ++Index)
+        {
+            broadphase_proxy Proxy = Proxies[Index];
+            size_t Curr = Index;
+            
+            while ((Curr > 0) && (Proxies[Curr - 1].Bounds.Min.x > Proxy.Bounds.Min.x))
+            {
+                Proxies[Curr] = Proxies[Curr - 1];
+                --Curr;
+            }
+            
+            Proxies[Curr] = Proxy;
+        }
+    }
+    
+    
+    //
+    // Sweep, in chunks of proxies. Each chunk writes to its own pair array and they are then
+    // concatenated in order, which gives the same pairs in the same order as a single sweep.
+    u32 const ProxyCount = static_cast<u32>(Proxies.size());
+    u32 const ChunkCount = (ProxyCount + kSweepChunkSize - 1) / kSweepChunkSize;
+    
+    if (Broadphase->ChunkPairs.size() < ChunkCount)
+    {
+        Broadphase->ChunkPairs.resize(ChunkCount);
+        Broadphase->ChunkTestCounts.resize(ChunkCount);
+    }
+    
+    ParallelFor(State->Workers, ProxyCount, kSweepChunkSize, SweepChunk, Broadphase);
+    
+    std::vector<body_pair>& Pairs = Broadphase->Pairs;
+    Pairs.clear();
+    
+    u32 TestCount = 0;
+    for (u32 Chunk = 0; Chunk < ChunkCount; ++Chunk)
+    {
+        Pairs.insert(Pairs.end(), Broadphase->ChunkPairs[Chunk].begin(), Broadphase->ChunkPairs[Chunk].end());
+        TestCount += Broadphase->ChunkTestCounts[Chunk];
+    }
+    
+#ifdef DETERMINISTIC
+    //
+    // The sweep order depends on how the proxies were sorted and split in earlier frames, i.e.
+    // on more than the current state. Process the pairs in body order instead.
+    std::sort(Pairs.begin(), Pairs.end(), LessPair);
+#endif
+    
+    State->Stats.BodyCount = static_cast<u32>(BodyCount);
+    State->Stats.BroadphaseTestCount = TestCount;
+}
+
+
+static b32 ShouldCollide(broadphase_proxy const& A, broadphase_proxy const& B)
+{
+    b32 Result = (A.Layer & B.Mask) && (B.Layer & A.Mask);
+    return Result;
+}
+
+
+static void AddPair(broadphase_proxy const& A, broadphase_proxy const& B, std::vector<body_pair>& Output)
+{
+    body_pair Pair;
+    Pair.A = Min(A.BodyIndex, B.BodyIndex);
+    Pair.B = Max(A.BodyIndex, B.BodyIndex);
+    Output.push_back(Pair);
+}
+
+
+// Sweeps the awake proxies [First, First + Count) against all the awake proxies after them and
+// against the resting proxies, returns the number of AABB tests done.
+u32 Sweep(broadphase *Broadphase, u32 First, u32 Count, std::vector<body_pair>& Output)
+{
+    broadphase_proxy const *Proxies = Broadphase->Proxies.data();
+    u32 const ProxyCount = static_cast<u32>(Broadphase->Proxies.size());
+    
+    broadphase_proxy const *RestingBegin = Broadphase->RestingProxies.data();
+    broadphase_proxy const *RestingEnd = RestingBegin + Broadphase->RestingProxies.size();
+    
+    u32 TestCount = 0;
+    
+    for (u32 IndexA = First; IndexA < (First + Count); ++IndexA)
+    {
+        broadphase_proxy const& A = Proxies[IndexA];
+        
+        for (u32 IndexB = IndexA + 1; IndexB < ProxyCount; ++IndexB)
+        {
+            broadphase_proxy const& B = Proxies[IndexB];
+            if (B.Bounds.Min.x > A.Bounds.Max.x)
+            {
+                break;
+            }
+            
+            ++TestCount;
+            if (Overlaps(A.Bounds, B.Bounds) && ShouldCollide(A, B))
+            {
+                AddPair(A, B, Output);
+            }
+        }
+        
+        //
+        // No resting proxy is wider than RestingMaxWidth, so the ones that can overlap A start
+        // at MinX >= A.MinX - RestingMaxWidth. The index of the key puts it before any proxy with
+        // that exact MinX.
+        broadphase_proxy Key;
+        Key.Bounds.Min.x = A.Bounds.Min.x - Broadphase->RestingMaxWidth;
+        Key.BodyIndex = -1;
+        
+        for (broadphase_proxy const *B = std::lower_bound(RestingBegin, RestingEnd, Key, LessMinX); B < RestingEnd; ++B)
+        {
+            if (B->Bounds.Min.x > A.Bounds.Max.x)
+            {
+                break;
+            }
+            
+            ++TestCount;
+            if (Overlaps(A.Bounds, B->Bounds) && ShouldCollide(A, *B))
+            {
+                AddPair(A, *B, Output);
+            }
+        }
+    }
+    
+    return TestCount;
+}
+
+
+
+
+//
+// Collision
+//
+
+collision_info GetCollisionInfo(polytope *Simplex, v2 Poa, shape *A, v2 Pob, shape *B)
+{
+    assert(Simplex);
+    
+    edge Edge = FindEdgeClosestToOrigin(Simplex);
+    f32 Distance = Edge.Distance;
+    
+    for (u32 Iteration = 0; Iteration < kMaxEPAIterations; ++Iteration)
+    {
+        v2 P = FurthestPointInShape(Poa, A, Edge.N) - FurthestPointInShape(Pob, B, -Edge.N);
+        
+        Distance = Dot(P, Edge.N);
+        if ((Distance - Edge.Distance) < 0.00001f)
+        {
+            break;
+        }
+        
+        Insert(Simplex, Edge.VertexIndex, P);
+        Edge = FindEdgeClosestToOrigin(Simplex);
+        Distance = Edge.Distance;
+    }
+    
+    // If we ran out of iterations we settle for the closest edge found so far, for curved shapes
+    // (circles) the error is well below what is noticeable at that point.
+    collision_info Result;
+    Result.N = Edge.N;
+    Result.Depth = Distance;
+    return Result;
+}
+
+
+//
+// Narrowphase dispatch, indexed with [A->Type][B->Type]. All the functions report
+// a normal that points from A towards B and a positive penetration depth.
+// The rectangles and circles have closed form tests, the convex shapes go through GJK + EPA.
+typedef b32 intersect_function(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info);
+
+static intersect_function * const IntersectFunctions[ShapeType_Count][ShapeType_Count] =
+{
+    // B: Rectangle              B: Circle                 B: Convex
+    {IntersectRectangles     , IntersectRectangleCircle, IntersectsGJK}, // A: Rectangle
+    {IntersectCircleRectangle, IntersectCircles        , IntersectsGJK}, // A: Circle
+    {IntersectsGJK           , IntersectsGJK           , IntersectsGJK}, // A: Convex
+};
+
+
+// The GJK pairs go through the contact cache in the narrowphase
+b32 UsesGJK(shape *A, shape *B)
+{
+    b32 Result = IntersectFunctions[A->Type][B->Type] == IntersectsGJK;
+    return Result;
+}
+
+
+b32 Intersects(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info)
+{
+    assert(A && B);
+    assert(A->Type < ShapeType_Count && B->Type < ShapeType_Count);
+    
+    intersect_function *Function = IntersectFunctions[A->Type][B->Type];
+    b32 Result = Function(Pa, A, Pb, B, Info);
+    
+    return Result;
+}
+
+
+b32 IntersectRectangles(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info)
+{
+    v2 D = Pb - Pa;
+    v2 H = A->HalfSize + B->HalfSize;
+    
+    f32 OverlapX = H.x - Abs(D.x);
+    f32 OverlapY = H.y - Abs(D.y);
+    
+    if ((OverlapX <= 0.0f) || (OverlapY <= 0.0f))
+    {
+        return false;
+    }
+    
+    if (Info)
+    {
+        // Separate along the axis of least penetration
+        if (OverlapX < OverlapY)
+        {
+            Info->N = V2(Sign(D.x), 0.0f);
+            Info->Depth = OverlapX;
+        }
+        else
+        {
+            Info->N = V2(0.0f, Sign(D.y));
+            Info->Depth = OverlapY;
+        }
+    }
+    
+    return true;
+}
+
+
+// N points from the rectangle towards the circle
+b32 RectangleVsCircle(v2 Pr, v2 HalfSize, v2 Pc, f32 Radius, v2 *N, f32 *Depth)
+{
+    v2 D = Pc - Pr;
+    
+    if ((Abs(D.x) <= HalfSize.x) && (Abs(D.y) <= HalfSize.y))
+    {
+        //
+        // The centre of the circle is inside the rectangle, push it out through the closest side
+        f32 dX = HalfSize.x - Abs(D.x);
+        f32 dY = HalfSize.y - Abs(D.y);
+        
+        if (dX < dY)
+        {
+            *N = V2(Sign(D.x), 0.0f);
+            *Depth = dX + Radius;
+        }
+        else
+        {
+            *N = V2(0.0f, Sign(D.y));
+            *Depth = dY + Radius;
+        }
+        
+        return true;
+    }
+    
+    v2 Closest = V2(Clamp(D.x, -HalfSize.x, HalfSize.x),
+                    Clamp(D.y, -HalfSize.y, HalfSize.y));
+    v2 Delta = D - Closest;
+    
+    f32 DistanceSq = LengthSq(Delta);
+    if (DistanceSq >= Square(Radius))
+    {
+        return false;
+    }
+    
+    f32 Distance = SquareRoot(DistanceSq);
+    *N = Delta * (1.0f / Distance);
+    *Depth = Radius - Distance;
+    
+    return true;
+}
+
+
+// Sweeps a circle that starts at S, relative to the centre of the rectangle, and moves D during
+// the step. On a hit TOI is the fraction of D moved before touching and N points from the
+// rectangle towards the circle. A circle that already touches at the start is not a hit.
+b32 SweepCircleRectangle(v2 S, v2 D, v2 HalfSize, f32 Radius, f32 *TOI, v2 *N)
+{
+    v2 Dummy;
+    f32 DummyDepth;
+    if (RectangleVsCircle(v2_zero, HalfSize, S, Radius, &Dummy, &DummyDepth))
+    {
+        return false;
+    }
+    
+    //
+    // Ray (the centre of the circle) against the rectangle grown by the radius
+    v2 Extent = HalfSize + V2(Radius, Radius);
+    
+    f32 Enter = -f32Max;
+    f32 Exit = f32Max;
+    u32 EnterAxis = 0;
+    
+    for (u32 Axis = 0; Axis < 2; ++Axis)
+    {
+        f32 s = Axis == 0 ? S.x : S.y;
+        f32 d = Axis == 0 ? D.x : D.y;
+        f32 e = Axis == 0 ? Extent.x : Extent.y;
+        
+        if (Abs(d) < 1e-8f)
+        {
+            if (Abs(s) > e)
+            {
+                return false;
+            }
+            continue;
+        }
+        
+        f32 t0 = (-e - s) / d;
+        f32 t1 = ( e - s) / d;
+        if (t0 > t1)
+        {
+            f32 Temp = t0;
+            t0 = t1;
+            t1 = Temp;
+        }
+        
+        if (t0 > Enter)
+        {
+            Enter = t0;
+            EnterAxis = Axis;
+        }
+        Exit = Min(Exit, t1);
+    }
+    
+    if ((Enter > Exit) || (Enter > 1.0f) || (Exit < 0.0f))
+    {
+        return false;
+    }
+    
+    //
+    // Entering through one of the rounded corners, the ray has to hit the circle around the
+    // corner. Missing it means that it passes the corner without touching the rectangle.
+    v2 Q = S + Max(Enter, 0.0f)*D;
+    if ((Enter < 0.0f) || ((Abs(Q.x) > HalfSize.x) && (Abs(Q.y) > HalfSize.y)))
+    {
+        v2 Corner = V2(Sign(Q.x)*HalfSize.x, Sign(Q.y)*HalfSize.y);
+        
+        f32 t;
+        if (!SweepCircleCorner(S, D, Corner, Radius, &t))
+        {
+            return false;
+        }
+        
+        *TOI = t;
+        *N = (S + t*D - Corner) * (1.0f / Radius);
+        return true;
+    }
+    
+    *TOI = Enter;
+    *N = EnterAxis == 0 ? V2(Sign(Q.x), 0.0f) : V2(0.0f, Sign(Q.y));
+    return true;
 }
 
 
-void Update(dynamics_state *State, f32 dt)
+// Ray from S along D against the circle around the corner, hits within [0, 1] only
+b32 SweepCircleCorner(v2 S, v2 D, v2 Corner, f32 Radius, f32 *TOI)
 {
-    assert(State);
-    assert(dt > 0.0f);
+    v2 M = S - Corner;
+    f32 b = Dot(M, D);
+    f32 c = LengthSq(M) - Square(Radius);
+    
+    if ((c > 0.0f) && (b > 0.0f))
+    {
+        return false;
+    }
     
-    for (auto& Body : State->Bodies)
+    f32 a = LengthSq(D);
+    f32 Discriminant = b*b - a*c;
+    if ((a <= 0.0f) || (Discriminant < 0.0f))
     {
-        UpdateBody(Body, dt);
+        return false;
     }
+    
+    f32 t = Max((-b - SquareRoot(Discriminant)) / a, 0.0f);
+    if (t > 1.0f)
+    {
+        return false;
+    }
+    
+    *TOI = t;
+    return true;
 }
 
 
-body *NewRectangleBody(dynamics_state *State, v2 Size, void *UserData)
+b32 IntersectRectangleCircle(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info)
 {
-    assert(State);
-    
-    u32 Index = static_cast<u32>(State->Bodies.size());
-    State->Bodies.emplace_back(body());
-    body *Result = &State->Bodies.back();
+    v2 N;
+    f32 Depth;
     
-    Result->Shape.Type = ShapeType_Rectangle;
-    Result->Shape.HalfSize = 0.5f*Size;
-    Result->Shape.BodyIndex = Index;
-    Result->UserData = UserData;
+    b32 Result = RectangleVsCircle(Pa, A->HalfSize, Pb, B->Radius, &N, &Depth);
+    if (Result && Info)
+    {
+        Info->N = N;
+        Info->Depth = Depth;
+    }
     
     return Result;
 }
 
 
-body *NewCircleBody(dynamics_state *State, f32 Radius, void *UserData)
+b32 IntersectCircleRectangle(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info)
 {
-    assert(State);
-    
-    u32 Index = static_cast<u32>(State->Bodies.size());
-    State->Bodies.emplace_back(body());
-    body *Result = &State->Bodies.back();
+    v2 N;
+    f32 Depth;
     
-    Result->Shape.Type = ShapeType_Circle;
-    Result->Shape.Radius = Radius;
-    Result->Shape.BodyIndex = Index;
-    Result->UserData = UserData;
+    b32 Result = RectangleVsCircle(Pb, B->HalfSize, Pa, A->Radius, &N, &Depth);
+    if (Result && Info)
+    {
+        Info->N = -N;
+        Info->Depth = Depth;
+    }
     
     return Result;
 }
 
 
-body *GetBody(dynamics_state *State, body_index BodyIndex)
+b32 IntersectCircles(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info)
 {
-    return &State->Bodies[BodyIndex];
+    v2 D = Pb - Pa;
+    f32 RadiusSum = A->Radius + B->Radius;
+    
+    f32 DistanceSq = LengthSq(D);
+    if (DistanceSq >= Square(RadiusSum))
+    {
+        return false;
+    }
+    
+    if (Info)
+    {
+        f32 Distance = SquareRoot(DistanceSq);
+        Info->N = Distance > 0.0f ? D * (1.0f / Distance) : V2(1.0f, 0.0f);
+        Info->Depth = RadiusSum - Distance;
+    }
+    
+    return true;
 }
 
 
-body_index GetBodyIndex(dynamics_state *State, body *Body)
+//
+// Swept test for a pair where at least one of the bodies is continuous, uses the motion from
+// PrevP to P relative to the other body. The depth is how far back along the normal the bodies
+// must be moved to be touching again, which keeps a body that tunnelled on the side it came from.
+b32 IntersectsSwept(body_arrays *Bodies, body_index A, body_index B, collision_info *Info)
 {
-    body_index Result = -1;
+    shape *ShapeA = &Bodies->Shapes[A];
+    shape *ShapeB = &Bodies->Shapes[B];
     
-    if (State && Body)
+    //
+    // The convex shapes are swept with conservative advancement, A against B standing still
+    if ((ShapeA->Type == ShapeType_Convex) || (ShapeB->Type == ShapeType_Convex))
     {
-        if (Body->Shape.BodyIndex >= 0)
-        {
-            Result = Body->Shape.BodyIndex;
-        }
-        else
+        v2 S = Bodies->PrevP[A] - Bodies->PrevP[B];
+        v2 D = (Bodies->P[A] - Bodies->PrevP[A]) - (Bodies->P[B] - Bodies->PrevP[B]);
+        
+        f32 TOI;
+        v2 N;
+        if (!CastConvex(ShapeA, S, D, ShapeB, &TOI, &N))
         {
-            for (std::vector<body>::size_type Index = 0; Index < State->Bodies.size(); ++Index)
-            {
-                if (&State->Bodies[Index] == Body)
-                {
-                    Result = static_cast<s32>(Index);
-                    Body->Shape.BodyIndex = Result;
-                    break;
-                }
-            }
+            return false;
         }
+        
+        Info->N = -N;
+        Info->Depth = Max((1.0f - TOI) * -Dot(D, N), 0.0f);
+        
+        return true;
     }
     
-    return Result;
+    body_index Circle;
+    body_index Rectangle;
+    
+    if ((ShapeA->Type == ShapeType_Circle) && (ShapeB->Type == ShapeType_Rectangle))
+    {
+        Circle = A;
+        Rectangle = B;
+    }
+    else if ((ShapeA->Type == ShapeType_Rectangle) && (ShapeB->Type == ShapeType_Circle))
+    {
+        Circle = B;
+        Rectangle = A;
+    }
+    else
+    {
+        return false;
+    }
+    
+    v2 S = Bodies->PrevP[Circle] - Bodies->PrevP[Rectangle];
+    v2 D = (Bodies->P[Circle] - Bodies->PrevP[Circle]) - (Bodies->P[Rectangle] - Bodies->PrevP[Rectangle]);
+    
+    f32 TOI;
+    v2 N;
+    if (!SweepCircleRectangle(S, D, Bodies->Shapes[Rectangle].HalfSize, Bodies->Shapes[Circle].Radius, &TOI, &N))
+    {
+        return false;
+    }
+    
+    Info->N = Circle == A ? -N : N;
+    Info->Depth = Max((1.0f - TOI) * -Dot(D, N), 0.0f);
+    
+    return true;
 }
 
 
-void SetP(dynamics_state *State, body_index BodyIndex, v2 Po)
+b32 IntersectsGJK(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info)
 {
-    body *Body = GetBody(State, BodyIndex);
-    Body->P = Po;
-    Body->PrevP = Body->P;
+    polytope Simplex;
+    if (!GJK(Pa, A, Pb, B, Pb - Pa, &Simplex))
+    {
+        return false;
+    }
+    
+    if (Info)
+    {
+        *Info = GetCollisionInfo(&Simplex, Pa, A, Pb, B);
+    }
     
-    Body->dP = v2_zero;
-    Body->F = v2_zero;
+    return true;
 }
 
 
-void DetectCollisions(dynamics_state *State, std::vector<collision_info>& Output)
+//
+// Same as IntersectsGJK but with the contact cache, the result is added to NewEntries.
+b32 IntersectsCached(dynamics_state *State, body_index A, body_index B, collision_info *Info, 
+                     std::vector<contact_cache_entry>& NewEntries, contact_cache_stats *Stats)
 {
-    for (u32 IndexA = 0; IndexA < 5; ++IndexA)
+    body_arrays *Bodies = &State->Bodies;
+    
+    //
+    // The cache is keyed on the slots, since the body indices change when bodies are destroyed.
+    // The cached vectors point from the body in the lowest slot, flip them if that is B.
+    body_handle HandleA = GetBodyHandle(State, A);
+    body_handle HandleB = GetBodyHandle(State, B);
+    f32 Sign = (HandleA.Slot > HandleB.Slot) ? -1.0f : 1.0f;
+    
+    contact_cache_entry Entry;
+    Entry.Key = GetContactKey(HandleA, HandleB, Entry.Generations);
+    
+    contact_cache_entry const *Cached = FindContact(&State->ContactCache, Entry.Key, Entry.Generations[0], Entry.Generations[1]);
+    
+    ++Stats->LookupCount;
+    Stats->HitCount += Cached ? 1 : 0;
+    
+    v2 Pa = Bodies->P[A];
+    v2 Pb = Bodies->P[B];
+    v2 D = Pb - Pa;
+    
+    polytope Simplex;
+    if (!GJK(Pa, &Bodies->Shapes[A], Pb, &Bodies->Shapes[B], Cached ? Sign * Cached->N : D, &Simplex))
+    {
+        return false;
+    }
+    
+    if (Cached)
     {
-        for (u32 IndexB = IndexA + 1; IndexB < 5; ++IndexB)
+        //
+        // Moving B by Motion moves the Minkowski difference by -Motion, so the distance to the
+        // cached edge changes by the motion along its normal. If the support along the normal
+        // doesn't agree then another feature is closest now and EPA has to run again.
+        v2 N = Sign * Cached->N;
+        v2 Motion = D - Sign * Cached->D;
+        f32 Depth = Cached->Depth - Dot(Motion, N);
+        
+        v2 Support = FurthestPointInShape(Pa, &Bodies->Shapes[A], N) - FurthestPointInShape(Pb, &Bodies->Shapes[B], -N);
+        f32 SupportDepth = Dot(Support, N);
+        
+        if ((LengthSq(Motion) < Square(kContactCacheMaxMotion)) && (Depth > 0.0f) &&
+            (Abs(SupportDepth - Depth) < kContactCacheTolerance))
         {
-            body *Body[2];
-            Body[0] = &State->Bodies[IndexA];
-            Body[1] = &State->Bodies[IndexB];
+            Info->N = N;
+            Info->Depth = Depth;
             
-            collision_info Collision;
-            if (Intersects(Body[0], Body[1], &Collision))
-            {
-                Collision.BodiesInvolved[0] = IndexA;
-                Collision.BodiesInvolved[1] = IndexB;
-                Collision.UserData[0] = Body[0]->UserData;
-                Collision.UserData[1] = Body[1]->UserData;
-                Output.push_back(Collision);
-            }
+            ++Stats->EPASkipCount;
+            NewEntries.push_back(*Cached);
+            return true;
         }
     }
+    
+    *Info = GetCollisionInfo(&Simplex, Pa, &Bodies->Shapes[A], Pb, &Bodies->Shapes[B]);
+    
+    Entry.N = Sign * Info->N;
+    Entry.Depth = Info->Depth;
+    Entry.D = Sign * D;
+    NewEntries.push_back(Entry);
+    
+    return true;
 }
 
 
-void ResolveCollisions(dynamics_state *State, std::vector<collision_info>& Input, f32 dt)
+//
+// Returns true if the shapes intersect, the simplex then contains the origin and can be
+// expanded by EPA. Direction is where to look first, any non-zero direction works.
+b32 GJK(v2 Pa, shape *A, v2 Pb, shape *B, v2 Direction, polytope *Simplex)
 {
-    // TODO(Marcus): Check the math, we're currently not caring about dt, but we probably
-    //               want to use impulse in our calculations?
+    Direction = NOZ(Direction);
+    if ((Direction.x == 0.0f) && (Direction.y == 0.0f))
+    {
+        Direction = V2(1.0f, 0.0f);
+    }
+    
+    v2 P0 = FurthestPointInShape(Pa, A, Direction) - FurthestPointInShape(Pb, B, -Direction);
+    Insert(Simplex, Simplex->Count, P0);
+    
+    Direction = -Direction;
     
-    for (auto& Collision : Input)
+    for (u32 Iteration = 0; Iteration < kMaxGJKIterations; ++Iteration)
     {
-        body *Body[2];
-        Body[0] = GetBody(State, Collision.BodiesInvolved[0]);
-        Body[1] = GetBody(State, Collision.BodiesInvolved[1]);
+        v2 P1 = FurthestPointInShape(Pa, A, Direction) - FurthestPointInShape(Pb, B, -Direction);
+        Insert(Simplex, Simplex->Count, P1);
         
-        v2 dPMaska = Body[0]->dPMask;
-        v2 dPMaskb = Body[1]->dPMask;
-        
-        f32 TotalInverseMass = Body[0]->InverseMass + Body[1]->InverseMass;
-        
-        
-        // 
-        // Interpenetration
-        if (!Collision.SkipInterpenetration)
+        if (Dot(P1, Direction) <= 0.0f)
         {
-            f32 ShareA;
-            if (AlmostEqualRelative(TotalInverseMass, 0.0f))
-            {
-                ShareA = 0.5f;
-            }
-            else
-            {
-                ShareA = Body[0]->InverseMass / TotalInverseMass;
-            }
-            
-            f32 dP = Collision.Depth + 0.005f; // Nudge it a bit further so that it is not colliding anymore
-            f32 dPa = ShareA * dP;
-            f32 dPb = dP - dPa;
-            
-            Body[0]->P -= Hadamard(dPMaska, dPa * Collision.N);
-            Body[1]->P += Hadamard(dPMaskb, dPb * Collision.N);
+            // The last v2 added was not passed the origin
+            return false;
         }
-        
-        
-        //
-        // Calculate forces due to the collision
-        if (!Collision.SkipForceApplication)
+        else
         {
-            v2 N = Collision.N;
-            v2 Va = Body[0]->dP;
-            v2 Vb = Body[1]->dP;
-            
-            f32 ForceCoeff = 1 + Collision.ForceModifier;
-            Body[0]->dP = ForceCoeff * Hadamard(dPMaska, -2.0f * Dot(N, Va)*N + Va);
-            Body[1]->dP = ForceCoeff * Hadamard(dPMaskb, -2.0f * Dot(N, Vb)*N + Vb);
+            if (ContainsOrigin(Simplex, &Direction))
+            {
+                return true;
+            }
         }
     }
+    
+    // The simplex did not converge, this only happens in degenerate cases where the origin is on
+    // the boundary of the Minkowski difference, i.e. the shapes are touching.
+    return false;
 }
 
 
+// The point on the segment closest to the origin, Count becomes 1 if that is one of the ends
+static v2 ClosestOnSegment(v2 *Simplex, u32 *Count)
+{
+    v2 A = Simplex[0];
+    v2 AB = Simplex[1] - A;
+    
+    f32 LengthSqAB = LengthSq(AB);
+    f32 t = LengthSqAB > 0.0f ? -Dot(A, AB) / LengthSqAB : 0.0f;
+    
+    if (t <= 0.0f)
+    {
+        *Count = 1;
+        return A;
+    }
+    
+    if (t >= 1.0f)
+    {
+        Simplex[0] = Simplex[1];
+        *Count = 1;
+        return Simplex[0];
+    }
+    
+    return A + t * AB;
+}
 
 
-//
-// Simulation
-//
-
-void UpdateBody(body& Body, f32 dt)
+// Reduces the simplex to the feature closest to the origin and returns the closest point on
+// it. A triangle is only kept if it contains the origin, the result is then the origin.
+static v2 ClosestOnSimplex(v2 *Simplex, u32 *Count)
 {
-    assert(dt > 0.0f);
+    if (*Count == 1)
+    {
+        return Simplex[0];
+    }
+    
+    if (*Count == 2)
+    {
+        return ClosestOnSegment(Simplex, Count);
+    }
     
-    v2 ddP = Body.F * Body.InverseMass; // F = ma ->  a = F/m -> a = F * (1/m)
-    Body.F = v2_zero;
+    v2 A = Simplex[0];
+    v2 B = Simplex[1];
+    v2 C = Simplex[2];
     
-    Body.dP += Hadamard(Body.dPMask, (ddP * dt) - (Body.Damping * Body.dP));
+    f32 Area = Cross(B - A, C - A);
+    f32 u = Cross(B, C) * Area;
+    f32 v = Cross(C, A) * Area;
+    f32 w = Cross(A, B) * Area;
     
-    Body.PrevP = Body.P;
-    Body.P += Body.dP * dt;
+    if ((Area != 0.0f) && (u >= 0.0f) && (v >= 0.0f) && (w >= 0.0f))
+    {
+        return v2_zero;
+    }
     
     //
-    // Speed limit
-    Body.dP = V2(Min(Body.dP.x, Body.dPMax.x),
-                 Min(Body.dP.y, Body.dPMax.y));
+    // Outside, the closest point is on one of the edges
+    v2 Result = v2_zero;
+    f32 BestDistanceSq = f32Max;
+    v2 Best[2] = {};
+    u32 BestCount = 0;
+    
+    for (u32 Edge = 0; Edge < 3; ++Edge)
+    {
+        v2 Segment[2] = {Simplex[Edge], Simplex[(Edge + 1) % 3]};
+        u32 SegmentCount = 2;
+        v2 P = ClosestOnSegment(Segment, &SegmentCount);
+        
+        if (LengthSq(P) < BestDistanceSq)
+        {
+            BestDistanceSq = LengthSq(P);
+            Result = P;
+            Best[0] = Segment[0];
+            Best[1] = Segment[1];
+            BestCount = SegmentCount;
+        }
+    }
+    
+    Simplex[0] = Best[0];
+    Simplex[1] = Best[1];
+    *Count = BestCount;
+    
+    return Result;
 }
 
 
-
-
-//
-// Collision
 //
-
-collision_info GetCollisionInfo(std::vector<v2>& Simplex, v2 Poa, shape *A, v2 Pob, shape *B)
+// The distance between the shapes, 0 if they overlap. N is the direction from A towards B.
+// GJK on the Minkowski difference B - A, keeping the feature of the simplex closest to the origin.
+f32 GJKDistance(v2 Pa, shape *A, v2 Pb, shape *B, v2 *N)
 {
-    while (1) {
-        edge Edge = FindEdgeClosestToOrigin(Simplex);
+    v2 Direction = NOZ(Pb - Pa);
+    if ((Direction.x == 0.0f) && (Direction.y == 0.0f))
+    {
+        Direction = V2(1.0f, 0.0f);
+    }
+    
+    v2 Simplex[3];
+    u32 Count = 0;
+    
+    v2 V = FurthestPointInShape(Pb, B, -Direction) - FurthestPointInShape(Pa, A, Direction);
+    Simplex[Count++] = V;
+    
+    for (u32 Iteration = 0; Iteration < kMaxGJKIterations; ++Iteration)
+    {
+        f32 DistanceSq = LengthSq(V);
+        if (DistanceSq == 0.0f)
+        {
+            break;
+        }
         
-        v2 P = FurthestPointInShape(Poa, A, Edge.N) - FurthestPointInShape(Pob, B, -Edge.N);
+        // The support point furthest towards the origin
+        v2 Towards = -V * (1.0f / SquareRoot(DistanceSq));
+        v2 W = FurthestPointInShape(Pb, B, Towards) - FurthestPointInShape(Pa, A, -Towards);
         
-        f32 Distance = Dot(P, Edge.N);
-        if (Distance - Edge.Distance < 0.00001f) {
-            collision_info Result;
-            Result.N = Edge.N;
-            Result.Depth = Distance;
-            return Result;
-        } else {
-            Simplex.insert(Simplex.begin() + Edge.VertexIndex, P);
+        if ((DistanceSq - Dot(V, W)) <= kGJKDistanceTolerance * DistanceSq)
+        {
+            break;
+        }
+        
+        Simplex[Count++] = W;
+        V = ClosestOnSimplex(Simplex, &Count);
+        
+        if (Count == 3)
+        {
+            V = v2_zero;
+            break;
+        }
+    }
+    
+    *N = NOZ(V);
+    
+    //
+    // When the shapes are close V is short and the rounding of the support points shows in its
+    // direction, the edge of the simplex that V lies on then gives the better normal
+    if (Count == 2)
+    {
+        v2 Edge = Simplex[1] - Simplex[0];
+        if (LengthSq(Edge) > LengthSq(V))
+        {
+            v2 EdgeN = NOZ(Perp(Edge));
+            *N = Dot(EdgeN, V) < 0.0f ? -EdgeN : EdgeN;
         }
     }
+    
+    f32 Result = Length(V);
+    return Result;
 }
 
 
-b32 Intersects(body *A, body *B, collision_info *Info)
+//
+// The shape Cast moving from S (relative to the centre of Shape) along D, with conservative
+// advancement: the shapes are at least their distance apart along the normal between them, so
+// Cast can move that far towards Shape without passing through it. N is the normal of Shape.
+b32 CastConvex(shape *Cast, v2 S, v2 D, shape *Shape, f32 *t, v2 *N)
 {
-    std::vector<v2> Simplex;
-    
-    v2 Direction = Normalize(B->P - A->P);
+    f32 T = 0.0f;
+    v2 Towards = v2_zero;
     
-    v2 P0 = FurthestPointInShape(A->P, &A->Shape, Direction) - FurthestPointInShape(B->P, &B->Shape, -Direction);
-    Simplex.push_back(P0);
-    
-    Direction = -Direction;
-    
-    while(1)
+    for (u32 Iteration = 0; Iteration < kMaxCastIterations; ++Iteration)
     {
-        v2 P1 = FurthestPointInShape(A->P, &A->Shape, Direction) - FurthestPointInShape(B->P, &B->Shape, -Direction);
-        Simplex.push_back(P1);
-        
-        if (Dot(Simplex.back(), Direction) <= 0.0f)
+        // A step that rounds into contact has no normal of its own, the last one still holds
+        v2 Previous = Towards;
+        f32 Distance = GJKDistance(S + T * D, Cast, v2_zero, Shape, &Towards);
+        if (Distance == 0.0f)
         {
-            // The last v2 added was not passed the origin
-            return false;
+            Towards = Previous;
         }
-        else
+        
+        f32 Closing = Dot(D, Towards);
+        
+        if (Distance <= kCastTolerance)
         {
-            if (ContainsOrigin(Simplex, &Direction))
+            // Shapes that already touch at the start are not hit
+            if (Iteration == 0)
             {
-                if (Info)
-                {
-                    *Info = GetCollisionInfo(Simplex, A->P, &A->Shape, B->P, &B->Shape);
-                }
-                
-                return true;
+                return false;
             }
+            
+            // The rest of the way is as good as straight, it is exact against a flat side
+            *t = Closing > 0.0f ? Min(T + Distance / Closing, 1.0f) : T;
+            *N = -Towards;
+            return true;
+        }
+        
+        if (Closing <= 0.0f)
+        {
+            return false;
+        }
+        
+        T += (Distance - 0.5f * kCastTolerance) / Closing;
+        if (T > 1.0f)
+        {
+            return false;
         }
     }
+    
+    return false;
 }
 
 
@@ -352,35 +2934,73 @@ b32 Intersects(body *A, body *B, collision_info *Info)
 // Geometry related
 //
 
-// Direction should be of unit length
+// The corner on the side of each axis that Direction points to. When Direction is along an axis
+// the corners tie, the one picked is the first of (+, +), (-, +), (-, -), (+, -).
 v2 FurthestPointInRectangle(v2 Po, shape *Rectangle, v2 Direction)
 {
     assert(Rectangle);
     
     v2 H = Rectangle->HalfSize;
-    v2 dX = V2(2.0f*H.x, 0.0f);
-    v2 dY = V2(0.0f    , 2.0f*H.y);
     
-    v2 Vertices[4] = {
-        {Po + H},
-        {Po + H - dX},
-        {Po - H},
-        {Po - H + dX},
-    }; 
+    f32 x = Direction.x > 0.0f ? H.x : (Direction.x < 0.0f ? -H.x : (Direction.y >= 0.0f ? H.x : -H.x));
+    f32 y = Direction.y >= 0.0f ? H.y : -H.y;
     
-    f32 Distance = -(f32Max - 1);
-    v2 Result = v2_zero;
+    v2 Result = Po + V2(x, y);
+    return Result;
+}
+
+
+// The first vertex with the highest dot product with Direction. The padding repeats the first
+// vertex, so it never wins over it.
+static u32 GetSupportIndex(convex_shape const *Convex, v2 Direction)
+{
+#if DYNAMICS_X86
+    __m128 Dx = _mm_set1_ps(Direction.x);
+    __m128 Dy = _mm_set1_ps(Direction.y);
+    
+    __m128 Dot0 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(Convex->X + 0), Dx), _mm_mul_ps(_mm_loadu_ps(Convex->Y + 0), Dy));
+    __m128 Dot1 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(Convex->X + 4), Dx), _mm_mul_ps(_mm_loadu_ps(Convex->Y + 4), Dy));
+    
+    __m128 Best = _mm_max_ps(Dot0, Dot1);
+    Best = _mm_max_ps(Best, _mm_shuffle_ps(Best, Best, _MM_SHUFFLE(2, 3, 0, 1)));
+    Best = _mm_max_ps(Best, _mm_shuffle_ps(Best, Best, _MM_SHUFFLE(1, 0, 3, 2)));
+    
+    u32 Mask = static_cast<u32>(_mm_movemask_ps(_mm_cmpeq_ps(Dot0, Best))) |
+        (static_cast<u32>(_mm_movemask_ps(_mm_cmpeq_ps(Dot1, Best))) << 4);
+    
+    u32 Result = 0;
+    while ((Result < (kMaxConvexVertexCount - 1)) && !(Mask & (1u << Result)))
+    {
+        ++Result;
+    }
+#else
+    u32 Result = 0;
+    f32 Best = Convex->X[0] * Direction.x + Convex->Y[0] * Direction.y;
     
-    for (u32 Index = 0; Index < 4; ++Index)
+    for (u32 Index = 1; Index < Convex->VertexCount; ++Index)
     {
-        f32 CurrDistance = Dot(Vertices[Index], Direction);
-        if (CurrDistance > Distance)
+        f32 Distance = Convex->X[Index] * Direction.x + Convex->Y[Index] * Direction.y;
+        if (Distance > Best)
         {
-            Distance = CurrDistance;
-            Result = Vertices[Index];
+            Best = Distance;
+            Result = Index;
         }
     }
+#endif
+    
+    return Result;
+}
+
+
+// Direction should be of unit length
+v2 FurthestPointInConvex(v2 Po, shape *Convex, v2 Direction)
+{
+    assert(Convex && Convex->Convex);
+    
+    convex_shape const *Shape = Convex->Convex;
+    u32 Index = GetSupportIndex(Shape, Direction);
     
+    v2 Result = Po + V2(Shape->X[Index], Shape->Y[Index]) + Shape->Radius * Direction;
     return Result;
 }
 
@@ -412,6 +3032,11 @@ v2 FurthestPointInShape(v2 Po, shape *Shape, v2 Direction)
             Result = FurthestPointInCircle(Po, Shape, Direction);
         } break;
         
+        case ShapeType_Convex:
+        {
+            Result = FurthestPointInConvex(Po, Shape, Direction);
+        } break;
+        
         default:
         {
             Result = v2_zero;
@@ -436,18 +3061,19 @@ v2 NormalTowards(v2 Line, v2 Direction)
 }
 
 
-b32 ContainsOrigin(std::vector<v2>& Simplex, v2 *Direction)
+b32 ContainsOrigin(polytope *Simplex, v2 *Direction)
 {
+    assert(Simplex);
     b32 Result = false;
     
-    v2 A = Simplex.back();
+    v2 A = Simplex->Vertices[Simplex->Count - 1];
     v2 AO = Normalize(-A);
     
-    if (Simplex.size() == 3)
+    if (Simplex->Count == 3)
     {
         // Triangle!
-        v2 B = Simplex[1];
-        v2 C = Simplex[0];
+        v2 B = Simplex->Vertices[1];
+        v2 C = Simplex->Vertices[0];
         
         v2 AB = B - A;
         v2 AC = C - A;
@@ -458,13 +3084,13 @@ b32 ContainsOrigin(std::vector<v2>& Simplex, v2 *Direction)
         if (Dot(ABPerp, AO) > 0)
         {
             // The origin is outside and in the direction of AB, remove point C
-            Simplex.erase(Simplex.begin());
+            Remove(Simplex, 0);
             *Direction = ABPerp;
         }
         else if (Dot(ACPerp, AO) > 0)
         {
             // The origin is outside and in the direction of AC, remove point B
-            Simplex.erase(Simplex.begin() + 1);
+            Remove(Simplex, 1);
             *Direction = ACPerp;
         }
         else
@@ -473,10 +3099,10 @@ b32 ContainsOrigin(std::vector<v2>& Simplex, v2 *Direction)
             Result = true;
         }
     }
-    else if (Simplex.size() == 2)
+    else if (Simplex->Count == 2)
     {
         // We are a line! Yay, let's go do some typical line-things.
-        v2 B = Simplex[0];
+        v2 B = Simplex->Vertices[0];
         v2 AB = B - A;
         
         v2 Normal = NormalTowards(AB, AO);
@@ -491,18 +3117,22 @@ b32 ContainsOrigin(std::vector<v2>& Simplex, v2 *Direction)
 }
 
 
-edge FindEdgeClosestToOrigin(std::vector<v2>& Simplex)
+edge FindEdgeClosestToOrigin(polytope *Polytope)
 {
+    assert(Polytope);
+    
     edge Result;
+    Result.N = v2_zero;
     Result.Distance = f32Max;
+    Result.VertexIndex = 0;
     
-    std::vector<v2>::size_type Size = Simplex.size();
+    u32 Size = Polytope->Count;
     for (u32 CurrIndex = 0; CurrIndex < Size; ++CurrIndex)
     {
         u32 NextIndex = (CurrIndex + 1) % Size;
         
-        v2 A = Simplex[CurrIndex];
-        v2 B = Simplex[NextIndex];
+        v2 A = Polytope->Vertices[CurrIndex];
+        v2 B = Polytope->Vertices[NextIndex];
         v2 E = B - A;
         v2 N = NormalTowards(E, A);
         
@@ -517,3 +3147,33 @@ edge FindEdgeClosestToOrigin(std::vector<v2>& Simplex)
     
     return Result;
 }
+
+
+void Insert(polytope *Polytope, u32 Index, v2 P)
+{
+    assert(Polytope);
+    assert(Index <= Polytope->Count);
+    assert(Polytope->Count < kMaxPolytopeVertexCount);
+    
+    for (u32 Curr = Polytope->Count; Curr > Index; --Curr)
+    {
+        Polytope->Vertices[Curr] = Polytope->Vertices[Curr - 1];
+    }
+    
+    Polytope->Vertices[Index] = P;
+    ++Polytope->Count;
+}
+
+
+void Remove(polytope *Polytope, u32 Index)
+{
+    assert(Polytope);
+    assert(Index < Polytope->Count);
+    
+    for (u32 Curr = Index + 1; Curr < Polytope->Count; ++Curr)
+    {
+        Polytope->Vertices[Curr - 1] = Polytope->Vertices[Curr];
+    }
+    
+    --Polytope->Count;
+}
@@ -26,68 +26,507 @@
 #define dynamics__h
 
 #include <vector> // @debug
+#include <deque>
 #include "mathematics.h" // includes types.h
 
+struct worker_pool;
 
 
+
+// Index into the body arrays, only valid until a body is created or destroyed. Use a
+// body_handle to refer to a body for longer than that.
 typedef s32 body_index;
 
+
+//
+// Generational handle to a body. The slot is reused when the body is destroyed, but with a new
+// generation, so an old handle never refers to another body.
+u32 constexpr kInvalidBodySlot = 0xFFFFFFFF;
+
+struct body_handle
+{
+    u32 Slot = kInvalidBodySlot;
+    u32 Generation = 0;
+};
+
+inline b32 operator==(body_handle A, body_handle B)
+{
+    b32 Result = (A.Slot == B.Slot) && (A.Generation == B.Generation);
+    return Result;
+}
+
+inline b32 operator!=(body_handle A, body_handle B)
+{
+    b32 Result = !(A == B);
+    return Result;
+}
+
 enum shape_type
 {
     ShapeType_Rectangle,
     ShapeType_Circle,
+    ShapeType_Convex,
     
     ShapeType_Count,
 };
 
 
+struct aabb
+{
+    v2 Min;
+    v2 Max;
+};
+
+
+//
+// Convex polygon of up to kMaxConvexVertexCount vertices, rounded by Radius. A capsule is a
+// segment, two vertices, with a radius. The vertices are relative to the body position and
+// already rotated, the bodies themselves don't rotate. They are stored as x and y arrays padded
+// with copies of the first vertex, so that the support function can test all of them at once
+// with two SIMD dot products.
+u32 constexpr kMaxConvexVertexCount = 8;
+
+struct convex_shape
+{
+    f32 X[kMaxConvexVertexCount]; // Counter-clockwise
+    f32 Y[kMaxConvexVertexCount];
+    u32 VertexCount;
+    f32 Radius;
+    aabb Bounds; // Relative to the body position, with the radius
+};
+
+
 struct shape
 {
     s32 BodyIndex = -1;
+    shape_type Type = ShapeType_Rectangle;
     union
     {
         v2 HalfSize = V2(1.0f, 1.0f);
         f32 Radius;
+        convex_shape const *Convex; // See NewPolygonShape()
     };
-    shape_type Type = ShapeType_Rectangle;
 };
 
 
+enum body_flags
+{
+    // Collisions are found by sweeping the body from PrevP to P instead of only testing the
+    // end position, so that it can not tunnel through thin bodies when moving fast.
+    // Currently only circles swept against rectangles (and vice versa) are handled.
+    BodyFlag_Continuous = 0x1,
+    
+    // Set by the dynamics, the body is neither integrated nor moved in the broadphase. Static
+    // bodies always have it set, dynamic bodies get it when they have been (almost) still for a
+    // while and lose it when they are hit by an awake body, or get a force or a new position.
+    BodyFlag_Sleeping = 0x2,
+};
+
+
+enum body_type
+{
+    BodyType_Dynamic,   // Moved by forces and contacts
+    BodyType_Kinematic, // Moved by its velocity only, pushes dynamic bodies but is never pushed
+    BodyType_Static,    // Never moves
+};
+
+
+//
+// Collision filtering, each body is in one or more layers and has a mask of the layers it collides
+// with. Two bodies are only paired by the broadphase if each is in a layer in the mask of the other.
+u32 constexpr kDefaultCollisionLayer = 0x1;
+u32 constexpr kAllCollisionLayers = 0xFFFFFFFF;
+
+
+struct body_slot
+{
+    u32 Generation = 0;
+    u32 Index = 0; // The body_index when the slot is in use, the next free slot when not
+};
+
+
+//
+// The body data is stored as a structure-of-arrays in dynamics_state::Bodies, all arrays are
+// indexed with the body_index. The arrays are kept packed, destroying a body moves the last body
+// into its place. Slots maps the handles to the body indices.
+struct body_arrays
+{
+    // The dynamics system will not do anything with this, neither free nor allocate any memory.
+    std::vector<void *> UserData;
+    
+    std::vector<shape> Shapes;
+    
+    std::vector<v2> P;
+    std::vector<v2> PrevP;
+    
+    std::vector<v2> dP;
+    std::vector<v2> dPMax;
+    std::vector<v2> dPMask;
+    
+    std::vector<v2> F;
+    std::vector<f32> Damping;
+    std::vector<f32> InverseMass;
+    std::vector<f32> Restitution; // Of a pair the highest one is used
+    std::vector<f32> Friction;    // Of a pair the geometric mean is used
+    
+    std::vector<u32> Flags; // body_flags
+    std::vector<body_type> Types;
+    std::vector<f32> SleepTimes; // For how long the body has been below the sleep speed
+    std::vector<u32> Layers;     // See SetCollisionFilter()
+    std::vector<u32> Masks;
+    
+    std::vector<u32> SlotIndices; // The slot that refers to the body
+    
+    u32 Count = 0;
+    
+    std::vector<body_slot> Slots; // Indexed with body_handle::Slot
+    u32 FirstFreeSlot = kInvalidBodySlot;
+};
+
+
+//
+// A proxy that refers to a single body in the body_arrays, used to set up and inspect bodies.
+// Note: just like a pointer into a std::vector it is invalidated when a body is created or
+// destroyed, keep a body_handle instead.
 struct body
 {
-    // The dynamics system eill not do anything with this, neither free nor allocate any memory.
-    void *UserData = nullptr; 
+    void *&UserData;
+    
+    shape &Shape;
     
-    shape Shape;
+    v2 &P;
+    v2 &PrevP;
     
-    v2 P = v2_zero;
-    v2 PrevP = v2_zero;
+    v2 &dP;
+    v2 &dPMax;
+    v2 &dPMask;
     
-    v2 dP = v2_zero;
-    v2 dPMax = V2(f32Max, f32Max);
-    v2 dPMask = v2_one;
+    v2 &F;
+    f32 &Damping;
+    f32 &InverseMass;
+    f32 &Restitution;
+    f32 &Friction;
     
-    v2 F = v2_zero;
-    f32 Damping = 0.0f;
-    f32 InverseMass = 1.0f;
+    u32 &Flags;
 };
 
 
 struct collision_info
 {
     void *UserData[2] = {};
-    body_index BodiesInvolved[2] = {};
+    body_handle Handles[2] = {};
+    body_index BodiesInvolved[2] = {}; // Only valid until a body is created or destroyed
     v2 N = v2_zero;
-    f32 ForceModifier = 0.0f;
+    f32 ForceModifier = 0.0f; // Added to the restitution of the pair
     f32 Depth = 0.0f;
-    b32 SkipInterpenetration = false;
-    b32 SkipForceApplication = false;
+    b32 SkipInterpenetration = false; // Not pushed apart
+    b32 SkipForceApplication = false; // No impulses, the velocities are left as they are
+};
+
+
+//
+// Broadphase, sweep-and-prune along the x-axis. The proxies are kept sorted on MinX between
+// frames, so that the (mostly) sorted array can be re-sorted cheaply with an insertion sort.
+// Sleeping and static bodies are kept in a separate array, RestingProxies, that is only rebuilt
+// when a body falls asleep or wakes up. Resting bodies are never tested against each other and
+// the awake proxies find the resting ones they overlap with a binary search.
+struct broadphase_proxy
+{
+    aabb Bounds;
+    body_index BodyIndex;
+    u32 Layer; // Copied from the body for the filtering
+    u32 Mask;
+};
+
+struct body_pair
+{
+    body_index A;
+    body_index B;
+};
+
+struct broadphase
+{
+    std::vector<broadphase_proxy> Proxies;
+    std::vector<broadphase_proxy> RestingProxies;
+    f32 RestingMaxWidth = 0.0f;
+    b32 Rebuild = true; // Set when a body moves between Proxies and RestingProxies
+    
+    std::vector<body_pair> Pairs;
+    
+    // Per chunk output of the sweep, concatenated in chunk order into Pairs
+    std::vector<std::vector<body_pair>> ChunkPairs;
+    std::vector<u32> ChunkTestCounts;
+};
+
+
+//
+// Contact cache, keeps the result of the narrowphase for each pair of bodies that used GJK + EPA
+// last frame. The cached normal seeds GJK, and as long as the two bodies have moved less than
+// kContactCacheMaxMotion relative to each other since EPA was run, EPA is skipped and the cached
+// normal is used with the depth adjusted for the motion. The closed form tests are cheaper than
+// a lookup, so those pairs are not cached.
+struct contact_cache_entry
+{
+    u64 Key;            // The slots of the two bodies, the lowest one in the high bits
+    u32 Generations[2]; // Of the body in the lowest and the highest slot
+    
+    // From the body in the lowest slot towards the other one, as when EPA was last run
+    v2 N;
+    f32 Depth;
+    v2 D; // The position of the body in the highest slot relative to the other one
+};
+
+struct contact_cache_stats
+{
+    u32 LookupCount = 0;
+    u32 HitCount = 0;
+    u32 EPASkipCount = 0;
+};
+
+struct contact_cache
+{
+    std::vector<contact_cache_entry> Entries; // Sorted on Key
+    std::vector<contact_cache_entry> NewEntries;
+    
+    // Per narrowphase chunk, merged into Entries after the narrowphase
+    std::vector<std::vector<contact_cache_entry>> ChunkEntries;
+    std::vector<contact_cache_stats> ChunkStats;
+};
+
+
+//
+// Contact events, DetectCollisions() compares the pairs of bodies that touch with the ones that
+// touched after the previous call. Each pair gets one event, ordered on the slots of the bodies.
+enum contact_event_type
+{
+    ContactEvent_Begin, // Touching now but not in the previous call
+    ContactEvent_Stay,  // Touching in both
+    ContactEvent_End,   // Touched in the previous call but not now, or one of them was destroyed
+};
+
+u32 constexpr kNoCollision = 0xFFFFFFFF;
+
+struct contact_event
+{
+    contact_event_type Type;
+    u32 Collision; // Index into the output of DetectCollisions(), kNoCollision for ContactEvent_End
+    u32 Layers[2];
+    body_handle Handles[2]; // The handles are no longer valid for an End with a destroyed body
+    void *UserData[2];
+};
+
+struct contact_event_pair
+{
+    u64 Key;            // The slots of the two bodies, as in the contact cache
+    u32 Generations[2]; // Of the body in the lowest and the highest slot
+    contact_event Event;
+};
+
+struct contact_events
+{
+    std::vector<contact_event> Events; // Of the last call to DetectCollisions()
+    
+    std::vector<contact_event_pair> Pairs; // Touching after the last call, sorted on Key
+    std::vector<contact_event_pair> NewPairs;
+};
+
+
+//
+// Sequential impulse solver. ResolveCollisions() makes VelocityIterations passes over the
+// contacts, each one applies the impulse that takes the relative normal velocity of the pair
+// towards the one given by the restitution, and a friction impulse along the surface. The
+// impulses are accumulated per contact and clamped, so the bodies are never pulled together.
+// They are kept until the next step and applied up front (warm starting), which lets resting
+// contacts and stacks settle with few iterations. PositionIterations passes then move the
+// bodies apart by Baumgarte times the depth beyond Slop, without changing the velocities.
+struct contact_constraint
+{
+    body_index A;
+    body_index B;
+    v2 N; // From A towards B
+    v2 T;
+    v2 D; // The position of B relative to A when the constraint was set up
+    f32 Depth;
+    f32 InverseMassA; // 0 for immovable bodies
+    f32 InverseMassB;
+    f32 NormalMass; // 1 / the inverse mass of the pair along N, with the dPMasks applied
+    f32 TangentMass;
+    f32 TargetSpeed; // The relative normal velocity the restitution asks for
+    f32 Friction;
+    f32 NormalImpulse;
+    f32 TangentImpulse;
+    b32 SkipInterpenetration;
+    b32 SkipForceApplication;
+};
+
+struct contact_impulse
+{
+    u64 Key;            // The slots of the two bodies, as in the contact cache
+    u32 Generations[2]; // Of the body in the lowest and the highest slot
+    f32 NormalImpulse;
+    f32 TangentImpulse;
+};
+
+struct contact_solver
+{
+    u32 VelocityIterations = 4;
+    u32 PositionIterations = 2;
+    f32 Baumgarte = 0.8f;
+    f32 Slop = 0.01f;
+    
+    std::vector<contact_constraint> Constraints; // Per contact, in the order of the input
+    std::vector<contact_impulse> Impulses; // Of the last step, sorted on Key
+    std::vector<contact_impulse> NewImpulses;
+};
+
+
+//
+// The contacts are split into batches where no movable body occurs twice, the contacts in a
+// batch can then be resolved in parallel. Contacts that could not be given one of the
+// kMaxContactBatchCount colours end up in a final batch that is resolved sequentially.
+u32 constexpr kMaxContactBatchCount = 64;
+
+struct contact_batches
+{
+    std::vector<u64> BodyColours; // Bit n is set if the body is in batch n
+    std::vector<u32> Colours;     // Per contact
+    std::vector<u32> Order;       // Contact indices sorted on batch
+    u32 Offsets[kMaxContactBatchCount + 2];
+};
+
+
+//
+// Bounding volume hierarchy over the body bounds for the queries, see dynamics_query.cpp. It is
+// built by the first query after bodies have been created or destroyed, and refitted by the first
+// query after the bodies have moved. Internal nodes have their two children at First and
+// First + 1, leaves refer to Count bodies in Items starting at First.
+struct bvh_node
+{
+    aabb Bounds;
+    u32 First = 0;
+    u16 Count = 0; // 0 for internal nodes
+    u16 Axis = 0;  // That the children were split along
+};
+
+struct query_tree
+{
+    std::vector<bvh_node> Nodes;
+    std::vector<body_index> Items;
+    std::vector<aabb> Bounds; // Per body, indexed with the body_index
+    
+    b32 Rebuild = true;
+    b32 Refit = false;
+    u32 RefitCount = 0; // Since the last rebuild, the tree gets worse as the bodies move
+};
+
+
+//
+// Wall-clock time of the last call of a phase, and by how much the arrays owned by the dynamics
+// grew during it. The growth should stay at 0 once the simulation has warmed up.
+struct dynamics_phase_stats
+{
+    u64 Nanoseconds = 0;
+    u64 AllocatedBytes = 0;
+};
+
+struct dynamics_stats
+{
+    u32 BodyCount = 0;
+    u32 SleepingBodyCount = 0; // Including the static bodies
+    u32 BroadphaseTestCount = 0; // AABB vs AABB tests done in the sweep
+    u32 PairTestCount = 0;       // Candidate pairs passed on to the narrowphase
+    u32 CollisionCount = 0;
+    u32 ContactBatchCount = 0;
+    contact_cache_stats ContactCache; // HitCount / LookupCount is the hit rate
+    
+    dynamics_phase_stats Update;      // Integration, per BodyCount
+    dynamics_phase_stats Broadphase;  // Per BroadphaseTestCount
+    dynamics_phase_stats Narrowphase; // Per PairTestCount
+    dynamics_phase_stats Resolve;     // Per CollisionCount
+    u64 ArrayBytes = 0; // The capacity of all the arrays owned by the dynamics
+};
+
+
+//
+// Integration kernels, implemented in dynamics_simd.cpp. They all do the same symplectic Euler
+// step over the bodies [First, First + Count), the SIMD versions 4 (SSE2) or 8 (AVX2) bodies
+// at a time. The scalar version is the reference. IntegrateFixed is an experiment that does the
+// step in Q48.16 fixed point on the f32 bodies, DYNAMICS_FIXED_POINT picks it instead of the SIMD
+// kernels. It is slower than the f32 kernels and doesn't make a run lockstep safe, since the
+// narrowphase and the solver stay f32, the lockstep build relies on DETERMINISTIC for that.
+typedef void integrate_function(body_arrays *Bodies, u32 First, u32 Count, f32 dt);
+
+enum simd_level
+{
+    SimdLevel_Scalar,
+    SimdLevel_SSE2,
+    SimdLevel_AVX2,
+    
+    SimdLevel_Count,
+};
+
+simd_level GetSupportedSimdLevel();
+integrate_function *GetIntegrateFunction(simd_level Level);
+
+void IntegrateScalar(body_arrays *Bodies, u32 First, u32 Count, f32 dt);
+void IntegrateSSE2(body_arrays *Bodies, u32 First, u32 Count, f32 dt);
+void IntegrateAVX2(body_arrays *Bodies, u32 First, u32 Count, f32 dt);
+void IntegrateFixed(body_arrays *Bodies, u32 First, u32 Count, f32 dt);
+
+
+//
+// Fixed timestep, Simulate() adds the wall-clock time to the accumulator and runs as many steps of
+// StepTime as fits. What is left is used to interpolate between the last two steps when rendering.
+struct dynamics_timestep
+{
+    f32 StepTime = 1.0f / 60.0f;
+    u32 MaxStepCount = 8; // Per call, the rest of the time is dropped so that a slow frame can't snowball
+    
+    f32 Accumulator = 0.0f;
+    f32 Alpha = 0.0f; // Accumulator / StepTime after the last call, in [0, 1)
+};
+
+
+struct dynamics_snapshot_header
+{
+    u32 Size = 0; // Of the whole snapshot, the header included
+    u32 BodyCount = 0;
+    u32 SlotCount = 0;
+    u32 FirstFreeSlot = kInvalidBodySlot;
+    u32 ContactCount = 0;
+    u32 ImpulseCount = 0;
+    u32 EventPairCount = 0;
+    f32 Accumulator = 0.0f;
+    f32 Alpha = 0.0f;
 };
 
 
 struct dynamics_state
 {
-    std::vector<body> Bodies;
+    body_arrays Bodies;
+    broadphase Broadphase;
+    contact_batches Batches;
+    contact_solver Solver;
+    contact_cache ContactCache;
+    contact_events ContactEvents;
+    query_tree QueryTree;
+    std::vector<std::vector<collision_info>> ChunkCollisions;
+    dynamics_stats Stats;
+    dynamics_timestep Timestep;
+    
+    // Used by Simulate(), the collisions of the last step
+    std::vector<collision_info> Collisions;
+    
+    // Created by NewPolygonShape() and NewCapsuleShape(), the shapes of the bodies point into it.
+    // A deque, so that the pointers stay valid when more are added.
+    std::deque<convex_shape> ConvexShapes;
+    
+    // Picked by Init() from what the CPU supports
+    integrate_function *Integrate = nullptr;
+    
+    // Optional, not owned. If set the step is split into chunks that are run on the workers.
+    // The result does not depend on the number of threads.
+    worker_pool *Workers = nullptr;
 };
 
 void Init(dynamics_state *State);
@@ -95,16 +534,47 @@ void Shutdown(dynamics_state *State);
 
 
 //
-// Add a new body to the simulation, returns the index of the body in the "body-array"
-body *NewRectangleBody(dynamics_state *State, v2 Size, void *UserData = nullptr);
-body *NewCircleBody(dynamics_state *State, f32 Radius, void *UserData = nullptr);
+// Create and destroy bodies, both are O(1)
+body_handle NewRectangleBody(dynamics_state *State, v2 Size, void *UserData = nullptr);
+body_handle NewCircleBody(dynamics_state *State, f32 Radius, void *UserData = nullptr);
+body_handle NewConvexBody(dynamics_state *State, convex_shape const *Shape, void *UserData = nullptr);
+void DestroyBody(dynamics_state *State, body_handle Handle);
+
+// False for destroyed bodies and default constructed handles
+b32 IsValid(dynamics_state *State, body_handle Handle);
+
+
+//
+// Convex shapes for NewConvexBody(), shared by any number of bodies. They are owned by State and
+// live until Init() or Shutdown(), bodies in another dynamics_state may use them as long as
+// State outlives them. Polygons are the convex hull of the Count <= kMaxConvexVertexCount
+// vertices, rotated by Angle around the body position. Capsules are Length between the centres
+// of the two end caps and lie along the x-axis before they are rotated.
+convex_shape const *NewPolygonShape(dynamics_state *State, v2 const *Vertices, u32 Count, f32 Angle = 0.0f, f32 Radius = 0.0f);
+convex_shape const *NewCapsuleShape(dynamics_state *State, f32 Length, f32 Radius, f32 Angle = 0.0f);
 
 
 //
 // Getters & Setters
-body *GetBody(dynamics_state *State, body_index BodyIndex);
-body_index GetBodyIndex(dynamics_state *State, body *Body);
-void SetP(dynamics_state *State, body_index BodyIndex, v2 P);
+body GetBody(dynamics_state *State, body_handle Handle);
+body_index GetBodyIndex(dynamics_state *State, body_handle Handle);
+body_handle GetBodyHandle(dynamics_state *State, body_index BodyIndex);
+void SetP(dynamics_state *State, body_handle Handle, v2 P);
+
+// Static and kinematic bodies get an InverseMass of 0, new bodies are dynamic
+void SetType(dynamics_state *State, body_handle Handle, body_type Type);
+body_type GetType(dynamics_state *State, body_handle Handle);
+
+// New bodies are in kDefaultCollisionLayer and collide with kAllCollisionLayers
+void SetCollisionFilter(dynamics_state *State, body_handle Handle, u32 Layer, u32 Mask);
+u32 GetCollisionLayer(dynamics_state *State, body_handle Handle);
+u32 GetCollisionMask(dynamics_state *State, body_handle Handle);
+
+
+//
+// Sleeping
+void WakeUp(dynamics_state *State, body_handle Handle);
+b32 IsSleeping(dynamics_state *State, body_handle Handle);
 
 
 //
@@ -113,7 +583,85 @@ void Update(dynamics_state *State, f32 dt);
 
 
 //
-// Detect and resolve collisions
+// Runs fixed steps of State->Timestep.StepTime for the wall-clock time dt, returns the number of
+// steps taken. Each step is PreStep, Update, DetectCollisions, OnCollisions and ResolveCollisions.
+// The forces are cleared by every step, so PreStep is where they should be applied. OnCollisions
+// may change the collisions before they are resolved. Both callbacks are optional.
+typedef void pre_step_function(dynamics_state *State, f32 dt, void *Data);
+typedef void collisions_function(dynamics_state *State, std::vector<collision_info>& Collisions, void *Data);
+
+u32 Simulate(dynamics_state *State, f32 dt, pre_step_function *PreStep = nullptr, 
+             collisions_function *OnCollisions = nullptr, void *Data = nullptr);
+
+// Writes the stats as one line of space separated key=value pairs, including the cost per
+// operation of each phase, for logging and comparing runs. Returns the length of the line.
+size_t FormatStats(dynamics_stats const *Stats, char *Buffer, size_t Size);
+
+// The position blended between the last two steps with Timestep.Alpha, for rendering
+v2 GetInterpolatedP(dynamics_state *State, body_handle Handle);
+
+
+//
+// Hash of the state that decides how the simulation continues, for checking that two runs (or
+// two machines in lockstep) are in sync. Only comparable between builds with DETERMINISTIC.
+u64 Checksum(dynamics_state *State);
+
+
+//
+// Snapshots, for rollback. A snapshot is one block of plain data that can be copied around with
+// memcpy: a dynamics_snapshot_header followed by the body arrays, the slots, the contact cache,
+// the accumulated impulses of the solver and the pairs that were touching. With the pairs, a
+// rollback only gives Begin events for contacts that weren't there when the snapshot was saved.
+// The user data and convex shape pointers are stored as they are, so a snapshot is only valid in
+// the process that saved it. Restoring it and stepping again gives the same result in
+// DETERMINISTIC builds.
+size_t GetSnapshotSize(dynamics_state *State);
+size_t SaveSnapshot(dynamics_state *State, void *Memory, size_t Size); // Returns 0 if it doesn't fit in Size
+b32 RestoreSnapshot(dynamics_state *State, void const *Memory, size_t Size);
+
+
+//
+// Queries, implemented in dynamics_query.cpp. The rays and casts go from Origin to
+// Origin + Direction, a body that the ray or the shape already overlaps at Origin is not hit.
+// Bodies changed directly through a body proxy are seen by the queries after the next Update().
+// The queries update the tree on demand, so they must not be called from several threads at the
+// same time; the batched RayCast() runs on State->Workers itself.
+struct query_hit
+{
+    b32 Hit = false;
+    body_handle Handle;
+    void *UserData = nullptr;
+    f32 t = 1.0f; // Fraction of Direction
+    v2 P = v2_zero; // Origin + t * Direction, for a shape cast where the shape is when it touches
+    v2 N = v2_zero; // Surface normal of the body that was hit
+};
+
+struct ray_query
+{
+    v2 Origin;
+    v2 Direction;
+};
+
+b32 RayCast(dynamics_state *State, v2 Origin, v2 Direction, query_hit *Hit);
+b32 ShapeCast(dynamics_state *State, shape *Shape, v2 Origin, v2 Direction, query_hit *Hit);
+
+// Appends the bodies that overlap Bounds to Output, returns how many were added
+u32 OverlapAABB(dynamics_state *State, aabb Bounds, std::vector<body_handle>& Output);
+
+// The closest hit for each of the Count rays, traced four at a time with SIMD slab tests. Rays
+// that start close to each other and go in similar directions should be next to each other.
+void RayCast(dynamics_state *State, ray_query const *Rays, u32 Count, query_hit *Hits);
+
+
+//
+// Bounds
+aabb GetAABB(v2 P, shape *Shape);
+aabb GetAABB(dynamics_state *State, body_handle Handle);
+
+
+//
+// Detect and resolve collisions. DetectCollisions() appends the collisions to Output and replaces
+// State->ContactEvents.Events with the events for them.
 void DetectCollisions(dynamics_state *State, std::vector<collision_info>& Output);
 void ResolveCollisions(dynamics_state *State, std::vector<collision_info>& Input, f32 dt);
 
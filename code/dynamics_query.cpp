@@ -0,0 +1,793 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "dynamics.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+
+#ifdef DEBUG
+#include <assert.h>
+#else
+#define assert(x)
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define DYNAMICS_X86 1
+#include <emmintrin.h>
+#endif
+
+
+
+//
+// Ray, shape and AABB queries against the bodies. They all walk a bounding volume hierarchy,
+// query_tree, that is built with median splits along the longest axis of each node. When the
+// bodies have only moved the tree is refitted instead, which is linear in the number of nodes.
+// The batched ray cast traces packets of four rays through the tree together and tests each node
+// against all four with one set of SIMD slab tests.
+//
+
+
+
+
+//
+// Constants
+//
+
+u32 constexpr kBVHLeafSize = 4;
+u32 constexpr kBVHMaxRefitCount = 64; // Rebuilt instead after this many refits in a row
+u32 constexpr kBVHMaxStackSize = 64;  // The median splits keep the depth at log2(BodyCount)
+
+u32 constexpr kRayPacketChunkSize = 16; // Packets of four rays per chunk on the worker_pool
+
+// Used instead of 1/0 for the axes a ray doesn't move along, keeps the slab tests free of NaNs
+f32 constexpr kMaxInverseDirection = 1e30f;
+
+
+
+
+//
+// Forward declarations of "private" functions
+//
+
+//
+// Tree
+void UpdateQueryTree(dynamics_state *State);
+void BuildNode(query_tree *Tree, u32 *NodeCount, u32 NodeIndex, u32 First, u32 Count);
+void RefitTree(query_tree *Tree);
+
+//
+// Shapes
+b32 RayVsShape(v2 S, v2 D, shape *Shape, f32 *t, v2 *N);
+b32 RayVsBox(v2 S, v2 D, v2 HalfSize, f32 *t, v2 *N);
+b32 CastVsShape(shape *Cast, v2 S, v2 D, shape *Shape, f32 *t, v2 *N);
+b32 OverlapsShape(aabb const& Bounds, v2 P, shape *Shape);
+
+//
+// From dynamics.cpp
+aabb GetAABB(dynamics_state *State, body_index BodyIndex);
+b32 Overlaps(aabb const& A, aabb const& B);
+aabb Union(aabb const& A, aabb const& B);
+b32 SweepCircleRectangle(v2 S, v2 D, v2 HalfSize, f32 Radius, f32 *TOI, v2 *N);
+b32 SweepCircleCorner(v2 S, v2 D, v2 Corner, f32 Radius, f32 *TOI);
+b32 CastConvex(shape *Cast, v2 S, v2 D, shape *Shape, f32 *t, v2 *N);
+b32 IntersectsGJK(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info);
+
+
+
+
+//
+// Traversal
+//
+
+static v2 GetInverseDirection(v2 D)
+{
+    v2 Result;
+    Result.x = (Abs(D.x) > (1.0f / kMaxInverseDirection)) ? (1.0f / D.x) : (D.x < 0.0f ? -kMaxInverseDirection : kMaxInverseDirection);
+    Result.y = (Abs(D.y) > (1.0f / kMaxInverseDirection)) ? (1.0f / D.y) : (D.y < 0.0f ? -kMaxInverseDirection : kMaxInverseDirection);
+    return Result;
+}
+
+
+// Ray from Origin against Bounds grown by Extent, true if it enters before MaxT
+static b32 SlabTest(aabb const& Bounds, v2 Extent, v2 Origin, v2 InvD, f32 MaxT)
+{
+    f32 t0x = (Bounds.Min.x - Extent.x - Origin.x) * InvD.x;
+    f32 t1x = (Bounds.Max.x + Extent.x - Origin.x) * InvD.x;
+    f32 t0y = (Bounds.Min.y - Extent.y - Origin.y) * InvD.y;
+    f32 t1y = (Bounds.Max.y + Extent.y - Origin.y) * InvD.y;
+    
+    f32 Enter = Max(Max(Min(t0x, t1x), Min(t0y, t1y)), 0.0f);
+    f32 Exit = Min(Min(Max(t0x, t1x), Max(t0y, t1y)), MaxT);
+    
+    b32 Result = Enter <= Exit;
+    return Result;
+}
+
+
+// Pushes the children of an internal node so that the one closest along Direction is popped first
+static void PushChildren(bvh_node const& Node, v2 Direction, u32 *Stack, u32 *StackCount)
+{
+    assert(*StackCount + 2 <= kBVHMaxStackSize);
+    
+    b32 Reverse = (Node.Axis == 0 ? Direction.x : Direction.y) < 0.0f;
+    Stack[(*StackCount)++] = Node.First + (Reverse ? 0 : 1);
+    Stack[(*StackCount)++] = Node.First + (Reverse ? 1 : 0);
+}
+
+
+// Walks the nodes that the ray (or the box of half size Extent moving along it) passes through
+// before *MaxT, TestBody(Index, MaxT) is called for the bodies in them and may lower *MaxT.
+template <typename test_function>
+static void TraceRay(query_tree *Tree, v2 Origin, v2 Direction, v2 Extent, f32 *MaxT, test_function TestBody)
+{
+    if (Tree->Nodes.empty())
+    {
+        return;
+    }
+    
+    v2 InvD = GetInverseDirection(Direction);
+    
+    u32 Stack[kBVHMaxStackSize];
+    u32 StackCount = 0;
+    Stack[StackCount++] = 0;
+    
+    while (StackCount > 0)
+    {
+        bvh_node const& Node = Tree->Nodes[Stack[--StackCount]];
+        
+        if (!SlabTest(Node.Bounds, Extent, Origin, InvD, *MaxT))
+        {
+            continue;
+        }
+        
+        if (Node.Count > 0)
+        {
+            for (u32 Item = Node.First; Item < (Node.First + Node.Count); ++Item)
+            {
+                TestBody(Tree->Items[Item], MaxT);
+            }
+        }
+        else
+        {
+            PushChildren(Node, Direction, Stack, &StackCount);
+        }
+    }
+}
+
+
+// Keeps the closest hit, ties go to the lowest body index so that the result doesn't depend on
+// the shape of the tree. The first hit may be at MaxT itself, i.e. at the end of the ray.
+static void KeepClosest(f32 t, v2 N, body_index Index, f32 *MaxT, body_index *HitIndex, v2 *HitN)
+{
+    if ((t < *MaxT) || ((t == *MaxT) && ((*HitIndex < 0) || (Index < *HitIndex))))
+    {
+        *MaxT = t;
+        *HitIndex = Index;
+        *HitN = N;
+    }
+}
+
+
+static void FillHit(dynamics_state *State, v2 Origin, v2 Direction, f32 t, v2 N, body_index Index, query_hit *Hit)
+{
+    *Hit = query_hit();
+    
+    if (Index >= 0)
+    {
+        Hit->Hit = true;
+        Hit->Handle = GetBodyHandle(State, Index);
+        Hit->UserData = State->Bodies.UserData[Index];
+        Hit->t = t;
+        Hit->P = Origin + t * Direction;
+        Hit->N = N;
+    }
+}
+
+
+
+
+//
+// "Public" functions (declared in the header file).
+//
+
+b32 RayCast(dynamics_state *State, v2 Origin, v2 Direction, query_hit *Hit)
+{
+    assert(State);
+    assert(Hit);
+    
+    UpdateQueryTree(State);
+    
+    body_arrays *Bodies = &State->Bodies;
+    
+    f32 MaxT = 1.0f;
+    body_index HitIndex = -1;
+    v2 HitN = v2_zero;
+    
+    TraceRay(&State->QueryTree, Origin, Direction, v2_zero, &MaxT, [&](body_index Index, f32 *ClosestT)
+    {
+        f32 t;
+        v2 N;
+        if (RayVsShape(Origin - Bodies->P[Index], Direction, &Bodies->Shapes[Index], &t, &N))
+        {
+            KeepClosest(t, N, Index, ClosestT, &HitIndex, &HitN);
+        }
+    });
+    
+    FillHit(State, Origin, Direction, MaxT, HitN, HitIndex, Hit);
+    return Hit->Hit;
+}
+
+
+b32 ShapeCast(dynamics_state *State, shape *Shape, v2 Origin, v2 Direction, query_hit *Hit)
+{
+    assert(State);
+    assert(Shape);
+    assert(Hit);
+    
+    UpdateQueryTree(State);
+    
+    body_arrays *Bodies = &State->Bodies;
+    
+    f32 MaxT = 1.0f;
+    body_index HitIndex = -1;
+    v2 HitN = v2_zero;
+    
+    //
+    // The nodes are grown by the extent of the shape, which turns it into a ray
+    v2 Extent = GetAABB(v2_zero, Shape).Max;
+    
+    TraceRay(&State->QueryTree, Origin, Direction, Extent, &MaxT, [&](body_index Index, f32 *ClosestT)
+    {
+        f32 t;
+        v2 N;
+        if (CastVsShape(Shape, Origin - Bodies->P[Index], Direction, &Bodies->Shapes[Index], &t, &N))
+        {
+            KeepClosest(t, N, Index, ClosestT, &HitIndex, &HitN);
+        }
+    });
+    
+    FillHit(State, Origin, Direction, MaxT, HitN, HitIndex, Hit);
+    return Hit->Hit;
+}
+
+
+u32 OverlapAABB(dynamics_state *State, aabb Bounds, std::vector<body_handle>& Output)
+{
+    assert(State);
+    
+    UpdateQueryTree(State);
+    
+    query_tree *Tree = &State->QueryTree;
+    body_arrays *Bodies = &State->Bodies;
+    
+    if (Tree->Nodes.empty())
+    {
+        return 0;
+    }
+    
+    u32 Result = 0;
+    
+    u32 Stack[kBVHMaxStackSize];
+    u32 StackCount = 0;
+    Stack[StackCount++] = 0;
+    
+    while (StackCount > 0)
+    {
+        bvh_node const& Node = Tree->Nodes[Stack[--StackCount]];
+        
+        if (!Overlaps(Node.Bounds, Bounds))
+        {
+            continue;
+        }
+        
+        if (Node.Count > 0)
+        {
+            for (u32 Item = Node.First; Item < (Node.First + Node.Count); ++Item)
+            {
+                body_index Index = Tree->Items[Item];
+                
+                if (OverlapsShape(Bounds, Bodies->P[Index], &Bodies->Shapes[Index]))
+                {
+                    Output.push_back(GetBodyHandle(State, Index));
+                    ++Result;
+                }
+            }
+        }
+        else
+        {
+            assert(StackCount + 2 <= kBVHMaxStackSize);
+            Stack[StackCount++] = Node.First;
+            Stack[StackCount++] = Node.First + 1;
+        }
+    }
+    
+    return Result;
+}
+
+
+
+
+//
+// Batched ray casts
+//
+
+struct ray_packet_job
+{
+    dynamics_state *State;
+    ray_query const *Rays;
+    query_hit *Hits;
+    u32 Count;
+};
+
+
+// Up to four rays, lanes that aren't used get a MaxT below zero and never hit anything
+struct ray_packet
+{
+    f32 Ox[4];
+    f32 Oy[4];
+    f32 InvDx[4];
+    f32 InvDy[4];
+    f32 MaxT[4];
+};
+
+
+// Bit n is set if ray n enters Bounds before its MaxT
+static u32 SlabTest4(aabb const& Bounds, ray_packet const *Packet)
+{
+#if DYNAMICS_X86
+    __m128 Ox = _mm_loadu_ps(Packet->Ox);
+    __m128 Oy = _mm_loadu_ps(Packet->Oy);
+    __m128 InvDx = _mm_loadu_ps(Packet->InvDx);
+    __m128 InvDy = _mm_loadu_ps(Packet->InvDy);
+    
+    __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(Bounds.Min.x), Ox), InvDx);
+    __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(Bounds.Max.x), Ox), InvDx);
+    __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(Bounds.Min.y), Oy), InvDy);
+    __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(Bounds.Max.y), Oy), InvDy);
+    
+    __m128 Enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_setzero_ps());
+    __m128 Exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_loadu_ps(Packet->MaxT));
+    
+    u32 Result = static_cast<u32>(_mm_movemask_ps(_mm_cmple_ps(Enter, Exit)));
+#else
+    u32 Result = 0;
+    for (u32 Lane = 0; Lane < 4; ++Lane)
+    {
+        v2 Origin = V2(Packet->Ox[Lane], Packet->Oy[Lane]);
+        v2 InvD = V2(Packet->InvDx[Lane], Packet->InvDy[Lane]);
+        Result |= SlabTest(Bounds, v2_zero, Origin, InvD, Packet->MaxT[Lane]) ? (1u << Lane) : 0;
+    }
+#endif
+    
+    return Result;
+}
+
+
+static void TracePacket(dynamics_state *State, ray_query const *Rays, u32 Count, query_hit *Hits)
+{
+    assert((Count > 0) && (Count <= 4));
+    
+    query_tree *Tree = &State->QueryTree;
+    body_arrays *Bodies = &State->Bodies;
+    
+    ray_packet Packet;
+    body_index HitIndex[4] = {-1, -1, -1, -1};
+    v2 HitN[4] = {};
+    
+    for (u32 Lane = 0; Lane < 4; ++Lane)
+    {
+        ray_query const& Ray = Rays[Lane < Count ? Lane : 0];
+        v2 InvD = GetInverseDirection(Ray.Direction);
+        
+        Packet.Ox[Lane] = Ray.Origin.x;
+        Packet.Oy[Lane] = Ray.Origin.y;
+        Packet.InvDx[Lane] = InvD.x;
+        Packet.InvDy[Lane] = InvD.y;
+        Packet.MaxT[Lane] = Lane < Count ? 1.0f : -1.0f;
+    }
+    
+    if (!Tree->Nodes.empty())
+    {
+        u32 Stack[kBVHMaxStackSize];
+        u32 StackCount = 0;
+        Stack[StackCount++] = 0;
+        
+        while (StackCount > 0)
+        {
+            bvh_node const& Node = Tree->Nodes[Stack[--StackCount]];
+            
+            u32 Mask = SlabTest4(Node.Bounds, &Packet);
+            if (!Mask)
+            {
+                continue;
+            }
+            
+            if (Node.Count > 0)
+            {
+                for (u32 Lane = 0; Lane < Count; ++Lane)
+                {
+                    if (!(Mask & (1u << Lane)))
+                    {
+                        continue;
+                    }
+                    
+                    ray_query const& Ray = Rays[Lane];
+                    for (u32 Item = Node.First; Item < (Node.First + Node.Count); ++Item)
+                    {
+                        body_index Index = Tree->Items[Item];
+                        
+                        f32 t;
+                        v2 N;
+                        if (RayVsShape(Ray.Origin - Bodies->P[Index], Ray.Direction, &Bodies->Shapes[Index], &t, &N))
+                        {
+                            KeepClosest(t, N, Index, &Packet.MaxT[Lane], &HitIndex[Lane], &HitN[Lane]);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                // The order is picked for the first ray, the rays in a packet should be similar
+                PushChildren(Node, Rays[0].Direction, Stack, &StackCount);
+            }
+        }
+    }
+    
+    for (u32 Lane = 0; Lane < Count; ++Lane)
+    {
+        FillHit(State, Rays[Lane].Origin, Rays[Lane].Direction, Packet.MaxT[Lane], HitN[Lane], HitIndex[Lane], &Hits[Lane]);
+    }
+}
+
+
+static void RayPacketChunk(void *Data, u32 First, u32 Count)
+{
+    ray_packet_job *Job = static_cast<ray_packet_job *>(Data);
+    
+    for (u32 PacketIndex = First; PacketIndex < (First + Count); ++PacketIndex)
+    {
+        u32 FirstRay = 4 * PacketIndex;
+        u32 RayCount = Min(4u, Job->Count - FirstRay);
+        TracePacket(Job->State, Job->Rays + FirstRay, RayCount, Job->Hits + FirstRay);
+    }
+}
+
+
+void RayCast(dynamics_state *State, ray_query const *Rays, u32 Count, query_hit *Hits)
+{
+    assert(State);
+    assert(Rays || (Count == 0));
+    assert(Hits || (Count == 0));
+    
+    // Before the jobs start, they only read the tree
+    UpdateQueryTree(State);
+    
+    ray_packet_job Job = {State, Rays, Hits, Count};
+    u32 PacketCount = (Count + 3) / 4;
+    ParallelFor(State->Workers, PacketCount, kRayPacketChunkSize, RayPacketChunk, &Job);
+}
+
+
+
+
+//
+// Tree
+//
+
+void UpdateQueryTree(dynamics_state *State)
+{
+    query_tree *Tree = &State->QueryTree;
+    body_arrays *Bodies = &State->Bodies;
+    
+    b32 Rebuild = Tree->Rebuild || (Tree->Items.size() != Bodies->Count) ||
+        (Tree->Refit && (Tree->RefitCount >= kBVHMaxRefitCount));
+    
+    if (!Rebuild && !Tree->Refit)
+    {
+        return;
+    }
+    
+    Tree->Bounds.resize(Bodies->Count);
+    for (u32 Index = 0; Index < Bodies->Count; ++Index)
+    {
+        Tree->Bounds[Index] = GetAABB(State, static_cast<body_index>(Index));
+    }
+    
+    if (Rebuild)
+    {
+        Tree->Items.resize(Bodies->Count);
+        for (u32 Index = 0; Index < Bodies->Count; ++Index)
+        {
+            Tree->Items[Index] = static_cast<body_index>(Index);
+        }
+        
+        // A binary tree with at least one item per leaf has fewer than 2n nodes
+        Tree->Nodes.resize(2 * Bodies->Count);
+        
+        u32 NodeCount = 0;
+        if (Bodies->Count > 0)
+        {
+            NodeCount = 1;
+            BuildNode(Tree, &NodeCount, 0, 0, Bodies->Count);
+        }
+        Tree->Nodes.resize(NodeCount);
+        
+        Tree->RefitCount = 0;
+    }
+    else
+    {
+        RefitTree(Tree);
+        ++Tree->RefitCount;
+    }
+    
+    Tree->Rebuild = false;
+    Tree->Refit = false;
+}
+
+
+void BuildNode(query_tree *Tree, u32 *NodeCount, u32 NodeIndex, u32 First, u32 Count)
+{
+    body_index *Items = Tree->Items.data();
+    aabb const *Bounds = Tree->Bounds.data();
+    
+    aabb NodeBounds = Bounds[Items[First]];
+    for (u32 Item = First + 1; Item < (First + Count); ++Item)
+    {
+        NodeBounds = Union(NodeBounds, Bounds[Items[Item]]);
+    }
+    
+    bvh_node *Node = &Tree->Nodes[NodeIndex];
+    Node->Bounds = NodeBounds;
+    
+    if (Count <= kBVHLeafSize)
+    {
+        Node->First = First;
+        Node->Count = static_cast<u16>(Count);
+        return;
+    }
+    
+    //
+    // Split at the median centre along the longest axis, ties on the index keep it independent
+    // of the nth_element implementation
+    u16 Axis = (NodeBounds.Max.x - NodeBounds.Min.x) >= (NodeBounds.Max.y - NodeBounds.Min.y) ? 0 : 1;
+    u32 Half = Count / 2;
+    
+    std::nth_element(Items + First, Items + First + Half, Items + First + Count, [&](body_index A, body_index B)
+    {
+        f32 CentreA = Axis == 0 ? (Bounds[A].Min.x + Bounds[A].Max.x) : (Bounds[A].Min.y + Bounds[A].Max.y);
+        f32 CentreB = Axis == 0 ? (Bounds[B].Min.x + Bounds[B].Max.x) : (Bounds[B].Min.y + Bounds[B].Max.y);
+        return (CentreA < CentreB) || ((CentreA == CentreB) && (A < B));
+    });
+    
+    u32 Children = *NodeCount;
+    *NodeCount += 2;
+    
+    Node->First = Children;
+    Node->Count = 0;
+    Node->Axis = Axis;
+    
+    BuildNode(Tree, NodeCount, Children, First, Half);
+    BuildNode(Tree, NodeCount, Children + 1, First + Half, Count - Half);
+}
+
+
+// The children always come after their parent, so going backwards updates them first
+void RefitTree(query_tree *Tree)
+{
+    for (size_t NodeIndex = Tree->Nodes.size(); NodeIndex-- > 0;)
+    {
+        bvh_node *Node = &Tree->Nodes[NodeIndex];
+        
+        if (Node->Count > 0)
+        {
+            aabb NodeBounds = Tree->Bounds[Tree->Items[Node->First]];
+            for (u32 Item = Node->First + 1; Item < (Node->First + Node->Count); ++Item)
+            {
+                NodeBounds = Union(NodeBounds, Tree->Bounds[Tree->Items[Item]]);
+            }
+            Node->Bounds = NodeBounds;
+        }
+        else
+        {
+            Node->Bounds = Union(Tree->Nodes[Node->First].Bounds, Tree->Nodes[Node->First + 1].Bounds);
+        }
+    }
+}
+
+
+
+
+//
+// Shapes
+//
+
+// Ray from S (relative to the centre of the shape) along D, hits within [0, 1] only
+b32 RayVsShape(v2 S, v2 D, shape *Shape, f32 *t, v2 *N)
+{
+    switch (Shape->Type)
+    {
+        case ShapeType_Rectangle:
+        {
+            return RayVsBox(S, D, Shape->HalfSize, t, N);
+        }
+        
+        case ShapeType_Circle:
+        {
+            if (LengthSq(S) <= Square(Shape->Radius))
+            {
+                return false;
+            }
+            
+            if (!SweepCircleCorner(S, D, v2_zero, Shape->Radius, t))
+            {
+                return false;
+            }
+            
+            *N = NOZ(S + (*t) * D);
+            return true;
+        }
+        
+        case ShapeType_Convex:
+        {
+            // A point cast against the shape
+            shape Point;
+            Point.Type = ShapeType_Circle;
+            Point.Radius = 0.0f;
+            
+            return CastConvex(&Point, S, D, Shape, t, N);
+        }
+        
+        default:
+        {
+            assert(0);
+        } break;
+    }
+    
+    return false;
+}
+
+
+b32 RayVsBox(v2 S, v2 D, v2 HalfSize, f32 *t, v2 *N)
+{
+    if ((Abs(S.x) <= HalfSize.x) && (Abs(S.y) <= HalfSize.y))
+    {
+        return false;
+    }
+    
+    f32 Enter = -f32Max;
+    f32 Exit = f32Max;
+    u32 EnterAxis = 0;
+    
+    for (u32 Axis = 0; Axis < 2; ++Axis)
+    {
+        f32 s = Axis == 0 ? S.x : S.y;
+        f32 d = Axis == 0 ? D.x : D.y;
+        f32 e = Axis == 0 ? HalfSize.x : HalfSize.y;
+        
+        if (Abs(d) < 1e-8f)
+        {
+            if (Abs(s) > e)
+            {
+                return false;
+            }
+            continue;
+        }
+        
+        f32 t0 = (-e - s) / d;
+        f32 t1 = ( e - s) / d;
+        if (t0 > t1)
+        {
+            f32 Temp = t0;
+            t0 = t1;
+            t1 = Temp;
+        }
+        
+        if (t0 > Enter)
+        {
+            Enter = t0;
+            EnterAxis = Axis;
+        }
+        Exit = Min(Exit, t1);
+    }
+    
+    if ((Enter > Exit) || (Enter > 1.0f) || (Enter < 0.0f))
+    {
+        return false;
+    }
+    
+    *t = Enter;
+    *N = EnterAxis == 0 ? V2(-Sign(D.x), 0.0f) : V2(0.0f, -Sign(D.y));
+    return true;
+}
+
+
+// The shape Cast moving from S (relative to the centre of Shape) along D
+b32 CastVsShape(shape *Cast, v2 S, v2 D, shape *Shape, f32 *t, v2 *N)
+{
+    if ((Cast->Type == ShapeType_Convex) || (Shape->Type == ShapeType_Convex))
+    {
+        return CastConvex(Cast, S, D, Shape, t, N);
+    }
+    
+    if (Cast->Type == ShapeType_Circle)
+    {
+        if (Shape->Type == ShapeType_Rectangle)
+        {
+            return SweepCircleRectangle(S, D, Shape->HalfSize, Cast->Radius, t, N);
+        }
+        
+        //
+        // Circle against circle is a ray against the circle with the sum of the radii
+        f32 Radius = Cast->Radius + Shape->Radius;
+        if ((LengthSq(S) <= Square(Radius)) || !SweepCircleCorner(S, D, v2_zero, Radius, t))
+        {
+            return false;
+        }
+        
+        *N = NOZ(S + (*t) * D);
+        return true;
+    }
+    
+    if (Shape->Type == ShapeType_Rectangle)
+    {
+        return RayVsBox(S, D, Cast->HalfSize + Shape->HalfSize, t, N);
+    }
+    
+    //
+    // A rectangle against a circle is the circle moving the other way against the rectangle,
+    // the normal is then the one of the rectangle
+    v2 RectangleN;
+    if (!SweepCircleRectangle(-S, -D, Cast->HalfSize, Shape->Radius, t, &RectangleN))
+    {
+        return false;
+    }
+    
+    *N = -RectangleN;
+    return true;
+}
+
+
+b32 OverlapsShape(aabb const& Bounds, v2 P, shape *Shape)
+{
+    if (Shape->Type == ShapeType_Circle)
+    {
+        v2 Closest = V2(Clamp(P.x, Bounds.Min.x, Bounds.Max.x), Clamp(P.y, Bounds.Min.y, Bounds.Max.y));
+        b32 Result = LengthSq(P - Closest) <= Square(Shape->Radius);
+        return Result;
+    }
+    
+    if (Shape->Type == ShapeType_Convex)
+    {
+        shape Box;
+        Box.Type = ShapeType_Rectangle;
+        Box.HalfSize = 0.5f * (Bounds.Max - Bounds.Min);
+        
+        b32 Result = Overlaps(Bounds, GetAABB(P, Shape)) && IntersectsGJK(0.5f * (Bounds.Min + Bounds.Max), &Box, P, Shape, nullptr);
+        return Result;
+    }
+    
+    b32 Result = Overlaps(Bounds, GetAABB(P, Shape));
+    return Result;
+}
@@ -0,0 +1,375 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "dynamics.h"
+
+#ifdef DEBUG
+#include <assert.h>
+#else
+#define assert(x)
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define DYNAMICS_X86 1
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define DYNAMICS_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define DYNAMICS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+
+
+//
+// All the kernels work on the interleaved v2 arrays directly, i.e. one 128-bit register holds
+// {x0, y0, x1, y1}. The per-body scalars (Damping and InverseMass) are duplicated into the same
+// layout before they are used. The operations are done in the same order as in the scalar
+// kernel so that the results match it.
+//
+
+
+
+
+//
+// Dispatch
+//
+
+simd_level GetSupportedSimdLevel()
+{
+    simd_level Result = SimdLevel_Scalar;
+    
+#if DYNAMICS_X86
+    // SSE2 is part of the x64 baseline
+    Result = SimdLevel_SSE2;
+    
+#if defined(_MSC_VER)
+    s32 Info[4] = {};
+    __cpuid(Info, 0);
+    s32 MaxLeaf = Info[0];
+    
+    if (MaxLeaf >= 7)
+    {
+        __cpuid(Info, 1);
+        b32 OSXSave = (Info[2] & (1 << 27)) != 0;
+        b32 AVX = (Info[2] & (1 << 28)) != 0;
+        
+        __cpuidex(Info, 7, 0);
+        b32 AVX2 = (Info[1] & (1 << 5)) != 0;
+        
+        // Make sure that the OS saves the YMM registers
+        if (OSXSave && AVX && AVX2 && ((_xgetbv(0) & 0x6) == 0x6))
+        {
+            Result = SimdLevel_AVX2;
+        }
+    }
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        Result = SimdLevel_AVX2;
+    }
+#endif
+#endif
+    
+    return Result;
+}
+
+
+integrate_function *GetIntegrateFunction(simd_level Level)
+{
+    integrate_function *Result = IntegrateScalar;
+    
+    switch (Level)
+    {
+        case SimdLevel_SSE2: Result = IntegrateSSE2; break;
+        case SimdLevel_AVX2: Result = IntegrateAVX2; break;
+        default: break;
+    }
+    
+    return Result;
+}
+
+
+
+
+//
+// Scalar, the reference
+//
+
+void IntegrateScalar(body_arrays *Bodies, u32 First, u32 Count, f32 dt)
+{
+    assert(Bodies);
+    assert(dt > 0.0f);
+    assert(First + Count <= Bodies->Count);
+    
+    v2 *P = Bodies->P.data();
+    v2 *PrevP = Bodies->PrevP.data();
+    v2 *dP = Bodies->dP.data();
+    v2 const *dPMax = Bodies->dPMax.data();
+    v2 const *dPMask = Bodies->dPMask.data();
+    v2 *F = Bodies->F.data();
+    f32 const *Damping = Bodies->Damping.data();
+    f32 const *InverseMass = Bodies->InverseMass.data();
+    
+    u32 const End = First + Count;
+    for (u32 Index = First; Index < End; ++Index)
+    {
+        v2 ddP = F[Index] * InverseMass[Index]; // F = ma ->  a = F/m -> a = F * (1/m)
+        F[Index] = v2_zero;
+        
+        v2 V = dP[Index];
+        V += Hadamard(dPMask[Index], (ddP * dt) - (Damping[Index] * V));
+        
+        PrevP[Index] = P[Index];
+        P[Index] += V * dt;
+        
+        //
+        // Speed limit
+        dP[Index] = V2(Min(V.x, dPMax[Index].x),
+                       Min(V.y, dPMax[Index].y));
+    }
+}
+
+
+
+
+//
+// SSE2, 4 bodies per iteration
+//
+
+#if DYNAMICS_X86
+// Two bodies, i.e. one register, at the given v2 offset
+static inline void IntegrateSSE2Pair(f32 *P, f32 *PrevP, f32 *dP, f32 const *dPMax, f32 const *dPMask, f32 *F,
+                                     __m128 Damping, __m128 InverseMass, __m128 dt)
+{
+    __m128 ddP = _mm_mul_ps(_mm_loadu_ps(F), InverseMass);
+    _mm_storeu_ps(F, _mm_setzero_ps());
+    
+    __m128 V = _mm_loadu_ps(dP);
+    __m128 dV = _mm_sub_ps(_mm_mul_ps(ddP, dt), _mm_mul_ps(Damping, V));
+    V = _mm_add_ps(V, _mm_mul_ps(_mm_loadu_ps(dPMask), dV));
+    
+    __m128 Po = _mm_loadu_ps(P);
+    _mm_storeu_ps(PrevP, Po);
+    _mm_storeu_ps(P, _mm_add_ps(Po, _mm_mul_ps(V, dt)));
+    
+    _mm_storeu_ps(dP, _mm_min_ps(V, _mm_loadu_ps(dPMax)));
+}
+#endif
+
+
+void IntegrateSSE2(body_arrays *Bodies, u32 First, u32 Count, f32 dt)
+{
+#if DYNAMICS_X86
+    assert(Bodies);
+    assert(dt > 0.0f);
+    assert(First + Count <= Bodies->Count);
+    
+    f32 *P = &Bodies->P.data()->x;
+    f32 *PrevP = &Bodies->PrevP.data()->x;
+    f32 *dP = &Bodies->dP.data()->x;
+    f32 const *dPMax = &Bodies->dPMax.data()->x;
+    f32 const *dPMask = &Bodies->dPMask.data()->x;
+    f32 *F = &Bodies->F.data()->x;
+    f32 const *Damping = Bodies->Damping.data();
+    f32 const *InverseMass = Bodies->InverseMass.data();
+    
+    __m128 const dtWide = _mm_set1_ps(dt);
+    
+    u32 Index = First;
+    u32 const End = First + Count;
+    for (; (Index + 4) <= End; Index += 4)
+    {
+        __m128 D = _mm_loadu_ps(Damping + Index);
+        __m128 M = _mm_loadu_ps(InverseMass + Index);
+        
+        // {s0, s0, s1, s1} and {s2, s2, s3, s3}
+        __m128 D01 = _mm_unpacklo_ps(D, D);
+        __m128 D23 = _mm_unpackhi_ps(D, D);
+        __m128 M01 = _mm_unpacklo_ps(M, M);
+        __m128 M23 = _mm_unpackhi_ps(M, M);
+        
+        u32 E = 2 * Index;
+        IntegrateSSE2Pair(P + E, PrevP + E, dP + E, dPMax + E, dPMask + E, F + E, D01, M01, dtWide);
+        
+        E += 4;
+        IntegrateSSE2Pair(P + E, PrevP + E, dP + E, dPMax + E, dPMask + E, F + E, D23, M23, dtWide);
+    }
+    
+    if (Index < End)
+    {
+        IntegrateScalar(Bodies, Index, End - Index, dt);
+    }
+#else
+    IntegrateScalar(Bodies, First, Count, dt);
+#endif
+}
+
+
+
+
+//
+// AVX2, 8 bodies per iteration
+//
+
+#if DYNAMICS_X86
+// Four bodies, i.e. one register, at the given v2 offset
+DYNAMICS_TARGET_AVX2
+static inline void IntegrateAVX2Quad(f32 *P, f32 *PrevP, f32 *dP, f32 const *dPMax, f32 const *dPMask, f32 *F,
+                                     __m256 Damping, __m256 InverseMass, __m256 dt)
+{
+    __m256 ddP = _mm256_mul_ps(_mm256_loadu_ps(F), InverseMass);
+    _mm256_storeu_ps(F, _mm256_setzero_ps());
+    
+    __m256 V = _mm256_loadu_ps(dP);
+    __m256 dV = _mm256_sub_ps(_mm256_mul_ps(ddP, dt), _mm256_mul_ps(Damping, V));
+    V = _mm256_add_ps(V, _mm256_mul_ps(_mm256_loadu_ps(dPMask), dV));
+    
+    __m256 Po = _mm256_loadu_ps(P);
+    _mm256_storeu_ps(PrevP, Po);
+    _mm256_storeu_ps(P, _mm256_add_ps(Po, _mm256_mul_ps(V, dt)));
+    
+    _mm256_storeu_ps(dP, _mm256_min_ps(V, _mm256_loadu_ps(dPMax)));
+}
+
+
+DYNAMICS_TARGET_AVX2
+static void IntegrateAVX2Kernel(body_arrays *Bodies, u32 First, u32 Count, f32 dt)
+{
+    f32 *P = &Bodies->P.data()->x;
+    f32 *PrevP = &Bodies->PrevP.data()->x;
+    f32 *dP = &Bodies->dP.data()->x;
+    f32 const *dPMax = &Bodies->dPMax.data()->x;
+    f32 const *dPMask = &Bodies->dPMask.data()->x;
+    f32 *F = &Bodies->F.data()->x;
+    f32 const *Damping = Bodies->Damping.data();
+    f32 const *InverseMass = Bodies->InverseMass.data();
+    
+    __m256 const dtWide = _mm256_set1_ps(dt);
+    __m256i const Lo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    __m256i const Hi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+    
+    u32 Index = First;
+    u32 const End = First + Count;
+    for (; (Index + 8) <= End; Index += 8)
+    {
+        __m256 D = _mm256_loadu_ps(Damping + Index);
+        __m256 M = _mm256_loadu_ps(InverseMass + Index);
+        
+        // {s0, s0, s1, s1, s2, s2, s3, s3} and {s4, s4, ..., s7, s7}
+        __m256 D0123 = _mm256_permutevar8x32_ps(D, Lo);
+        __m256 D4567 = _mm256_permutevar8x32_ps(D, Hi);
+        __m256 M0123 = _mm256_permutevar8x32_ps(M, Lo);
+        __m256 M4567 = _mm256_permutevar8x32_ps(M, Hi);
+        
+        u32 E = 2 * Index;
+        IntegrateAVX2Quad(P + E, PrevP + E, dP + E, dPMax + E, dPMask + E, F + E, D0123, M0123, dtWide);
+        
+        E += 8;
+        IntegrateAVX2Quad(P + E, PrevP + E, dP + E, dPMax + E, dPMask + E, F + E, D4567, M4567, dtWide);
+    }
+    
+    // Avoid the AVX -> SSE transition penalty in the tail
+    _mm256_zeroupper();
+    
+    if (Index < End)
+    {
+        IntegrateSSE2(Bodies, Index, End - Index, dt);
+    }
+}
+#endif
+
+
+void IntegrateAVX2(body_arrays *Bodies, u32 First, u32 Count, f32 dt)
+{
+#if DYNAMICS_X86
+    assert(Bodies);
+    assert(dt > 0.0f);
+    assert(First + Count <= Bodies->Count);
+    
+    IntegrateAVX2Kernel(Bodies, First, Count, dt);
+#else
+    IntegrateScalar(Bodies, First, Count, dt);
+#endif
+}
+
+
+
+
+//
+// Fixed point, Q48.16
+//
+// An experiment, picked by DYNAMICS_FIXED_POINT. Same step as the scalar kernel but with the
+// arithmetic done on fixed, one axis at a time. The bodies are still stored as f32 and converted
+// in and out on every step, and dt is quantized to 2^-16 (1/60 becomes 1092/65536), so it only
+// stays close to the scalar kernel, see TestFixedIntegrationCloseToScalar().
+//
+
+static void IntegrateFixedAxis(f32 *P, f32 *PrevP, f32 *dP, fixed ddP, f32 dPMax, f32 dPMask, f32 Damping,
+                               fixed dt)
+{
+    fixed V = Fixed(*dP);
+    V += Fixed(dPMask) * ((ddP * dt) - (Fixed(Damping) * V));
+    
+    fixed NewP = Fixed(*P) + V * dt;
+    *PrevP = *P;
+    *P = ToF32(NewP);
+    
+    // Speed limit
+    *dP = ToF32(Min(V, Fixed(dPMax)));
+}
+
+void IntegrateFixed(body_arrays *Bodies, u32 First, u32 Count, f32 dt)
+{
+    assert(Bodies);
+    assert(dt > 0.0f);
+    assert(First + Count <= Bodies->Count);
+    
+    v2 *P = Bodies->P.data();
+    v2 *PrevP = Bodies->PrevP.data();
+    v2 *dP = Bodies->dP.data();
+    v2 const *dPMax = Bodies->dPMax.data();
+    v2 const *dPMask = Bodies->dPMask.data();
+    v2 *F = Bodies->F.data();
+    f32 const *Damping = Bodies->Damping.data();
+    f32 const *InverseMass = Bodies->InverseMass.data();
+    
+    fixed const Fixeddt = Fixed(dt);
+    
+    u32 const End = First + Count;
+    for (u32 Index = First; Index < End; ++Index)
+    {
+        fixed InvMass = Fixed(InverseMass[Index]);
+        fixed ddPx = Fixed(F[Index].x) * InvMass;
+        fixed ddPy = Fixed(F[Index].y) * InvMass;
+        F[Index] = v2_zero;
+        
+        IntegrateFixedAxis(&P[Index].x, &PrevP[Index].x, &dP[Index].x, ddPx, dPMax[Index].x, dPMask[Index].x, Damping[Index], Fixeddt);
+        IntegrateFixedAxis(&P[Index].y, &PrevP[Index].y, &dP[Index].y, ddPy, dPMax[Index].y, dPMask[Index].y, Damping[Index], Fixeddt);
+    }
+}
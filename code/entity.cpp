@@ -43,7 +43,7 @@ void Init(entity *Entity)
     Entity->P = v3_zero; 
     Entity->Size = v2_one;
     Entity->Scale = v2_one;
-    Entity->BodyIndex = -1;
+    Entity->Body = body_handle();
     Entity->MeshIndex = -1;
     Entity->TextureIndex = -1;
 }
@@ -61,8 +61,11 @@ void Shutdown(entity *Entity)
 
 void Update(dynamics_state *Dynamics, entity *Entity, f32 dt)
 {
-    body *Body = GetBody(Dynamics, Entity->BodyIndex);
-    Entity->P = V3(Body->P, 0.0f);
+    if (IsValid(Dynamics, Entity->Body))
+    {
+        // Blend the last two physics steps, they don't run at the same rate as the rendering
+        Entity->P = V3(GetInterpolatedP(Dynamics, Entity->Body), 0.0f);
+    }
 }
 
 
@@ -42,6 +42,15 @@ enum entity_type
 };
 
 
+// The collision layers of the entities, see SetCollisionFilter()
+enum collision_layer
+{
+    CollisionLayer_Ball   = 0x1,
+    CollisionLayer_Paddle = 0x2,
+    CollisionLayer_Wall   = 0x4,
+};
+
+
 struct entity
 {
     entity_type Type = EntityType_Null;
@@ -50,7 +59,7 @@ struct entity
     v2 Size = v2_one;
     v2 Scale = v2_one;
     
-    body_index BodyIndex = -1;
+    body_handle Body;
     mesh_index MeshIndex = -1;
     texture_index TextureIndex = -1;
 };
@@ -82,13 +82,16 @@ static void SetupAsBall(resources *Resources, dynamics_state *Dynamics, entity_p
     f32 BallArea = Pi32 * BallRadius * BallRadius;
     f32 BallDensity = 0.0004f;
     
-    body *Body = NewCircleBody(Dynamics, BallRadius, Entity);
-    Body->dPMax = VelocityMax;
-    Body->InverseMass = 1.0f / (BallArea * BallDensity);
+    Entity->Body = NewCircleBody(Dynamics, BallRadius, Entity);
+    SetCollisionFilter(Dynamics, Entity->Body, CollisionLayer_Ball, CollisionLayer_Paddle | CollisionLayer_Wall);
+    
+    body Body = GetBody(Dynamics, Entity->Body);
+    Body.dPMax = VelocityMax;
+    Body.InverseMass = 1.0f / (BallArea * BallDensity);
+    Body.Flags |= BodyFlag_Continuous; // Fast and small, don't let it tunnel through the paddles
     
     Entity->Size = Size;
     Entity->Scale = Size;
-    Entity->BodyIndex = GetBodyIndex(Dynamics, Body);
     Entity->MeshIndex = MeshIndex;
     
     texture_index TextureIndex = LoadBMP(Resources, "data\\bitmaps\\ball.bmp");
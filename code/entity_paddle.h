@@ -36,13 +36,16 @@ static void SetupAsPaddle(dynamics_state *Dynamics, entity *Entity, mesh_index M
     f32 Density = 0.0005f;
     f32 InverseMass = 1.0f / (Area * Density);
     
-    body *Body = NewRectangleBody(Dynamics, Size, Entity);
-    Body->dPMax = VelMax;
-    Body->dPMask = V2(0.0f, 1.0f);
-    Body->Damping = 0.5f;
-    Body->InverseMass = InverseMass;
+    Entity->Body = NewRectangleBody(Dynamics, Size, Entity);
+    SetCollisionFilter(Dynamics, Entity->Body, CollisionLayer_Paddle, CollisionLayer_Ball | CollisionLayer_Wall);
+    
+    body Body = GetBody(Dynamics, Entity->Body);
+    Body.dPMax = VelMax;
+    Body.dPMask = V2(0.0f, 1.0f);
+    Body.Damping = 0.5f;
+    Body.InverseMass = InverseMass;
+    Body.Restitution = 0.0f; // Stops at the walls, the ball still bounces off it with its own
     
-    Entity->BodyIndex = GetBodyIndex(Dynamics, Body);
     Entity->Size = Size;
     Entity->Scale = Size;
     Entity->MeshIndex = MIndex;
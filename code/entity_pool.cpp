@@ -65,7 +65,7 @@ entity *GetFreeLocation(entity_pool *Pool)
                 return nullptr;
             }
         }
-        Result = reinterpret_cast<entity *>(Push(&Pool->Memory, Size));
+        Result = PushStruct<entity>(&Pool->Memory, "entity");
     }
     
     return Result;
@@ -104,8 +104,10 @@ void AddFreeLocation(entity_pool *Pool, entity *Entity)
 
 void Init(entity_pool *Pool)
 {
+    // Growing commits more of the reserved range in place, the entity pointers stay valid
     size_t Size = 10 * sizeof(entity); // @debug
-    Init(&Pool->Memory, Size);
+    InitVirtual(&Pool->Memory, 64 << 20, Size);
+    Register(&Pool->Memory, "entity_pool");
 }
 
 
@@ -124,6 +126,7 @@ void Shutdown(entity_pool *Pool)
         Shutdown(Entity);
     }
     
+    Unregister(&Pool->Memory);
     Free(&Pool->Memory);
 }
 
@@ -75,14 +75,19 @@ static void SetupAsWall(dynamics_state *Dynamics, entity *Entity, mesh_index Mes
     Init(Entity);
     Entity->Type = EntityType_Wall;
     
-    body *Body = NewRectangleBody(Dynamics, Size, Entity);
-    Body->P = P;
-    Body->InverseMass = 0.0f;
-    Body->dPMask = v2_zero;
+    Entity->Body = NewRectangleBody(Dynamics, Size, Entity);
+    SetCollisionFilter(Dynamics, Entity->Body, CollisionLayer_Wall, CollisionLayer_Ball | CollisionLayer_Paddle);
+    
+    body Body = GetBody(Dynamics, Entity->Body);
+    Body.P = P;
+    Body.dPMask = v2_zero;
+    Body.Restitution = 0.0f;
+    
+    // Never integrated nor tested against the other walls
+    SetType(Dynamics, Entity->Body, BodyType_Static);
     
     Entity->MeshIndex = MeshIndex;
     Entity->TextureIndex = TextureIndex;
-    Entity->BodyIndex = GetBodyIndex(Dynamics, Body);
     Entity->Size = Size;
 }
 
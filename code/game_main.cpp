@@ -24,6 +24,7 @@
 
 #include "game_main.h"
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #ifdef DEBUG
@@ -41,6 +42,8 @@
 
 void Render(game_state *State);
 void ProcessInput(game_state *State);
+void ApplyPaddleForces(game_state *State);
+void ApplyWallBounce(collision_info *Collision, body const& BallBody);
 
 void ResetPositions(game_state *State);
 void NewGame(game_state *State);
@@ -78,6 +81,9 @@ void Init(game_state *State)
         SetupPaddles(&State->Resources, &State->Dynamics, &State->EntityPool, MeshIndex_Quad1x1, (entity **)&State->Players);
         InitWalls(&State->Resources, &State->Dynamics, &State->EntityPool, WindowSize, (entity **)&State->Walls);
         
+        body_handle Walls[2] = {State->Walls[0]->Body, State->Walls[1]->Body};
+        Init(&State->BallPredictor, &State->Dynamics, State->Ball->Body, Walls, 2);
+        
         ResetPositions(State);
     }
     
@@ -167,6 +173,15 @@ void Init(game_state *State)
 void Shutdown(game_state *State)
 {
     assert(State);
+    
+#ifdef DEBUG
+    // How much of each arena the run used, for sizing them
+    char Report[4096];
+    FormatArenaReport(Report, sizeof(Report));
+    printf("%s", Report);
+#endif
+    
+    Shutdown(&State->BallPredictor);
     Shutdown(&State->EntityPool);
 }
 
@@ -177,6 +192,20 @@ void Shutdown(game_state *State)
 // Update
 //
 
+// The predicted ball only ever meets the walls, the collisions get the same treatment as in the game
+static void OnPredictedCollisions(dynamics_state *World, std::vector<collision_info>& Collisions, void *Data)
+{
+    game_state *State = static_cast<game_state *>(Data);
+    
+    body BallBody = GetBody(World, State->BallPredictor.Body);
+    
+    for (auto& Collision : Collisions)
+    {
+        ApplyWallBounce(&Collision, BallBody);
+    }
+}
+
+
 void UpdateAI(game_state *State, f32 dt)
 {
     if (State->PlayerCount == 2)
@@ -184,25 +213,52 @@ void UpdateAI(game_state *State, f32 dt)
         return;
     }
     
-    body *BallBody = GetBody(&State->Dynamics, State->Ball->BodyIndex);
+    body BallBody = GetBody(&State->Dynamics, State->Ball->Body);
     f32 LengthFactor = 0.8f;
     
+    //
+    // Where the paddles should go, straight for the ball unless the AI is predictive
+    f32 TargetY[2] = {BallBody.P.y, BallBody.P.y};
+    
+    if (State->PredictiveAI)
+    {
+        body Paddles[2] =
+        {
+            GetBody(&State->Dynamics, State->Players[0]->Body),
+            GetBody(&State->Dynamics, State->Players[1]->Body),
+        };
+        
+        // Where the ball touches the front of the paddles
+        f32 MinX = Paddles[0].P.x + Paddles[0].Shape.HalfSize.x + BallBody.Shape.Radius;
+        f32 MaxX = Paddles[1].P.x - Paddles[1].Shape.HalfSize.x - BallBody.Shape.Radius;
+        
+        // Only steps the ball forward after it has bounced
+        trajectory_prediction const *Prediction = Predict(&State->BallPredictor, &State->Dynamics, State->Ball->Body,
+                                                          MinX, MaxX, OnPredictedCollisions, State);
+        
+        //
+        // Wait in the middle while the ball is on its way to the other paddle
+        f32 const MidY = 0.5f * (f32)State->DrawCalls.DisplayMetrics.WindowHeight;
+        TargetY[0] = (Prediction->Reached && (Prediction->Side < 0)) ? Prediction->P.y : MidY;
+        TargetY[1] = (Prediction->Reached && (Prediction->Side > 0)) ? Prediction->P.y : MidY;
+    }
+    
     //
     // Left paddle, only if we're 0 players
     if (State->PlayerCount == 0)
     {
-        body *PaddleBody = GetBody(&State->Dynamics, State->Players[0]->BodyIndex);
+        body PaddleBody = GetBody(&State->Dynamics, State->Players[0]->Body);
         
-        State->PressedKeys.erase(0x57);
-        State->PressedKeys.erase(0x53);
+        State->PressedKeys[0x57] = 0;
+        State->PressedKeys[0x53] = 0;
         
-        f32 Length = LengthFactor * PaddleBody->Shape.HalfSize.y;
+        f32 Length = LengthFactor * PaddleBody.Shape.HalfSize.y;
         
-        if (BallBody->P.y > (PaddleBody->P.y + Length))
+        if (TargetY[0] > (PaddleBody.P.y + Length))
         {
             State->PressedKeys[0x57] = 1;
         }
-        else if (BallBody->P.y < (PaddleBody->P.y - Length))
+        else if (TargetY[0] < (PaddleBody.P.y - Length))
         {
             State->PressedKeys[0x53] = 1;
         }
@@ -212,18 +268,18 @@ void UpdateAI(game_state *State, f32 dt)
     //
     // Right paddle, if < 2 players
     {
-        body *PaddleBody = GetBody(&State->Dynamics, State->Players[1]->BodyIndex);
+        body PaddleBody = GetBody(&State->Dynamics, State->Players[1]->Body);
         
-        State->PressedKeys.erase(0x28);
-        State->PressedKeys.erase(0x26);
+        State->PressedKeys[0x28] = 0;
+        State->PressedKeys[0x26] = 0;
         
-        f32 Length = LengthFactor * PaddleBody->Shape.HalfSize.y;
+        f32 Length = LengthFactor * PaddleBody.Shape.HalfSize.y;
         
-        if (BallBody->P.y > (PaddleBody->P.y + Length))
+        if (TargetY[1] > (PaddleBody.P.y + Length))
         {
             State->PressedKeys[0x26] = 1;
         }
-        else if (BallBody->P.y < (PaddleBody->P.y - Length))
+        else if (TargetY[1] < (PaddleBody.P.y - Length))
         {
             State->PressedKeys[0x28] = 1;
         }
@@ -231,100 +287,99 @@ void UpdateAI(game_state *State, f32 dt)
 }
 
 
-void Update(game_state *State, f32 dt)
+// Called by the dynamics before each fixed step, the forces are cleared by every step
+static void PreStep(dynamics_state *Dynamics, f32 dt, void *Data)
 {
-    assert(State);
-    assert(dt > 0.0f);
-    
+    game_state *State = static_cast<game_state *>(Data);
     
     //
-    // Process inputs
-    ProcessInput(State);
+    // "AI"
+    UpdateAI(State, dt);
+    
+    ApplyPaddleForces(State);
+}
+
+
+// Called by the dynamics with the collisions of each fixed step, before they are resolved
+static void OnCollisions(dynamics_state *Dynamics, std::vector<collision_info>& Collisions, void *Data)
+{
+    game_state *State = static_cast<game_state *>(Data);
     
+    body BallBody = GetBody(Dynamics, State->Ball->Body);
     
-    if (State->GameMode == GameMode_Playing)
+    for (contact_event const& Event : Dynamics->ContactEvents.Events)
     {
-        //
-        // "AI"
-        UpdateAI(State, dt);
-        
-        
-        //
-        // "Physics"
-        Update(&State->Dynamics, dt);
+        if (Event.Type == ContactEvent_End)
+        {
+            continue;
+        }
         
-        std::vector<collision_info> static Collisions;
-        Collisions.clear();
+        collision_info& Collision = Collisions[Event.Collision];
+        u32 Layers = Event.Layers[0] | Event.Layers[1];
+        b32 Begin = Event.Type == ContactEvent_Begin;
         
-        DetectCollisions(&State->Dynamics, Collisions);
+        if (Layers & CollisionLayer_Ball)
+        {
+            // The velocity of the ball changes, the AI has to look ahead again
+            Invalidate(&State->BallPredictor);
+        }
         
-        body *BallBody = GetBody(&State->Dynamics, State->Ball->BodyIndex);
         
-        for (auto& Collision : Collisions)
+        //
+        // The sounds are played when the ball hits something, the modifiers apply for as long as
+        // the bodies touch
+        if (Layers == (CollisionLayer_Ball | CollisionLayer_Paddle))
         {
-            //
-            // Will be used in order to determine if we shall play any sounds
-            b32 TheBallIsInvolved = false;
-            b32 ABorderIsInvolved = false;
-            b32 APlayerIsInvolved = false;
-            
-            
-            //
-            // Check what entities were involved in the collision
-            if ((Collision.BodiesInvolved[0] == State->Ball->BodyIndex) || (Collision.BodiesInvolved[1] == State->Ball->BodyIndex))
-            {
-                TheBallIsInvolved = true;
-            } 
-            
-            for (u32 Index = 0; Index < 2; ++Index)
-            {
-                if ((Collision.BodiesInvolved[0] == State->Players[Index]->BodyIndex) ||
-                    (Collision.BodiesInvolved[1] == State->Players[Index]->BodyIndex))
-                {
-                    APlayerIsInvolved = true;
-                }
-                
-                if ((Collision.BodiesInvolved[0] == State->Walls[Index]->BodyIndex) ||
-                    (Collision.BodiesInvolved[1] == State->Walls[Index]->BodyIndex))
-                {
-                    ABorderIsInvolved = true;
-                }
-            }
-            
-            
-            //
-            // Play sounds
-            if (TheBallIsInvolved && APlayerIsInvolved)
+            if (Begin)
             {
                 State->Audio.Play(State->Audio_PaddleBounce);
-                Collision.ForceModifier = 0.15f;
             }
-            else if (TheBallIsInvolved && ABorderIsInvolved)
+            Collision.ForceModifier = 0.15f;
+        }
+        else if (Layers == (CollisionLayer_Ball | CollisionLayer_Wall))
+        {
+            if (Begin)
             {
                 State->Audio.Play(State->Audio_WallBounce);
-                
-                f32 L = Length(BallBody->dP);
-                if (L > 900.0f)
-                {
-                    Collision.ForceModifier = -0.15f;
-                }
-            }
-            else if (APlayerIsInvolved && ABorderIsInvolved)
-            {
-                Collision.SkipForceApplication = true;
             }
+            ApplyWallBounce(&Collision, BallBody);
         }
-        
-        ResolveCollisions(&State->Dynamics, Collisions, dt);
+    }
+}
+
+
+// dt is the wall-clock time since the last frame, the physics runs in fixed steps of its own
+void Update(game_state *State, f32 dt)
+{
+    assert(State);
+    assert(dt > 0.0f);
+    
+    // Scratch memory for the frame comes from GetThreadArena(), nothing from last frame is used
+    // any longer
+    BeginArenaFrame();
+    
+    
+    //
+    // Process inputs
+    ProcessInput(State);
+    
+    
+    if (State->GameMode == GameMode_Playing)
+    {
+        //
+        // "Physics"
+        Simulate(&State->Dynamics, dt, PreStep, OnCollisions, State);
         
         //
         // Check if any of the players scored.
         {
-            if (BallBody->P.x < 0.0f)
+            body BallBody = GetBody(&State->Dynamics, State->Ball->Body);
+            
+            if (BallBody.P.x < 0.0f)
             {
                 Score(State, 1);
             }
-            else if (BallBody->P.x > State->DrawCalls.DisplayMetrics.WindowWidth)
+            else if (BallBody.P.x > State->DrawCalls.DisplayMetrics.WindowWidth)
             {
                 Score(State, 0);
             }
@@ -414,6 +469,7 @@ void Render(game_state *State)
             PushShadowedText(DrawCalls, V2(x, y + 5.9f * dy), L"Right paddle: Up = Up arrow, Down = Down arrow", SI_Small);
             PushShadowedText(DrawCalls, V2(x, y + 6.6f * dy), L"Press G to change graphics mode", SI_Small);
             PushShadowedText(DrawCalls, V2(x, y + 7.3f * dy), L"Press R to reset the game"     , SI_Small);
+            PushShadowedText(DrawCalls, V2(x, y + 8.0f * dy), State->PredictiveAI ? L"Press I for a reactive AI" : L"Press I for a predictive AI", SI_Small);
         } break;
         
         case GameMode_Paused:
@@ -439,92 +495,113 @@ void Render(game_state *State)
 
 void ProcessInput(game_state *State)
 {
-    if (State->PressedKeys.count(0x47) > 0) // Key G, Change graphics mode
+    if (State->PressedKeys[0x47]) // Key G, Change graphics mode
     {
-        State->PressedKeys.erase(0x47);
+        State->PressedKeys[0x47] = 0;
         State->RenderAsPrimitives = !State->RenderAsPrimitives;
     }
     
+    if (State->PressedKeys[0x49]) // Key I, Predictive or reactive AI
+    {
+        State->PressedKeys[0x49] = 0;
+        State->PredictiveAI = !State->PredictiveAI;
+    }
+    
     if (State->GameMode == GameMode_Inactive)
     {
-        if (State->PressedKeys.count(0x30) > 0) // Key 0, AI vs AI
+        if (State->PressedKeys[0x30]) // Key 0, AI vs AI
         {
-            State->PressedKeys.erase(0x30);
+            State->PressedKeys[0x30] = 0;
             State->PlayerCount = 0;
             NewGame(State);
         }
         
-        if (State->PressedKeys.count(0x31) > 0) // Key 1
+        if (State->PressedKeys[0x31]) // Key 1
         {
-            State->PressedKeys.erase(0x31);
+            State->PressedKeys[0x31] = 0;
             State->PlayerCount = 1;
             NewGame(State);
         }
         
-        if (State->PressedKeys.count(0x32) > 0) // Key 2
+        if (State->PressedKeys[0x32]) // Key 2
         {
-            State->PressedKeys.erase(0x32);
+            State->PressedKeys[0x32] = 0;
             State->PlayerCount = 2;
             NewGame(State);
         }
     }
     else if (State->GameMode == GameMode_Scored)
     {
-        if (State->PressedKeys.count(0x50) > 0 || State->PlayerCount == 0) // P
+        if (State->PressedKeys[0x50] || State->PlayerCount == 0) // P
         {
             State->GameMode = GameMode_Playing;
-            State->PressedKeys.erase(0x50);
+            State->PressedKeys[0x50] = 0;
             Start(State);
         }
     }
     else 
     {
-        if (State->PressedKeys.count(0x50) > 0) // P
+        if (State->PressedKeys[0x50]) // P
         {
             // Pause
             State->GameMode = State->GameMode == GameMode_Paused ? GameMode_Playing : GameMode_Paused;
-            State->PressedKeys.erase(0x50);
+            State->PressedKeys[0x50] = 0;
         }
         
-        if (State->PressedKeys.count(0x52) > 0) // R
+        if (State->PressedKeys[0x52]) // R
         {
             // Reset
-            State->PressedKeys.erase(0x52);
+            State->PressedKeys[0x52] = 0;
             ResetPositions(State);
             State->GameMode = GameMode_Inactive;
             State->Audio.Play(State->Audio_Theme);
         }
-        
-        if (State->GameMode == GameMode_Playing)
-        {
-            body *Body[2];
-            Body[0] = GetBody(&State->Dynamics, State->Players[0]->BodyIndex);
-            Body[1] = GetBody(&State->Dynamics, State->Players[1]->BodyIndex);
-            
-            Body[0]->F = v2_zero;
-            Body[1]->F = v2_zero;
-            f32 Force = 30000.0f;
-            
-            if (State->PressedKeys.count(0x57) > 0) // W
-            {
-                Body[0]->F += V2(0.0f, +Force);
-            }
-            
-            if (State->PressedKeys.count(0x53) > 0) // S
-            {
-                Body[0]->F += V2(0.0f, -Force);
-            }
-            
-            if (State->PressedKeys.count(0x26) > 0) // Arrow up
-            {
-                Body[1]->F += V2(0.0f, +Force);
-            }
-            
-            if (State->PressedKeys.count(0x28) > 0) // Arrow down
-            {
-                Body[1]->F += V2(0.0f, -Force);
-            }
-        }
+    }
+}
+
+
+// Translates the pressed keys into forces on the paddles, done before every physics step
+void ApplyPaddleForces(game_state *State)
+{
+    body Body[2] =
+    {
+        GetBody(&State->Dynamics, State->Players[0]->Body),
+        GetBody(&State->Dynamics, State->Players[1]->Body),
+    };
+    
+    Body[0].F = v2_zero;
+    Body[1].F = v2_zero;
+    f32 Force = 30000.0f;
+    
+    if (State->PressedKeys[0x57]) // W
+    {
+        Body[0].F += V2(0.0f, +Force);
+    }
+    
+    if (State->PressedKeys[0x53]) // S
+    {
+        Body[0].F += V2(0.0f, -Force);
+    }
+    
+    if (State->PressedKeys[0x26]) // Arrow up
+    {
+        Body[1].F += V2(0.0f, +Force);
+    }
+    
+    if (State->PressedKeys[0x28]) // Arrow down
+    {
+        Body[1].F += V2(0.0f, -Force);
+    }
+}
+
+
+// Takes some of the speed out of fast balls that hit a wall
+void ApplyWallBounce(collision_info *Collision, body const& BallBody)
+{
+    f32 L = Length(BallBody.dP);
+    if (L > 900.0f)
+    {
+        Collision->ForceModifier = -0.15f;
     }
 }
 
@@ -555,8 +632,10 @@ void ServeBoll(game_state *State)
         Angle = Pi32 - 0.5f*Theta + Angle;
     }
     
-    body *Body = GetBody(&State->Dynamics, State->Ball->BodyIndex);
-    Body->F = V2(Cos(Angle), Sin(Angle)) * 10000.0f;
+    body Body = GetBody(&State->Dynamics, State->Ball->Body);
+    Body.F = V2(Cos(Angle), Sin(Angle)) * 10000.0f;
+    
+    Invalidate(&State->BallPredictor);
 }
 
 
@@ -620,6 +699,75 @@ void End(game_state *State)
 
 
 
+//
+// Snapshots
+//
+
+size_t GetSnapshotSize(game_state *State)
+{
+    assert(State);
+    
+    size_t Result = sizeof(game_snapshot_header) + GetSnapshotSize(&State->Dynamics);
+    return Result;
+}
+
+
+size_t SaveSnapshot(game_state *State, void *Memory, size_t Size)
+{
+    assert(State);
+    assert(Memory);
+    
+    if (Size < sizeof(game_snapshot_header))
+    {
+        return 0;
+    }
+    
+    game_snapshot_header Header = {};
+    Header.Scores[0] = State->Scores[0];
+    Header.Scores[1] = State->Scores[1];
+    Header.GameMode = State->GameMode;
+    
+    u8 *At = static_cast<u8 *>(Memory);
+    memcpy(At, &Header, sizeof(Header));
+    
+    size_t DynamicsSize = SaveSnapshot(&State->Dynamics, At + sizeof(Header), Size - sizeof(Header));
+    
+    size_t Result = DynamicsSize ? (sizeof(Header) + DynamicsSize) : 0;
+    return Result;
+}
+
+
+b32 RestoreSnapshot(game_state *State, void const *Memory, size_t Size)
+{
+    assert(State);
+    assert(Memory);
+    
+    if (Size < sizeof(game_snapshot_header))
+    {
+        return false;
+    }
+    
+    game_snapshot_header Header;
+    u8 const *At = static_cast<u8 const *>(Memory);
+    memcpy(&Header, At, sizeof(Header));
+    
+    if (!RestoreSnapshot(&State->Dynamics, At + sizeof(Header), Size - sizeof(Header)))
+    {
+        return false;
+    }
+    
+    State->Scores[0] = Header.Scores[0];
+    State->Scores[1] = Header.Scores[1];
+    State->GameMode = Header.GameMode;
+    
+    Invalidate(&State->BallPredictor);
+    
+    return true;
+}
+
+
+
+
 //
 // Misc.
 // 
@@ -630,13 +778,15 @@ void ResetPositions(game_state *State)
     f32 const Height = (f32)State->DrawCalls.DisplayMetrics.WindowHeight;
     
     v2 P = V2(0.5f * Width, 0.5f * Height);
-    SetP(&State->Dynamics, State->Ball->BodyIndex, P);
+    SetP(&State->Dynamics, State->Ball->Body, P);
     
     P = V2(1.5f * State->Players[1]->Size.x, 0.5f * Height);
-    SetP(&State->Dynamics, State->Players[0]->BodyIndex, P);
+    SetP(&State->Dynamics, State->Players[0]->Body, P);
     
     P = V2(Width - 1.5f * State->Players[1]->Size.x, 0.5f * Height);
-    SetP(&State->Dynamics, State->Players[1]->BodyIndex, P);
+    SetP(&State->Dynamics, State->Players[1]->Body, P);
+    
+    memset(State->PressedKeys, 0, sizeof(State->PressedKeys));
     
-    State->PressedKeys.clear();
+    Invalidate(&State->BallPredictor);
 }
@@ -29,12 +29,12 @@
 #include "audio.h"
 #include "dynamics.h"
 #include "resources.h"
+#include "trajectory.h"
 
 #include "entity_pool.h"
 #include "entity.h"
 
 #include <vector>
-#include <map>
 
 
 
@@ -77,8 +77,8 @@ struct game_state
     voice_index Audio_WallBounce;
     
     //
-    // Input
-    std::map<u8, u8> PressedKeys; // TODO(Marcus): Implement proper input handling and processing.
+    // Input, non-zero for the virtual-key codes that are held down
+    u8 PressedKeys[256] = {}; // TODO(Marcus): Implement proper input handling and processing.
     
     //
     // Physics
@@ -92,6 +92,11 @@ struct game_state
     entity *Ball;
     u32 Scores[2];
     
+    //
+    // AI, follows the predicted intercept of the ball instead of the ball itself when predictive
+    trajectory_predictor BallPredictor; // The ball and the walls
+    b32 PredictiveAI = true;
+    
     u8 PlayerCount;
     game_mode GameMode = GameMode_Inactive;
 };
@@ -102,4 +107,18 @@ void Update(game_state *State, f32 dt);
 void Shutdown(game_state *State);
 
 
+//
+// Snapshots for rollback, a game_snapshot_header followed by a snapshot of the dynamics
+struct game_snapshot_header
+{
+    u32 Scores[2];
+    game_mode GameMode;
+    u32 Padding; // Keeps the dynamics snapshot 8-byte aligned
+};
+
+size_t GetSnapshotSize(game_state *State);
+size_t SaveSnapshot(game_state *State, void *Memory, size_t Size); // Returns 0 if it doesn't fit in Size
+b32 RestoreSnapshot(game_state *State, void const *Memory, size_t Size);
+
+
 #endif
\ No newline at end of file
@@ -36,6 +36,34 @@
 #include "types.h"
 #include <math.h>
 
+#if defined(_MSC_VER)
+#include <intrin.h> // _mul128, for the fixed point products
+#endif
+
+//
+// Deterministic mode, DETERMINISTIC is defined by the lockstep build. The same input then gives
+// bit-identical results with every compiler and CPU: no contraction into FMA, no reordering
+// (that is up to the compiler flags, see build.bat) and no CRT functions whose results differ
+// between implementations.
+#ifdef DETERMINISTIC
+#if defined(_M_FP_FAST) || defined(__FAST_MATH__)
+#error "DETERMINISTIC needs strict floating point, build without /fp:fast or -ffast-math"
+#endif
+
+#if defined(_MSC_VER)
+#pragma fp_contract(off)
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MATHEMATICS_SSE_SQRT 1
+#include <emmintrin.h>
+#endif
+#endif
+
 #define Pi32    3.141592653589793f
 #define Pi32_2  1.570796326794897f
 #define Pi32_4  0.785398163397448f
@@ -46,9 +74,18 @@
 inline u8 Max(u8 x, u8 y) {return x > y ? x : y;}
 inline u8 Min(u8 x, u8 y) {return x < y ? x : y;}
 
+inline s32 Max(s32 x, s32 y) {return x > y ? x : y;}
+inline s32 Min(s32 x, s32 y) {return x < y ? x : y;}
+
+inline u32 Max(u32 x, u32 y) {return x > y ? x : y;}
+inline u32 Min(u32 x, u32 y) {return x < y ? x : y;}
+
 inline f32 Max(f32 x, f32 y) {return x > y ? x : y;}
 inline f32 Min(f32 x, f32 y) {return x < y ? x : y;}
 
+inline f32 Clamp(f32 x, f32 Lo, f32 Hi) {return Min(Max(x, Lo), Hi);}
+inline f32 Sign(f32 x) {return x < 0.0f ? -1.0f : 1.0f;}
+
 
 
 //
@@ -58,19 +95,69 @@ inline f32 Square(f32 const& x) {
     return Result;
 }
 
+// IEEE 754 requires the square root to be correctly rounded, but the compiler may still replace
+// it with an estimate. In deterministic mode the instruction is used directly.
 inline f32 SquareRoot(f32 const& x) {
+#ifdef MATHEMATICS_SSE_SQRT
+    f32 Result = _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(x)));
+#else
     f32 Result = sqrtf(x);
+#endif
+    return Result;
+}
+
+#ifdef DETERMINISTIC
+//
+// sinf and cosf are not correctly rounded and differ between CRTs. Reduce the angle to
+// [-Pi/4, Pi/4] and evaluate the Taylor polynomials instead. The error is around 1e-7 within
+// [-Tau, Tau] and grows slowly with the size of the angle.
+inline f32 SinPolynomial(f32 x) {
+    f32 x2 = x * x;
+    f32 Result = x + x * x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f + x2 * (-1.0f / 5040.0f + x2 * (1.0f / 362880.0f))));
     return Result;
 }
 
+inline f32 CosPolynomial(f32 x) {
+    f32 x2 = x * x;
+    f32 Result = 1.0f + x2 * (-0.5f + x2 * (1.0f / 24.0f + x2 * (-1.0f / 720.0f + x2 * (1.0f / 40320.0f))));
+    return Result;
+}
+
+// The quadrant of a, and a - Quadrant * Pi/2 with Pi/2 split in two parts to keep the precision
+inline s32 ReduceAngle(f32 a, f32 *r) {
+    s32 Quadrant = (s32)floorf(a * (2.0f / Pi32) + 0.5f);
+    *r = (a - (f32)Quadrant * 1.5707963705062866f) + (f32)Quadrant * 4.3711388286737929e-8f;
+    return Quadrant & 3;
+}
+
 inline f32 Cos(f32 const& a) {
-    f32 Result = cosf(a);
+    f32 r;
+    f32 Result;
+    switch (ReduceAngle(a, &r))
+    {
+        case 0:  Result =  CosPolynomial(r); break;
+        case 1:  Result = -SinPolynomial(r); break;
+        case 2:  Result = -CosPolynomial(r); break;
+        default: Result =  SinPolynomial(r); break;
+    }
     return Result;
 }
 
-inline f32 ArcCos(f32 const& c)
-{
-    f32 Result = acosf(c);
+inline f32 Sin(f32 const& a) {
+    f32 r;
+    f32 Result;
+    switch (ReduceAngle(a, &r))
+    {
+        case 0:  Result =  SinPolynomial(r); break;
+        case 1:  Result =  CosPolynomial(r); break;
+        case 2:  Result = -SinPolynomial(r); break;
+        default: Result = -CosPolynomial(r); break;
+    }
+    return Result;
+}
+#else
+inline f32 Cos(f32 const& a) {
+    f32 Result = cosf(a);
     return Result;
 }
 
@@ -78,6 +165,13 @@ inline f32 Sin(f32 const& a) {
     f32 Result = sinf(a);
     return Result;
 }
+#endif
+
+inline f32 ArcCos(f32 const& c)
+{
+    f32 Result = acosf(c);
+    return Result;
+}
 
 inline f32 Tan(f32 const& a) {
     f32 Result = tanf(a);
@@ -117,6 +211,109 @@ inline b32 AlmostEqualRelative(f32 a, f32 b, f32 MaxRelDiff = FLT_EPSILON)
 
 
 
+//
+// Fixed point
+//
+
+// Q48.16, the 16 fractional bits of Q16.16 but with a 64-bit integer part so that products like
+// a force times an inverse mass don't overflow. Products and quotients go through 128 bits, so
+// they only overflow when the result itself doesn't fit in Q48.16. All the arithmetic is integer
+// math, so the results are the same on every machine and with every compiler setting. The
+// conversions from f32 are exact up to the resolution of 2^-16 and round towards zero, the ones
+// to f32 round to nearest.
+// This is an experiment: only IntegrateFixed() uses it, with the bodies still stored as f32, and
+// the collision detection and the solver stay f32. It doesn't make the dynamics lockstep safe.
+s32 constexpr kFixedFractionBits = 16;
+s64 constexpr kFixedOne = s64(1) << kFixedFractionBits;
+
+// f32s of 2^47 and more don't fit, they saturate to +-kFixedMaxValue instead. f32Max, the "no
+// limit" of the bodies, then stays no limit. The largest f32 below 2^47 is 2^47 - 2^23, which is
+// still exact.
+f32 constexpr kFixedMaxF32 = 140737488355328.0f; // 2^47
+s64 constexpr kFixedMaxValue = 0x7fffffffffffffffLL;
+
+struct fixed {
+    s64 Value;
+};
+
+inline fixed Fixed(f32 const& a) {
+    fixed Result;
+    
+    if (a >= kFixedMaxF32) {
+        Result.Value = kFixedMaxValue;
+    }
+    else if (a <= -kFixedMaxF32) {
+        Result.Value = -kFixedMaxValue;
+    }
+    else {
+        Result.Value = static_cast<s64>(a * static_cast<f32>(kFixedOne));
+    }
+    
+    return Result;
+}
+
+inline f32 ToF32(fixed const& a) {
+    f32 Result = static_cast<f32>(a.Value) * (1.0f / static_cast<f32>(kFixedOne));
+    return Result;
+}
+
+inline fixed operator + (fixed const& a, fixed const& b) {
+    fixed Result = {a.Value + b.Value};
+    return Result;
+}
+
+inline fixed operator - (fixed const& a, fixed const& b) {
+    fixed Result = {a.Value - b.Value};
+    return Result;
+}
+
+inline fixed operator - (fixed const& a) {
+    fixed Result = {-a.Value};
+    return Result;
+}
+
+// The 128-bit product is shifted back with an arithmetic shift, i.e. rounded towards minus infinity
+inline fixed operator * (fixed const& a, fixed const& b) {
+    fixed Result;
+#if defined(_MSC_VER)
+    s64 High;
+    u64 Low = static_cast<u64>(_mul128(a.Value, b.Value, &High));
+    Result.Value = static_cast<s64>((Low >> kFixedFractionBits) | (static_cast<u64>(High) << (64 - kFixedFractionBits)));
+#else
+    __int128 Product = static_cast<__int128>(a.Value) * b.Value;
+    Result.Value = static_cast<s64>(Product >> kFixedFractionBits);
+#endif
+    return Result;
+}
+
+inline fixed operator += (fixed& a, fixed const& b) {
+    a = a + b;
+    return a;
+}
+
+inline fixed operator -= (fixed& a, fixed const& b) {
+    a = a - b;
+    return a;
+}
+
+inline fixed operator *= (fixed& a, fixed const& b) {
+    a = a * b;
+    return a;
+}
+
+inline b32 operator == (fixed const& a, fixed const& b) {return a.Value == b.Value;}
+inline b32 operator != (fixed const& a, fixed const& b) {return a.Value != b.Value;}
+inline b32 operator <  (fixed const& a, fixed const& b) {return a.Value <  b.Value;}
+inline b32 operator >  (fixed const& a, fixed const& b) {return a.Value >  b.Value;}
+inline b32 operator <= (fixed const& a, fixed const& b) {return a.Value <= b.Value;}
+inline b32 operator >= (fixed const& a, fixed const& b) {return a.Value >= b.Value;}
+
+inline fixed Max(fixed x, fixed y) {return x > y ? x : y;}
+inline fixed Min(fixed x, fixed y) {return x < y ? x : y;}
+
+
+
+
 //
 // Vectors
 //
@@ -182,6 +379,12 @@ inline f32 Dot(v2 const& A, v2 const& B) {
     return Result;
 }
 
+// The z of the 3D cross product, positive if B is counter-clockwise from A
+inline f32 Cross(v2 const& A, v2 const& B) {
+    f32 Result = A.x * B.y - A.y * B.x;
+    return Result;
+}
+
 //
 // v2 vs f32
 inline v2 operator * (v2 const& A, float const& b) {
@@ -238,6 +441,11 @@ inline v2 NOZ(v2 const& A) {
     return Result;
 }
 
+inline v2 Lerp(v2 const& A, v2 const& B, f32 t) {
+    v2 Result = A + t * (B - A);
+    return Result;
+}
+
 
 
 //
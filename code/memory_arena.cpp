@@ -0,0 +1,270 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "memory_arena.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+
+
+//
+// "Public" functions (declared in the header file).
+//
+
+size_t GetPageSize()
+{
+    static size_t PageSize = 0;
+    
+    if (PageSize == 0)
+    {
+#ifdef _WIN32
+        SYSTEM_INFO Info;
+        GetSystemInfo(&Info);
+        PageSize = Info.dwPageSize;
+#else
+        PageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    }
+    
+    return PageSize;
+}
+
+
+u8 *ReserveVirtualMemory(size_t Size)
+{
+    assert((Size % GetPageSize()) == 0);
+    
+#ifdef _WIN32
+    u8 *Result = static_cast<u8 *>(VirtualAlloc(nullptr, Size, MEM_RESERVE, PAGE_NOACCESS));
+#else
+    void *Ptr = mmap(nullptr, Size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    u8 *Result = (Ptr == MAP_FAILED) ? nullptr : static_cast<u8 *>(Ptr);
+#endif
+    
+    return Result;
+}
+
+
+b32 CommitVirtualMemory(u8 *Ptr, size_t Size)
+{
+    assert((reinterpret_cast<size_t>(Ptr) % GetPageSize()) == 0);
+    assert((Size % GetPageSize()) == 0);
+    
+#ifdef _WIN32
+    b32 Result = (VirtualAlloc(Ptr, Size, MEM_COMMIT, PAGE_READWRITE) != nullptr);
+#else
+    b32 Result = (mprotect(Ptr, Size, PROT_READ | PROT_WRITE) == 0);
+#endif
+    
+    return Result;
+}
+
+
+void ReleaseVirtualMemory(u8 *Ptr, size_t Size)
+{
+#ifdef _WIN32
+    VirtualFree(Ptr, 0, MEM_RELEASE);
+#else
+    munmap(Ptr, Size);
+#endif
+}
+
+
+
+
+//
+// Registry
+//
+
+// The thread arenas register themselves from their own threads
+static std::mutex RegistryMutex;
+
+static u32 const kMaxRegisteredArenaCount = 128;
+static memory_arena *RegisteredArenas[kMaxRegisteredArenaCount];
+static u32 RegisteredArenaCount = 0;
+
+
+void Register(memory_arena *Memory, char const *Name)
+{
+    assert(Memory);
+    std::lock_guard<std::mutex> Lock(RegistryMutex);
+    
+    Memory->Name = Name;
+    
+    for (u32 Index = 0; Index < RegisteredArenaCount; ++Index)
+    {
+        if (RegisteredArenas[Index] == Memory)
+        {
+            return;
+        }
+    }
+    
+    assert(RegisteredArenaCount < kMaxRegisteredArenaCount);
+    if (RegisteredArenaCount < kMaxRegisteredArenaCount)
+    {
+        RegisteredArenas[RegisteredArenaCount++] = Memory;
+    }
+}
+
+
+void Unregister(memory_arena *Memory)
+{
+    std::lock_guard<std::mutex> Lock(RegistryMutex);
+    
+    for (u32 Index = 0; Index < RegisteredArenaCount; ++Index)
+    {
+        if (RegisteredArenas[Index] == Memory)
+        {
+            RegisteredArenas[Index] = RegisteredArenas[--RegisteredArenaCount];
+            return;
+        }
+    }
+}
+
+
+// Appends to Buffer like snprintf, keeps counting the length once it is full
+static size_t Append(char *Buffer, size_t Size, size_t Length, char const *Format, ...)
+{
+    va_list Arguments;
+    va_start(Arguments, Format);
+    
+    int Written = vsnprintf(Buffer ? Buffer + (Length < Size ? Length : Size) : nullptr,
+                            Length < Size ? Size - Length : 0, Format, Arguments);
+    
+    va_end(Arguments);
+    
+    size_t Result = Length + (Written > 0 ? static_cast<size_t>(Written) : 0);
+    return Result;
+}
+
+
+// Reads the arenas of other threads without synchronization, see the declaration
+size_t FormatArenaReport(char *Buffer, size_t Size)
+{
+    assert(Buffer || (Size == 0));
+    std::lock_guard<std::mutex> Lock(RegistryMutex);
+    
+    size_t Length = 0;
+    
+    if (Size > 0)
+    {
+        Buffer[0] = 0;
+    }
+    
+    for (u32 Index = 0; Index < RegisteredArenaCount; ++Index)
+    {
+        memory_arena const *Memory = RegisteredArenas[Index];
+        memory_arena_stats const& Stats = Memory->Stats;
+        
+        Length = Append(Buffer, Size, Length,
+                        "arena=%s size=%llu used=%llu peak=%llu reserved=%llu resizes=%u pushes=%llu failed_pushes=%llu\n",
+                        Memory->Name ? Memory->Name : "unnamed",
+                        (unsigned long long)Memory->Size, (unsigned long long)Memory->Used,
+                        (unsigned long long)Stats.PeakUsed, (unsigned long long)Memory->Reserved,
+                        Stats.ResizeCount, (unsigned long long)Stats.PushCount,
+                        (unsigned long long)Stats.FailedPushCount);
+        
+#ifdef MEMORY_ARENA_TRACE
+        for (u32 TagIndex = 0; TagIndex < Memory->TagCount; ++TagIndex)
+        {
+            memory_arena_tag const& Tag = Memory->Tags[TagIndex];
+            Length = Append(Buffer, Size, Length, "    tag=%s pushes=%llu bytes=%llu\n",
+                            Tag.Tag ? Tag.Tag : "untagged",
+                            (unsigned long long)Tag.PushCount, (unsigned long long)Tag.Bytes);
+        }
+#endif
+    }
+    
+    return Length;
+}
+
+
+
+
+//
+// Thread arenas
+//
+
+// What is committed up front, the rest of kThreadArenaReservedSize is committed as it is needed
+static size_t const kThreadArenaSize = 64 << 10;
+
+static std::atomic<u64> ArenaFrame{0};
+
+struct thread_arena
+{
+    memory_arena Memory;
+    u64 Frame = 0;
+    
+    ~thread_arena()
+    {
+        if (Memory.Ptr)
+        {
+            Unregister(&Memory);
+            Free(&Memory);
+        }
+    }
+};
+
+static thread_local thread_arena ThreadArena;
+
+
+memory_arena *GetThreadArena(size_t Size)
+{
+    thread_arena *Arena = &ThreadArena;
+    u64 Frame = ArenaFrame.load(std::memory_order_relaxed);
+    
+    if (!Arena->Memory.Ptr)
+    {
+        InitVirtual(&Arena->Memory, kThreadArenaReservedSize, kThreadArenaSize);
+        Register(&Arena->Memory, "thread");
+        Arena->Frame = Frame;
+    }
+    else if (Arena->Frame != Frame)
+    {
+        Clear(&Arena->Memory);
+        Arena->Frame = Frame;
+    }
+    
+    if (Size > 0)
+    {
+        GrowToFit(&Arena->Memory, Size, kMaxArenaAlignment);
+    }
+    
+    return &Arena->Memory;
+}
+
+
+void BeginArenaFrame()
+{
+    ArenaFrame.fetch_add(1, std::memory_order_relaxed);
+}
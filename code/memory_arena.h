@@ -33,6 +33,11 @@
 
 #include "types.h"
 #include <stdlib.h>
+#include <string.h>
+#include <new> // std::bad_alloc
+#include <atomic>
+
+// Define MEMORY_ARENA_TRACE to also count the pushes per call site, see memory_arena_tag
 
 
 
@@ -40,31 +45,182 @@
 // Struct
 //
 
+// The memory is allocated aligned to this, and PushAligned() handles alignments up to it. The
+// alignment of the memory is kept by Resize().
+size_t constexpr kMaxArenaAlignment = 64;
+
+
+//
+// Kept by every arena, for sizing them. Init() and Free() leave the stats as they are, so they
+// cover the whole run.
+struct memory_arena_stats
+{
+    size_t PeakUsed = 0;
+    u32 ResizeCount = 0;
+    u64 PushCount = 0;
+    u64 FailedPushCount = 0; // Pushes that didn't fit
+};
+
+
+#ifdef MEMORY_ARENA_TRACE
+// The pushes and bytes, with padding, per tag passed to the push functions. The untagged pushes
+// share the null tag, and so do the tags that don't fit in the table.
+u32 constexpr kMaxArenaTagCount = 16;
+
+struct memory_arena_tag
+{
+    char const *Tag;
+    u64 PushCount;
+    u64 Bytes;
+};
+#endif
+
+
 struct memory_arena
 {
     u8 *Ptr = nullptr;
     size_t Size = 0;
     size_t Used = 0;
+    
+    // Non-zero for arenas made by InitVirtual(), the reserved address range that Size can grow
+    // into without the memory moving
+    size_t Reserved = 0;
+    
+    u32 TemporaryCount = 0; // Open BeginTemporaryMemory() scopes
+    
+    char const *Name = nullptr; // Set by Register()
+    memory_arena_stats Stats;
+    
+#ifdef MEMORY_ARENA_TRACE
+    memory_arena_tag Tags[kMaxArenaTagCount] = {};
+    u32 TagCount = 0;
+#endif
+};
+
+
+//
+// Everything pushed between BeginTemporaryMemory() and EndTemporaryMemory() is popped again by
+// EndTemporaryMemory(). The scopes nest, and must end in the reverse order they began.
+struct temporary_memory
+{
+    memory_arena *Arena = nullptr;
+    size_t Used = 0;
 };
 
 
 
 
+//
+// Virtual memory, implemented per platform in memory_arena.cpp. Reserved memory has addresses but
+// no pages, committing gives it zeroed pages. Sizes are multiples of the page size.
+//
+
+size_t GetPageSize();
+u8 *ReserveVirtualMemory(size_t Size);
+b32 CommitVirtualMemory(u8 *Ptr, size_t Size);
+void ReleaseVirtualMemory(u8 *Ptr, size_t Size);
+
+
+
+
+//
+// Registry of the arenas in the report, in memory_arena.cpp. An arena has to be unregistered
+// before it goes away.
+//
+
+void Register(memory_arena *Memory, char const *Name);
+void Unregister(memory_arena *Memory);
+
+
+
+
+//
+// Per-thread scratch, in memory_arena.cpp. Every thread has an arena of its own, made the first
+// time the thread asks for it. BeginArenaFrame() starts a new frame, and each thread arena is
+// cleared the first time its thread asks for it in the new frame, so memory from it is only
+// valid until the end of the frame.
+//
+
+// The thread arenas are virtual, Size is how much the caller is about to push and the arena
+// grows in place to fit it, up to kThreadArenaReservedSize. Pointers from earlier in the frame
+// stay valid.
+size_t constexpr kThreadArenaReservedSize = 64 << 20;
+
+memory_arena *GetThreadArena(size_t Size = 0);
+void BeginArenaFrame();
+
+// Writes one line per registered arena, key=value pairs like FormatStats() of the dynamics, and
+// with MEMORY_ARENA_TRACE one line per tag below it. Returns the length of the report.
+// The arenas are not synchronized, so call it only when no other thread pushes to, clears or
+// resizes a registered arena, e.g. at shutdown or while the workers are idle between frames.
+size_t FormatArenaReport(char *Buffer, size_t Size);
+
+
+
+
 //
 // Implementation
 //
 
+// Zero initialized, like calloc
+static u8 *AllocateAligned(size_t Size)
+{
+#ifdef _WIN32
+    u8 *Result = static_cast<u8 *>(_aligned_malloc(Size, kMaxArenaAlignment));
+#else
+    // aligned_alloc wants a multiple of the alignment
+    u8 *Result = static_cast<u8 *>(aligned_alloc(kMaxArenaAlignment, (Size + kMaxArenaAlignment - 1) & ~(kMaxArenaAlignment - 1)));
+#endif
+    
+    if (Result)
+    {
+        memset(Result, 0, Size);
+    }
+    
+    return Result;
+}
+
+
+static void FreeAligned(u8 *Ptr)
+{
+#ifdef _WIN32
+    _aligned_free(Ptr);
+#else
+    free(Ptr);
+#endif
+}
+
+
+static size_t RoundUpToPageSize(size_t Size)
+{
+    size_t PageSize = GetPageSize();
+    
+    size_t Result = (Size + PageSize - 1) & ~(PageSize - 1);
+    return Result;
+}
+
+
 static void Free(memory_arena *Memory)
 {
     assert(Memory);
     if (Memory->Ptr)
     {
-        free(Memory->Ptr);
+        if (Memory->Reserved)
+        {
+            ReleaseVirtualMemory(Memory->Ptr, Memory->Reserved);
+        }
+        else
+        {
+            FreeAligned(Memory->Ptr);
+        }
+        
         Memory->Ptr = nullptr;
     }
     
     Memory->Size = 0;
     Memory->Used = 0;
+    Memory->Reserved = 0;
+    Memory->TemporaryCount = 0;
 }
 
 
@@ -75,11 +231,44 @@ static b32 Init(memory_arena *Memory, size_t Size)
     
     if (Memory && Size > 0)
     {
-        Memory->Ptr = static_cast<u8 *>(calloc(1, Size));
+        Memory->Ptr = AllocateAligned(Size);
         assert(Memory->Ptr);
         
         Memory->Size = Size;
         Memory->Used = 0;
+        
+        Result = (Memory->Ptr != nullptr);
+    }
+    
+    return Result;
+}
+
+
+//
+// Reserves ReservedSize of address space and commits the first Size of it. Resize() then commits
+// more pages in place, up to ReservedSize, so pointers into the arena stay valid and nothing is
+// copied. Size is rounded up to whole pages.
+static b32 InitVirtual(memory_arena *Memory, size_t ReservedSize, size_t Size)
+{
+    Free(Memory);
+    b32 Result = false;
+    
+    if (Memory && (Size > 0) && (Size <= ReservedSize))
+    {
+        ReservedSize = RoundUpToPageSize(ReservedSize);
+        Size = RoundUpToPageSize(Size);
+        
+        Memory->Ptr = ReserveVirtualMemory(ReservedSize);
+        assert(Memory->Ptr);
+        
+        if (Memory->Ptr)
+        {
+            Memory->Reserved = ReservedSize;
+            
+            Result = CommitVirtualMemory(Memory->Ptr, Size);
+            Memory->Size = Result ? Size : 0;
+            Memory->Used = 0;
+        }
     }
     
     return Result;
@@ -98,13 +287,46 @@ static b32 Resize(memory_arena *Memory, size_t NewSize)
 {
     b32 Result = false;
     
-    if (Memory && NewSize > 0)
+    if (Memory && (NewSize > 0) && Memory->Reserved)
     {
-        u8 *NewPtr = static_cast<u8 *>(realloc(Memory->Ptr, NewSize));
+        //
+        // Only the new pages are committed. Shrinking keeps the pages but zeroes them, so that
+        // growing again gives zeroed memory like a fresh commit does.
+        if (NewSize <= Memory->Reserved)
+        {
+            NewSize = RoundUpToPageSize(NewSize);
+            
+            if (NewSize < Memory->Size)
+            {
+                memset(Memory->Ptr + NewSize, 0, Memory->Size - NewSize);
+            }
+            
+            if ((NewSize <= Memory->Size) || CommitVirtualMemory(Memory->Ptr + Memory->Size, NewSize - Memory->Size))
+            {
+                ++Memory->Stats.ResizeCount;
+                Memory->Size = NewSize;
+                Memory->Used = Memory->Used < NewSize ? Memory->Used : NewSize;
+                Result = true;
+            }
+        }
+    }
+    else if (Memory && (NewSize > 0))
+    {
+        // Not realloc, which would only keep the alignment of malloc. Like realloc the memory moves,
+        // pointers into it are invalid afterwards.
+        u8 *NewPtr = AllocateAligned(NewSize);
         
         if (NewPtr)
         {
+            if (Memory->Ptr)
+            {
+                memcpy(NewPtr, Memory->Ptr, Memory->Size < NewSize ? Memory->Size : NewSize);
+                FreeAligned(Memory->Ptr);
+            }
+            
+            ++Memory->Stats.ResizeCount;
             Memory->Ptr = NewPtr;
+            Memory->Used = Memory->Used < NewSize ? Memory->Used : NewSize;
             Memory->Size = NewSize;
             Result = true;
         }
@@ -114,18 +336,116 @@ static b32 Resize(memory_arena *Memory, size_t NewSize)
 }
 
 
-static u8 *Push(memory_arena *Memory, size_t Size)
+// Grows a virtual arena in place, to twice its size or more, so that Size with Alignment fits.
+// False for other arenas, or if it doesn't fit in what is reserved.
+static b32 GrowToFit(memory_arena *Memory, size_t Size, size_t Alignment)
+{
+    assert(Memory);
+    
+    size_t Needed = Memory->Used + Size + Alignment;
+    b32 Result = (Needed <= Memory->Size);
+    
+    if (!Result && Memory->Reserved && (Needed <= Memory->Reserved))
+    {
+        size_t NewSize = 2 * Memory->Size;
+        NewSize = NewSize < Needed ? Needed : NewSize;
+        NewSize = NewSize < Memory->Reserved ? NewSize : Memory->Reserved;
+        
+        Result = Resize(Memory, NewSize);
+    }
+    
+    return Result;
+}
+
+
+#ifdef MEMORY_ARENA_TRACE
+static void RecordTag(memory_arena *Memory, char const *Tag, size_t Bytes)
+{
+    u32 Index = 0;
+    while ((Index < Memory->TagCount) && (Memory->Tags[Index].Tag != Tag) &&
+           !(Tag && Memory->Tags[Index].Tag && (strcmp(Memory->Tags[Index].Tag, Tag) == 0)))
+    {
+        ++Index;
+    }
+    
+    if (Index == Memory->TagCount)
+    {
+        if (Memory->TagCount < kMaxArenaTagCount)
+        {
+            Memory->Tags[Memory->TagCount++].Tag = Tag;
+        }
+        else
+        {
+            // Full, counted with the untagged pushes in the last entry
+            Index = kMaxArenaTagCount - 1;
+            Memory->Tags[Index].Tag = nullptr;
+        }
+    }
+    
+    ++Memory->Tags[Index].PushCount;
+    Memory->Tags[Index].Bytes += Bytes;
+}
+#endif
+
+
+// Alignment is a power of two up to kMaxArenaAlignment. The padding in front of the memory counts
+// as used, pushing 0 bytes aligns the end of what is already pushed. Tag names the call site for
+// MEMORY_ARENA_TRACE builds and is ignored otherwise, it has to outlive the arena.
+static u8 *PushAligned(memory_arena *Memory, size_t Size, size_t Alignment, char const *Tag = nullptr)
 {
     assert(Memory);
+    assert((Alignment > 0) && ((Alignment & (Alignment - 1)) == 0));
+    assert(Alignment <= kMaxArenaAlignment);
     
     u8 *Result = nullptr;
     
-    if ((Memory->Size - Memory->Used) >= Size)
+    size_t Padding = (Alignment - (Memory->Used & (Alignment - 1))) & (Alignment - 1);
+    
+    if ((Memory->Size - Memory->Used) >= (Padding + Size))
     {
-        Result = (Memory->Ptr + Memory->Used);
-        Memory->Used += Size;
+        Result = (Memory->Ptr + Memory->Used + Padding);
+        Memory->Used += (Padding + Size);
+        
+        ++Memory->Stats.PushCount;
+        Memory->Stats.PeakUsed = Memory->Used > Memory->Stats.PeakUsed ? Memory->Used : Memory->Stats.PeakUsed;
+        
+#ifdef MEMORY_ARENA_TRACE
+        RecordTag(Memory, Tag, Padding + Size);
+#endif
     }
+    else
+    {
+        ++Memory->Stats.FailedPushCount;
+    }
+    
+    return Result;
+}
+
+
+static u8 *Push(memory_arena *Memory, size_t Size, char const *Tag = nullptr)
+{
+    u8 *Result = PushAligned(Memory, Size, 1, Tag);
+    return Result;
+}
+
+
+// Aligned to alignof(T), not constructed. Null if it doesn't fit, like Push().
+template<typename T>
+static T *PushStruct(memory_arena *Memory, char const *Tag = nullptr)
+{
+    static_assert(alignof(T) <= kMaxArenaAlignment, "The arena can't align T");
     
+    T *Result = reinterpret_cast<T *>(PushAligned(Memory, sizeof(T), alignof(T), Tag));
+    return Result;
+}
+
+
+template<typename T>
+static T *PushArray(memory_arena *Memory, size_t Count, char const *Tag = nullptr)
+{
+    static_assert(alignof(T) <= kMaxArenaAlignment, "The arena can't align T");
+    
+    T *Result = reinterpret_cast<T *>(PushAligned(Memory, Count * sizeof(T), alignof(T), Tag));
     return Result;
 }
 
@@ -133,9 +453,182 @@ static u8 *Push(memory_arena *Memory, size_t Size)
 static void Clear(memory_arena *Memory)
 {
     assert(Memory);
+    assert(Memory->TemporaryCount == 0);
     Memory->Used = 0;
 }
 
 
+static temporary_memory BeginTemporaryMemory(memory_arena *Memory)
+{
+    assert(Memory);
+    
+    temporary_memory Result;
+    Result.Arena = Memory;
+    Result.Used = Memory->Used;
+    
+    ++Memory->TemporaryCount;
+    
+    return Result;
+}
+
+
+static void EndTemporaryMemory(temporary_memory Temporary)
+{
+    memory_arena *Memory = Temporary.Arena;
+    assert(Memory);
+    assert(Memory->TemporaryCount > 0);
+    assert(Memory->Used >= Temporary.Used);
+    
+    Memory->Used = Temporary.Used;
+    --Memory->TemporaryCount;
+}
+
+
+
+
+//
+// An arena that many threads push to at the same time, with one atomic add per push and no
+// locks. It can't grow, the whole Size is reserved and committed by Init(), and only the pages
+// that are touched take memory. Clear() must not run while other threads push.
+//
+
+// Pushes are rounded up to this, so that every push starts aligned to it
+size_t constexpr kSharedArenaGranularity = 16;
+
+struct shared_arena
+{
+    memory_arena Memory; // Only its Ptr and Size are used while threads push
+    
+    // On a cache line of its own, it is what the threads contend for. The padding is the point,
+    // and C4324 is ignored in build.bat
+    alignas(64) std::atomic<size_t> Used{0};
+    std::atomic<u64> FailedPushCount{0};
+};
+
+
+static b32 Init(shared_arena *Arena, size_t Size)
+{
+    assert(Arena);
+    
+    b32 Result = InitVirtual(&Arena->Memory, Size, Size);
+    Arena->Used = 0;
+    Arena->FailedPushCount = 0;
+    
+    return Result;
+}
+
+
+static void Free(shared_arena *Arena)
+{
+    assert(Arena);
+    Free(&Arena->Memory);
+    Arena->Used = 0;
+    Arena->FailedPushCount = 0;
+}
+
+
+// Safe to call from any number of threads at once. Alignment is a power of two up to
+// kMaxArenaAlignment, alignments over kSharedArenaGranularity push padding to align within.
+static u8 *PushAtomic(shared_arena *Arena, size_t Size, size_t Alignment = kSharedArenaGranularity)
+{
+    assert(Arena);
+    assert((Alignment > 0) && ((Alignment & (Alignment - 1)) == 0));
+    assert(Alignment <= kMaxArenaAlignment);
+    
+    size_t Padding = Alignment > kSharedArenaGranularity ? Alignment - kSharedArenaGranularity : 0;
+    size_t RoundedSize = (Size + Padding + kSharedArenaGranularity - 1) & ~(kSharedArenaGranularity - 1);
+    
+    // Only the range matters, what is written to it is published by however the threads join
+    size_t Offset = Arena->Used.fetch_add(RoundedSize, std::memory_order_relaxed);
+    
+    u8 *Result = nullptr;
+    
+    if ((Offset + RoundedSize) <= Arena->Memory.Size)
+    {
+        Offset = (Offset + Alignment - 1) & ~(Alignment - 1);
+        Result = Arena->Memory.Ptr + Offset;
+    }
+    else
+    {
+        Arena->FailedPushCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    return Result;
+}
+
+
+// Brings the stats of Arena->Memory up to date before it is reset
+static void Clear(shared_arena *Arena)
+{
+    assert(Arena);
+    
+    memory_arena *Memory = &Arena->Memory;
+    size_t Used = Arena->Used.load();
+    Used = Used < Memory->Size ? Used : Memory->Size;
+    
+    Memory->Stats.PeakUsed = Used > Memory->Stats.PeakUsed ? Used : Memory->Stats.PeakUsed;
+    Memory->Stats.FailedPushCount += Arena->FailedPushCount.exchange(0);
+    
+    Arena->Used = 0;
+}
+
+
+
+
+//
+// Standard library allocator on top of an arena, for std containers of transient data, e.g.
+// std::vector<T, arena_allocator<T>> Array{arena_allocator<T>(&Arena)}. Deallocation does nothing,
+// the memory comes back when the arena is cleared or a temporary memory scope ends. Virtual
+// arenas grow in place when they are full, other arenas can't grow without moving what is already
+// allocated.
+// Note: unlike the push functions, which return null, allocate() throws std::bad_alloc when the
+// arena is full. That is the only way an allocator can fail, so code that uses it has to be ready
+// for the exception (or make sure that the arena is big enough).
+//
+
+template<typename T>
+struct arena_allocator
+{
+    typedef T value_type;
+    
+    memory_arena *Memory = nullptr;
+    
+    explicit arena_allocator(memory_arena *Arena) : Memory(Arena) {}
+    
+    template<typename U>
+    arena_allocator(arena_allocator<U> const& Other) : Memory(Other.Memory) {}
+    
+    // Throws std::bad_alloc if Count doesn't fit, see above
+    T *allocate(size_t Count)
+    {
+        T *Result = PushArray<T>(Memory, Count);
+        
+        if (!Result && GrowToFit(Memory, Count * sizeof(T), alignof(T)))
+        {
+            Result = PushArray<T>(Memory, Count);
+        }
+        
+        if (!Result)
+        {
+            throw std::bad_alloc();
+        }
+        
+        return Result;
+    }
+    
+    void deallocate(T *, size_t) {}
+};
+
+template<typename T, typename U>
+bool operator == (arena_allocator<T> const& A, arena_allocator<U> const& B) {
+    return A.Memory == B.Memory;
+}
+
+template<typename T, typename U>
+bool operator != (arena_allocator<T> const& A, arena_allocator<U> const& B) {
+    return A.Memory != B.Memory;
+}
+
+
 
 #endif
@@ -0,0 +1,400 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "snapshot_ring.h"
+
+#include <string.h>
+
+#ifdef DEBUG
+#include <assert.h>
+#else
+#define assert(x)
+#endif
+
+
+
+//
+// Forward declarations of "private" functions
+//
+
+size_t EncodeDelta(u8 const *Old, size_t OldSize, u8 const *New, size_t NewSize, u8 *Output);
+void ApplyDelta(u8 *Snapshot, u8 const *Delta, size_t DeltaSize);
+b32 OverlapsAnyDelta(snapshot_ring *Ring, size_t Offset, size_t Size);
+void DropOldestDelta(snapshot_ring *Ring);
+
+// Old XOR New at Index, the words past the end of the shorter one are zero
+static inline u32 GetDeltaWord(u32 const *Old, size_t OldCount, u32 const *New, size_t NewCount, size_t Index)
+{
+    u32 Result = ((Index < OldCount) ? Old[Index] : 0) ^ ((Index < NewCount) ? New[Index] : 0);
+    return Result;
+}
+
+// Keeps the blocks that are pushed onto the arena after it 8-byte aligned
+static size_t AlignTo8(size_t Size)
+{
+    return (Size + 7) & ~static_cast<size_t>(7);
+}
+
+
+
+
+//
+// "Public" functions (declared in the header file).
+//
+
+void Init(snapshot_ring *Ring, u32 Capacity, size_t MaxSnapshotSize, size_t StorageSize)
+{
+    assert(Ring);
+    assert(Capacity > 0);
+    assert((MaxSnapshotSize % 4) == 0);
+    
+    MaxSnapshotSize = AlignTo8(MaxSnapshotSize);
+    StorageSize = AlignTo8(StorageSize);
+    
+    //
+    // The worst case encoding is every other word differing, 8 bytes of run lengths per word
+    size_t const MaxEncodedSize = AlignTo8(2 * MaxSnapshotSize + 8);
+    u32 const DeltaCapacity = Capacity - 1;
+    
+    size_t Size = 2 * MaxSnapshotSize + MaxEncodedSize + (DeltaCapacity * sizeof(snapshot_delta)) + StorageSize;
+    Init(&Ring->Memory, Size);
+    Register(&Ring->Memory, "snapshot_ring");
+    
+    Ring->MaxSnapshotSize = MaxSnapshotSize;
+    Ring->Latest = Push(&Ring->Memory, MaxSnapshotSize);
+    Ring->Scratch = Push(&Ring->Memory, MaxSnapshotSize);
+    Ring->Encoded = Push(&Ring->Memory, MaxEncodedSize);
+    Ring->Deltas = reinterpret_cast<snapshot_delta *>(Push(&Ring->Memory, DeltaCapacity * sizeof(snapshot_delta)));
+    Ring->DeltaCapacity = DeltaCapacity;
+    Ring->Storage = Push(&Ring->Memory, StorageSize);
+    Ring->StorageSize = StorageSize;
+    
+    Clear(Ring);
+}
+
+
+void Shutdown(snapshot_ring *Ring)
+{
+    assert(Ring);
+    
+    Unregister(&Ring->Memory);
+    Free(&Ring->Memory);
+    *Ring = snapshot_ring();
+}
+
+
+void Clear(snapshot_ring *Ring)
+{
+    assert(Ring);
+    
+    memset(Ring->Latest, 0, Ring->LatestSize);
+    Ring->LatestSize = 0;
+    
+    Ring->FirstDelta = 0;
+    Ring->DeltaCount = 0;
+    Ring->Head = 0;
+}
+
+
+b32 Push(snapshot_ring *Ring, void const *Snapshot, size_t Size)
+{
+    assert(Ring);
+    assert(Snapshot);
+    assert((Size > 0) && (Size <= Ring->MaxSnapshotSize));
+    assert(((Size % 4) == 0) && ((reinterpret_cast<uintptr_t>(Snapshot) % 4) == 0));
+    
+    u8 const *New = static_cast<u8 const *>(Snapshot);
+    b32 Result = true;
+    
+    if ((Ring->LatestSize > 0) && (Ring->DeltaCapacity > 0))
+    {
+        size_t EncodedSize = EncodeDelta(Ring->Latest, Ring->LatestSize, New, Size, Ring->Encoded);
+        
+        if (EncodedSize <= Ring->StorageSize)
+        {
+            //
+            // Deltas are never split, wrap around to the start if it doesn't fit before the end.
+            // Drop the oldest until the space is free, so that the deltas that are left still
+            // lead all the way back from Latest.
+            size_t Offset = (Ring->Head + EncodedSize <= Ring->StorageSize) ? Ring->Head : 0;
+            
+            while ((Ring->DeltaCount == Ring->DeltaCapacity) || OverlapsAnyDelta(Ring, Offset, EncodedSize))
+            {
+                DropOldestDelta(Ring);
+            }
+            
+            memcpy(Ring->Storage + Offset, Ring->Encoded, EncodedSize);
+            
+            snapshot_delta *Delta = &Ring->Deltas[(Ring->FirstDelta + Ring->DeltaCount) % Ring->DeltaCapacity];
+            Delta->Offset = Offset;
+            Delta->Size = EncodedSize;
+            Delta->PreviousSize = Ring->LatestSize;
+            ++Ring->DeltaCount;
+            
+            Ring->Head = Offset + EncodedSize;
+        }
+        else
+        {
+            Ring->FirstDelta = 0;
+            Ring->DeltaCount = 0;
+            Ring->Head = 0;
+            Result = false;
+        }
+    }
+    
+    memcpy(Ring->Latest, New, Size);
+    if (Size < Ring->LatestSize)
+    {
+        memset(Ring->Latest + Size, 0, Ring->LatestSize - Size);
+    }
+    Ring->LatestSize = Size;
+    
+    return Result;
+}
+
+
+u32 GetCount(snapshot_ring *Ring)
+{
+    assert(Ring);
+    
+    u32 Result = (Ring->LatestSize > 0) ? (Ring->DeltaCount + 1) : 0;
+    return Result;
+}
+
+
+void const *Get(snapshot_ring *Ring, u32 Age, size_t *Size)
+{
+    assert(Ring);
+    assert(Size);
+    
+    if (Age >= GetCount(Ring))
+    {
+        return nullptr;
+    }
+    
+    if (Age == 0)
+    {
+        *Size = Ring->LatestSize;
+        return Ring->Latest;
+    }
+    
+    //
+    // The deltas cover the larger of the two sizes, copy enough of Latest (the rest is zero) for
+    // all the snapshots on the way.
+    size_t CopySize = Ring->LatestSize;
+    for (u32 Step = 0; Step < Age; ++Step)
+    {
+        snapshot_delta *Delta = &Ring->Deltas[(Ring->FirstDelta + Ring->DeltaCount - 1 - Step) % Ring->DeltaCapacity];
+        CopySize = CopySize > Delta->PreviousSize ? CopySize : Delta->PreviousSize;
+    }
+    
+    memcpy(Ring->Scratch, Ring->Latest, CopySize);
+    
+    for (u32 Step = 0; Step < Age; ++Step)
+    {
+        snapshot_delta *Delta = &Ring->Deltas[(Ring->FirstDelta + Ring->DeltaCount - 1 - Step) % Ring->DeltaCapacity];
+        ApplyDelta(Ring->Scratch, Ring->Storage + Delta->Offset, Delta->Size);
+        *Size = Delta->PreviousSize;
+    }
+    
+    return Ring->Scratch;
+}
+
+
+b32 Rewind(snapshot_ring *Ring, u32 Age)
+{
+    assert(Ring);
+    
+    if (Age >= GetCount(Ring))
+    {
+        return false;
+    }
+    
+    for (u32 Step = 0; Step < Age; ++Step)
+    {
+        snapshot_delta *Delta = &Ring->Deltas[(Ring->FirstDelta + Ring->DeltaCount - 1) % Ring->DeltaCapacity];
+        ApplyDelta(Ring->Latest, Ring->Storage + Delta->Offset, Delta->Size);
+        Ring->LatestSize = Delta->PreviousSize;
+        
+        // Nothing newer than this delta is left, so its storage is where the next one goes
+        Ring->Head = Delta->Offset;
+        --Ring->DeltaCount;
+    }
+    
+    return true;
+}
+
+
+
+
+//
+// Deltas
+//
+
+// Encodes Old XOR New as a sequence of [zero word count, literal word count, literal words...].
+// The snapshot that is shorter is treated as padded with zeros.
+size_t EncodeDelta(u8 const *Old, size_t OldSize, u8 const *New, size_t NewSize, u8 *Output)
+{
+    size_t const OldWordCount = OldSize / 4;
+    size_t const NewWordCount = NewSize / 4;
+    size_t const CommonWordCount = OldWordCount < NewWordCount ? OldWordCount : NewWordCount;
+    size_t const WordCount = OldWordCount > NewWordCount ? OldWordCount : NewWordCount;
+    
+    u32 const *OldWords = reinterpret_cast<u32 const *>(Old);
+    u32 const *NewWords = reinterpret_cast<u32 const *>(New);
+    
+    u8 *At = Output;
+    size_t Index = 0;
+    
+    while (Index < WordCount)
+    {
+        //
+        // Zero run, most of a snapshot is unchanged so it is skipped 8 bytes at a time
+        size_t First = Index;
+        
+        while (Index + 2 <= CommonWordCount)
+        {
+            u64 A;
+            u64 B;
+            memcpy(&A, OldWords + Index, sizeof(A));
+            memcpy(&B, NewWords + Index, sizeof(B));
+            
+            if (A != B)
+            {
+                break;
+            }
+            
+            Index += 2;
+        }
+        
+        while ((Index < WordCount) && (GetDeltaWord(OldWords, OldWordCount, NewWords, NewWordCount, Index) == 0))
+        {
+            ++Index;
+        }
+        
+        // Nothing differs after this, no need for a run at the end
+        if (Index == WordCount)
+        {
+            break;
+        }
+        
+        u32 ZeroCount = static_cast<u32>(Index - First);
+        
+        //
+        // Literal run
+        u8 *Counts = At;
+        At += 2 * sizeof(u32);
+        
+        First = Index;
+        while (Index < CommonWordCount)
+        {
+            u32 Word = OldWords[Index] ^ NewWords[Index];
+            if (Word == 0)
+            {
+                break;
+            }
+            
+            memcpy(At, &Word, sizeof(Word));
+            At += sizeof(Word);
+            ++Index;
+        }
+        
+        while ((Index >= CommonWordCount) && (Index < WordCount))
+        {
+            u32 Word = GetDeltaWord(OldWords, OldWordCount, NewWords, NewWordCount, Index);
+            if (Word == 0)
+            {
+                break;
+            }
+            
+            memcpy(At, &Word, sizeof(Word));
+            At += sizeof(Word);
+            ++Index;
+        }
+        
+        u32 LiteralCount = static_cast<u32>(Index - First);
+        
+        memcpy(Counts, &ZeroCount, sizeof(ZeroCount));
+        memcpy(Counts + sizeof(ZeroCount), &LiteralCount, sizeof(LiteralCount));
+    }
+    
+    size_t Result = static_cast<size_t>(At - Output);
+    return Result;
+}
+
+
+// XOR is its own inverse, so the same delta goes both ways
+void ApplyDelta(u8 *Snapshot, u8 const *Delta, size_t DeltaSize)
+{
+    u32 *Words = reinterpret_cast<u32 *>(Snapshot);
+    
+    u8 const *At = Delta;
+    u8 const *End = Delta + DeltaSize;
+    size_t Index = 0;
+    
+    while (At < End)
+    {
+        u32 ZeroCount;
+        u32 LiteralCount;
+        memcpy(&ZeroCount, At, sizeof(ZeroCount));
+        memcpy(&LiteralCount, At + sizeof(ZeroCount), sizeof(LiteralCount));
+        At += 2 * sizeof(u32);
+        
+        Index += ZeroCount;
+        
+        for (u32 Literal = 0; Literal < LiteralCount; ++Literal)
+        {
+            u32 Word;
+            memcpy(&Word, At, sizeof(Word));
+            At += sizeof(Word);
+            
+            Words[Index++] ^= Word;
+        }
+    }
+}
+
+
+b32 OverlapsAnyDelta(snapshot_ring *Ring, size_t Offset, size_t Size)
+{
+    for (u32 Index = 0; Index < Ring->DeltaCount; ++Index)
+    {
+        snapshot_delta *Delta = &Ring->Deltas[(Ring->FirstDelta + Index) % Ring->DeltaCapacity];
+        
+        if ((Offset < Delta->Offset + Delta->Size) && (Delta->Offset < Offset + Size))
+        {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+
+void DropOldestDelta(snapshot_ring *Ring)
+{
+    assert(Ring->DeltaCount > 0);
+    
+    Ring->FirstDelta = (Ring->FirstDelta + 1) % Ring->DeltaCapacity;
+    --Ring->DeltaCount;
+}
@@ -0,0 +1,97 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef snapshot_ring__h
+#define snapshot_ring__h
+
+#include "types.h"
+#include "memory_arena.h"
+
+
+
+//
+// A ring buffer of snapshots (any plain data, e.g. from SaveSnapshot()) for rollback. The newest
+// snapshot is kept as it is, the older ones as deltas: each delta is the XOR with the snapshot
+// after it, with the runs of zero words run-length encoded. Going back N snapshots applies N
+// deltas to a copy of the newest. All the memory is allocated up front in one arena, when the
+// deltas don't fit anymore the oldest are dropped.
+//
+// Snapshots must be a multiple of 4 bytes and 4-byte aligned.
+//
+
+struct snapshot_delta
+{
+    size_t Offset = 0;       // Into snapshot_ring::Storage
+    size_t Size = 0;         // Encoded size
+    size_t PreviousSize = 0; // Of the snapshot the delta leads back to
+};
+
+struct snapshot_ring
+{
+    memory_arena Memory;
+    
+    size_t MaxSnapshotSize = 0;
+    
+    u8 *Latest = nullptr; // The bytes after LatestSize are always zero
+    size_t LatestSize = 0;
+    
+    u8 *Scratch = nullptr; // Get() decodes here
+    u8 *Encoded = nullptr; // Push() encodes here before the delta is moved into Storage
+    
+    //
+    // Deltas[FirstDelta] leads back to the oldest snapshot, the last one to the one before Latest
+    snapshot_delta *Deltas = nullptr;
+    u32 DeltaCapacity = 0;
+    u32 FirstDelta = 0;
+    u32 DeltaCount = 0;
+    
+    u8 *Storage = nullptr;
+    size_t StorageSize = 0;
+    size_t Head = 0; // Where the next delta goes, unless it has to wrap around to 0
+};
+
+
+// Keeps at most Capacity snapshots of at most MaxSnapshotSize bytes, StorageSize is the memory
+// for the encoded deltas.
+void Init(snapshot_ring *Ring, u32 Capacity, size_t MaxSnapshotSize, size_t StorageSize);
+void Shutdown(snapshot_ring *Ring);
+void Clear(snapshot_ring *Ring);
+
+// Makes Snapshot the latest. Returns false if the delta to the previous one didn't fit in the
+// storage, the older snapshots are then lost.
+b32 Push(snapshot_ring *Ring, void const *Snapshot, size_t Size);
+
+// The number of snapshots that can be restored, the latest included
+u32 GetCount(snapshot_ring *Ring);
+
+// The snapshot Age steps back, 0 is the latest. Points into the ring and is valid until the next
+// call to Get(), Push() or Rewind().
+void const *Get(snapshot_ring *Ring, u32 Age, size_t *Size);
+
+// Drops the Age newest snapshots, so that the one Age steps back becomes the latest
+b32 Rewind(snapshot_ring *Ring, u32 Age);
+
+
+
+#endif
@@ -0,0 +1,1119 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+//
+// Tests of the dynamics, built and run with the Makefile in this directory (make test), not by
+// build.bat. They are built with DEBUG, so the asserts in the dynamics are on as well.
+//
+
+#include "test.h"
+#include "../dynamics.h"
+#include "../snapshot_ring.h"
+#include "../worker_pool.h"
+#include <math.h>
+#include <string.h>
+
+// Internal to dynamics.cpp
+b32 Intersects(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info); // Closed-form or GJK/EPA
+b32 IntersectsGJK(v2 Pa, shape *A, v2 Pb, shape *B, collision_info *Info);
+
+
+
+//
+// Scenes
+//
+
+// A closed box of static walls with rectangles, circles and triangles bouncing around in it.
+// Nothing is damped and the restitution is 1, so the bodies keep colliding.
+static void AddBox(dynamics_state *State)
+{
+    v2 const kWallSizes[] = { V2(1280.0f, 36.0f), V2(1280.0f, 36.0f), V2(36.0f, 720.0f), V2(36.0f, 720.0f) };
+    v2 const kWallPositions[] = { V2(640.0f, 18.0f), V2(640.0f, 702.0f), V2(18.0f, 360.0f), V2(1262.0f, 360.0f) };
+    for (u32 Index = 0; Index < ArrayCount(kWallSizes); ++Index)
+    {
+        body_handle Wall = NewRectangleBody(State, kWallSizes[Index]);
+        SetP(State, Wall, kWallPositions[Index]);
+        SetType(State, Wall, BodyType_Static);
+    }
+    
+    v2 const Triangle[] = { V2(-12.0f, -10.0f), V2(12.0f, -10.0f), V2(0.0f, 12.0f) };
+    convex_shape const *TriangleShape = NewPolygonShape(State, Triangle, ArrayCount(Triangle));
+    
+    for (u32 Index = 0; Index < 60; ++Index)
+    {
+        body_handle Handle;
+        switch (Index % 3)
+        {
+            case 0: Handle = NewRectangleBody(State, V2(20.0f, 30.0f)); break;
+            case 1: Handle = NewCircleBody(State, 12.0f); break;
+            default: Handle = NewConvexBody(State, TriangleShape); break;
+        }
+        
+        f32 x = 100.0f + 100.0f*static_cast<f32>(Index % 10);
+        f32 y = 100.0f + 90.0f*static_cast<f32>(Index / 10);
+        SetP(State, Handle, V2(x, y));
+        GetBody(State, Handle).dP = V2(250.0f*cosf(static_cast<f32>(Index)), 250.0f*sinf(static_cast<f32>(Index)));
+    }
+}
+
+
+
+//
+// Allocations
+//
+
+// Steps the scene, either with Simulate() or by calling the phases one by one, and returns the
+// number of allocations. The collisions are added to CollisionCount.
+static u64 CountAllocations(dynamics_state *State, u32 StepCount, b32 Phases, u32 *CollisionCount)
+{
+    f32 const dt = 1.0f / 60.0f;
+    std::vector<collision_info>& Collisions = State->Collisions;
+    
+    u64 Result = GetAllocationCount();
+    for (u32 Step = 0; Step < StepCount; ++Step)
+    {
+        if (Phases)
+        {
+            Collisions.clear();
+            Update(State, dt);
+            DetectCollisions(State, Collisions);
+            ResolveCollisions(State, Collisions, dt);
+        }
+        else
+        {
+            Simulate(State, dt);
+        }
+        
+        *CollisionCount += static_cast<u32>(Collisions.size());
+    }
+    Result = GetAllocationCount() - Result;
+    
+    return Result;
+}
+
+// A step doesn't touch the heap once the arrays have grown to fit, the narrowphase included: GJK
+// and EPA keep their polytope on the stack. The steps are run once for the arrays to grow to
+// their high-water mark and then replayed from a snapshot, the replay must not allocate.
+static void TestNoAllocationsPerStep()
+{
+    dynamics_state State;
+    Init(&State);
+    AddBox(&State);
+    
+    u32 const kStepCount = 600;
+    for (b32 Phases = 0; Phases < 2; ++Phases)
+    {
+        std::vector<u8> Snapshot(GetSnapshotSize(&State));
+        Check(SaveSnapshot(&State, Snapshot.data(), Snapshot.size()) != 0);
+        
+        u32 CollisionCount = 0;
+        CountAllocations(&State, kStepCount, Phases, &CollisionCount);
+        u64 Expected = Checksum(&State);
+        Check(CollisionCount > 0);
+        
+        Check(RestoreSnapshot(&State, Snapshot.data(), Snapshot.size()));
+        Check(CountAllocations(&State, kStepCount, Phases, &CollisionCount) == 0);
+        Check(Checksum(&State) == Expected);
+    }
+    
+    Shutdown(&State);
+}
+
+
+
+//
+// Handles
+//
+
+static contact_event const *FindEvent(dynamics_state *State, contact_event_type Type, body_handle Handle)
+{
+    for (contact_event const& Event : State->ContactEvents.Events)
+    {
+        if ((Event.Type == Type) && ((Event.Handles[0] == Handle) || (Event.Handles[1] == Handle)))
+        {
+            return &Event;
+        }
+    }
+    
+    return nullptr;
+}
+
+// A destroyed body's handle is no longer valid, and the body that reuses its slot gets a new
+// generation. The new body is a new pair for the contact cache, the warm starting impulses and
+// the contact events, even when it takes the place of the old one.
+static void TestDestroyedBodyHandles()
+{
+    dynamics_state State;
+    Init(&State);
+    
+    // Polygons, so that the pairs go through the contact cache
+    v2 const Square[] = { V2(-10.0f, -10.0f), V2(10.0f, -10.0f), V2(10.0f, 10.0f), V2(-10.0f, 10.0f) };
+    convex_shape const *SquareShape = NewPolygonShape(&State, Square, ArrayCount(Square));
+    
+    body_handle Floor = NewConvexBody(&State, SquareShape);
+    SetType(&State, Floor, BodyType_Static);
+    
+    body_handle Old = NewConvexBody(&State, SquareShape);
+    SetP(&State, Old, V2(0.0f, 19.0f));
+    
+    body_handle Last = NewCircleBody(&State, 5.0f);
+    SetP(&State, Last, V2(100.0f, 0.0f));
+    
+    Simulate(&State, State.Timestep.StepTime);
+    Simulate(&State, State.Timestep.StepTime);
+    Check(FindEvent(&State, ContactEvent_Stay, Old) != nullptr);
+    Check(State.Stats.ContactCache.HitCount == 1);
+    
+    // The last body is moved into the place of the destroyed one, its handle still finds it
+    DestroyBody(&State, Old);
+    Check(!IsValid(&State, Old));
+    Check(IsValid(&State, Floor) && IsValid(&State, Last));
+    Check(GetBody(&State, Last).P.x == 100.0f);
+    
+    body_handle New = NewConvexBody(&State, SquareShape);
+    SetP(&State, New, V2(0.0f, 19.0f));
+    Check(New.Slot == Old.Slot);
+    Check(New.Generation != Old.Generation);
+    Check(!IsValid(&State, Old) && IsValid(&State, New));
+    
+    Simulate(&State, State.Timestep.StepTime);
+    Check(State.Stats.ContactCache.LookupCount == 1);
+    Check(State.Stats.ContactCache.HitCount == 0);
+    Check(FindEvent(&State, ContactEvent_End, Old) != nullptr);
+    Check(FindEvent(&State, ContactEvent_Begin, New) != nullptr);
+    Check(FindEvent(&State, ContactEvent_Stay, New) == nullptr);
+    
+    Shutdown(&State);
+}
+
+
+
+//
+// GJK/EPA
+//
+
+// EPA adds a vertex per iteration and keeps going on curved shapes, with the centres of two
+// circles on top of each other, or close to it, it runs until the polytope is full. It must stop
+// there (the asserts in Insert() catch an overflow) and still give a depth within 1%.
+static void TestEPAIterationCap()
+{
+    shape A;
+    A.Type = ShapeType_Circle;
+    A.Radius = 10.0f;
+    
+    shape B;
+    B.Type = ShapeType_Circle;
+    B.Radius = 7.0f;
+    
+    u64 AllocationCount = GetAllocationCount();
+    
+    collision_info Info;
+    Check(IntersectsGJK(v2_zero, &A, v2_zero, &B, &Info));
+    Check(fabsf(Info.Depth - 17.0f) < 0.01f*17.0f);
+    Check(fabsf(Length(Info.N) - 1.0f) < 0.001f);
+    
+    for (u32 Index = 1; Index < 200; ++Index)
+    {
+        f32 Angle = 0.37f*static_cast<f32>(Index);
+        f32 Distance = 0.08f*static_cast<f32>(Index);
+        v2 Pb = Distance*V2(cosf(Angle), sinf(Angle));
+        
+        Check(IntersectsGJK(v2_zero, &A, Pb, &B, &Info));
+        Check(fabsf(Info.Depth - (17.0f - Distance)) < 0.01f*17.0f);
+        
+        // With the centres close together any normal gives almost the same depth
+        if (Distance > 1.0f)
+        {
+            Check(Dot(Info.N, Pb) > 0.99f*Distance);
+        }
+    }
+    
+    Check(GetAllocationCount() == AllocationCount);
+}
+
+
+
+// Distance from the centre of the circle B to the rectangle or the centre of the circle A, 0 if
+// it is inside the rectangle. The normal of a circle is the direction from that closest point.
+static f32 GetCoreDistance(v2 Pa, shape *A, v2 Pb)
+{
+    v2 Closest = Pa;
+    if (A->Type == ShapeType_Rectangle)
+    {
+        v2 Min = Pa - A->HalfSize;
+        v2 Max = Pa + A->HalfSize;
+        Closest = V2(Clamp(Pb.x, Min.x, Max.x), Clamp(Pb.y, Min.y, Max.y));
+    }
+    
+    f32 Result = Length(Pb - Closest);
+    return Result;
+}
+
+// The closed-form tests of the rectangles and circles against GJK/EPA, which is what they replaced.
+// Rectangles are polygons for EPA as well, so the results are the same. A circle is approximated
+// by the polytope EPA builds, which is capped, so the normal can be a few degrees off. With the
+// centre of the circle close to the other shape the normal is badly conditioned as well, only
+// the depth is compared then.
+static void TestClosedFormMatchesGJK()
+{
+    test_random Random;
+    u32 HitCount = 0;
+    
+    for (u32 Index = 0; Index < 20000; ++Index)
+    {
+        shape Shapes[2];
+        for (shape& Shape : Shapes)
+        {
+            if (NextU32(&Random) & 1)
+            {
+                Shape.Type = ShapeType_Circle;
+                Shape.Radius = RandomBetween(&Random, 3.0f, 25.0f);
+            }
+            else
+            {
+                Shape.Type = ShapeType_Rectangle;
+                Shape.HalfSize = V2(RandomBetween(&Random, 3.0f, 25.0f), RandomBetween(&Random, 3.0f, 25.0f));
+            }
+        }
+        
+        v2 Pa = V2(RandomBetween(&Random, -100.0f, 100.0f), RandomBetween(&Random, -100.0f, 100.0f));
+        v2 Pb = Pa + V2(RandomBetween(&Random, -50.0f, 50.0f), RandomBetween(&Random, -50.0f, 50.0f));
+        
+        collision_info Expected;
+        collision_info Info;
+        b32 Hit = Intersects(Pa, &Shapes[0], Pb, &Shapes[1], &Info);
+        b32 ExpectedHit = IntersectsGJK(Pa, &Shapes[0], Pb, &Shapes[1], &Expected);
+        
+        // Only shapes that just touch may differ
+        Check((Hit == ExpectedHit) || (Info.Depth < 0.001f && Expected.Depth < 0.001f));
+        if (!Hit || !ExpectedHit)
+        {
+            continue;
+        }
+        ++HitCount;
+        
+        b32 Curved = (Shapes[0].Type == ShapeType_Circle) || (Shapes[1].Type == ShapeType_Circle);
+        if (Curved)
+        {
+            f32 CoreDistance = (Shapes[1].Type == ShapeType_Circle) ? GetCoreDistance(Pa, &Shapes[0], Pb) :
+                                                                      GetCoreDistance(Pb, &Shapes[1], Pa);
+            b32 InsideRectangle = (CoreDistance == 0.0f) && (Shapes[0].Type != Shapes[1].Type);
+            b32 WellConditioned = (CoreDistance >= 2.0f) || InsideRectangle;
+            
+            Check(fabsf(Info.Depth - Expected.Depth) <= 0.01f*Expected.Depth + 0.001f);
+            Check(!WellConditioned || (Length(Info.N - Expected.N) < 0.1f));
+        }
+        else
+        {
+            Check(fabsf(Info.Depth - Expected.Depth) <= 0.001f*Expected.Depth + 0.001f);
+            Check(Length(Info.N - Expected.N) < 0.001f);
+        }
+    }
+    
+    Check(HitCount > 1000);
+}
+
+
+
+//
+// Solver
+//
+
+f32 constexpr kGravity = 600.0f;
+
+struct gravity_bodies
+{
+    body_handle const *Handles;
+    u32 Count;
+};
+
+static void ApplyGravity(dynamics_state *State, f32 dt, void *Data)
+{
+    gravity_bodies *Bodies = static_cast<gravity_bodies *>(Data);
+    for (u32 Index = 0; Index < Bodies->Count; ++Index)
+    {
+        GetBody(State, Bodies->Handles[Index]).F.y -= kGravity;
+    }
+}
+
+// A static floor with its top at y = 0
+static body_handle AddFloor(dynamics_state *State, f32 Restitution, f32 Friction)
+{
+    body_handle Floor = NewRectangleBody(State, V2(2000.0f, 20.0f));
+    SetP(State, Floor, V2(0.0f, -10.0f));
+    SetType(State, Floor, BodyType_Static);
+    GetBody(State, Floor).Restitution = Restitution;
+    GetBody(State, Floor).Friction = Friction;
+    return Floor;
+}
+
+// A ball dropped on the floor leaves it with the speed it hit it with for restitution 1, and
+// stays on it for restitution 0
+static void TestRestitution()
+{
+    f32 const kSpeed = 300.0f;
+    f32 const kRadius = 10.0f;
+    
+    for (u32 Restitution = 0; Restitution <= 1; ++Restitution)
+    {
+        dynamics_state State;
+        Init(&State);
+        AddFloor(&State, static_cast<f32>(Restitution), 0.0f);
+        
+        body_handle Ball = NewCircleBody(&State, kRadius);
+        SetP(&State, Ball, V2(0.0f, 50.0f));
+        body BallBody = GetBody(&State, Ball);
+        BallBody.Restitution = static_cast<f32>(Restitution);
+        BallBody.dP = V2(0.0f, -kSpeed);
+        
+        u32 HitStep = 0;
+        for (u32 Step = 1; (Step < 120) && !HitStep; ++Step)
+        {
+            Simulate(&State, State.Timestep.StepTime);
+            HitStep = State.Collisions.empty() ? 0 : Step;
+        }
+        Check(HitStep > 0);
+        
+        if (Restitution)
+        {
+            Check(fabsf(BallBody.dP.y - kSpeed) < 0.01f*kSpeed);
+        }
+        else
+        {
+            Check(fabsf(BallBody.dP.y) < 0.001f);
+        }
+        Check(fabsf(BallBody.dP.x) < 0.001f);
+        
+        for (u32 Step = 0; Step < 60; ++Step)
+        {
+            Simulate(&State, State.Timestep.StepTime);
+        }
+        
+        if (Restitution)
+        {
+            Check(BallBody.P.y > 50.0f);
+        }
+        else
+        {
+            // Resting on the floor, the position pass leaves the depth within the slop
+            Check(BallBody.P.y <= kRadius + 0.001f);
+            Check(BallBody.P.y >= kRadius - State.Solver.Slop - 0.001f);
+        }
+        
+        Shutdown(&State);
+    }
+}
+
+// A box sliding over the floor is stopped by friction, mu g slows it down by 300 per second, and
+// keeps its speed without
+static void TestFriction()
+{
+    for (u32 Friction = 0; Friction <= 1; ++Friction)
+    {
+        dynamics_state State;
+        Init(&State);
+        AddFloor(&State, 0.0f, 0.5f*static_cast<f32>(Friction));
+        
+        body_handle Box = NewRectangleBody(&State, V2(20.0f, 20.0f));
+        SetP(&State, Box, V2(0.0f, 10.0f));
+        body BoxBody = GetBody(&State, Box);
+        BoxBody.Restitution = 0.0f;
+        BoxBody.Friction = 0.5f*static_cast<f32>(Friction);
+        BoxBody.dP = V2(100.0f, 0.0f);
+        
+        gravity_bodies Gravity = {&Box, 1};
+        for (u32 Step = 0; Step < 10; ++Step)
+        {
+            Simulate(&State, State.Timestep.StepTime, ApplyGravity, nullptr, &Gravity);
+        }
+        
+        if (Friction)
+        {
+            // 10 steps of 1/60 s at 300 per second
+            Check(fabsf(BoxBody.dP.x - 50.0f) < 2.0f);
+            
+            for (u32 Step = 0; Step < 20; ++Step)
+            {
+                Simulate(&State, State.Timestep.StepTime, ApplyGravity, nullptr, &Gravity);
+            }
+            Check(fabsf(BoxBody.dP.x) < 0.001f);
+        }
+        else
+        {
+            Check(BoxBody.dP.x == 100.0f);
+        }
+        
+        Shutdown(&State);
+    }
+}
+
+// The deepest contact between the floor and the boxes of the stack, and between the boxes
+static f32 GetStackDepth(dynamics_state *State, body_handle const *Boxes, u32 Count, f32 BoxSize)
+{
+    f32 Result = 0.0f;
+    f32 Top = 0.0f;
+    for (u32 Index = 0; Index < Count; ++Index)
+    {
+        f32 Bottom = GetBody(State, Boxes[Index]).P.y - 0.5f*BoxSize;
+        Result = Max(Result, Top - Bottom);
+        Top = Bottom + BoxSize;
+    }
+    return Result;
+}
+
+// Boxes stacked on the floor under gravity. Every step the integration sinks them by g dt^2
+// before the contacts are found, and the position pass only corrects what is beyond the slop, so
+// the depth can't stay under the slop itself. A single box stays within twice the slop, and with
+// the default two position passes a stack of N boxes within the slop plus what it sinks in one
+// step times N. The stack stops sinking, stays upright, and the warm starting impulse kept for the
+// floor holds up its whole weight.
+static void TestRestingStack()
+{
+    f32 const kBoxSize = 20.0f;
+    u32 const kMaxBoxCount = 5;
+    
+    for (u32 BoxCount = 1; BoxCount <= kMaxBoxCount; ++BoxCount)
+    {
+        dynamics_state State;
+        Init(&State);
+        f32 const dt = State.Timestep.StepTime;
+        AddFloor(&State, 0.0f, 0.5f);
+        
+        body_handle Boxes[kMaxBoxCount];
+        for (u32 Index = 0; Index < BoxCount; ++Index)
+        {
+            Boxes[Index] = NewRectangleBody(&State, V2(kBoxSize, kBoxSize));
+            SetP(&State, Boxes[Index], V2(0.0f, (0.5f + static_cast<f32>(Index))*kBoxSize + 0.5f*static_cast<f32>(Index)));
+            GetBody(&State, Boxes[Index]).Restitution = 0.0f;
+            GetBody(&State, Boxes[Index]).Friction = 0.5f;
+        }
+        
+        gravity_bodies Gravity = {Boxes, BoxCount};
+        for (u32 Step = 0; Step < 300; ++Step)
+        {
+            Simulate(&State, dt, ApplyGravity, nullptr, &Gravity);
+        }
+        f32 SettledTop = GetBody(&State, Boxes[BoxCount - 1]).P.y;
+        
+        f32 const Sink = kGravity*dt*dt;
+        f32 const MaxDepth = (BoxCount == 1) ? 2.0f*State.Solver.Slop : State.Solver.Slop + static_cast<f32>(BoxCount)*Sink;
+        f32 LargestDepth = 0.0f;
+        for (u32 Step = 0; Step < 300; ++Step)
+        {
+            Simulate(&State, dt, ApplyGravity, nullptr, &Gravity);
+            LargestDepth = Max(LargestDepth, GetStackDepth(&State, Boxes, BoxCount, kBoxSize));
+        }
+        Check(LargestDepth <= MaxDepth);
+        
+        body Top = GetBody(&State, Boxes[BoxCount - 1]);
+        Check(fabsf(Top.P.y - SettledTop) < 0.01f);
+        Check(Top.P.y > (static_cast<f32>(BoxCount) - 0.5f)*kBoxSize - static_cast<f32>(BoxCount)*MaxDepth);
+        Check(fabsf(Top.P.x) < 0.001f);
+        
+        // One impulse per contact, the one of the floor is the weight of the stack for a step
+        Check(State.Solver.Impulses.size() == BoxCount);
+        f32 FloorImpulse = 0.0f;
+        for (contact_impulse const& Impulse : State.Solver.Impulses)
+        {
+            FloorImpulse = Max(FloorImpulse, Impulse.NormalImpulse);
+        }
+        f32 Weight = static_cast<f32>(BoxCount)*kGravity*dt;
+        Check(fabsf(FloorImpulse - Weight) < 0.05f*Weight);
+        
+        Shutdown(&State);
+    }
+}
+
+
+
+//
+// Continuous collision detection
+//
+
+// A ball that moves ten times its radius per step at a wall a fifth of that thick. The discrete
+// test never sees them overlap and the ball ends up on the other side, the swept test catches it
+// and the ball bounces back. Both for the wall coming from either side of the ball.
+static void TestContinuousNoTunnelling()
+{
+    f32 const kRadius = 5.0f;
+    f32 const kSpeed = 3000.0f; // 50 per step
+    f32 const kWallThickness = 10.0f;
+    
+    for (u32 Continuous = 0; Continuous <= 1; ++Continuous)
+    {
+        for (s32 Direction = -1; Direction <= 1; Direction += 2)
+        {
+            dynamics_state State;
+            Init(&State);
+            
+            body_handle Wall = NewRectangleBody(&State, V2(kWallThickness, 200.0f));
+            SetP(&State, Wall, v2_zero);
+            SetType(&State, Wall, BodyType_Static);
+            
+            body_handle Ball = NewCircleBody(&State, kRadius);
+            f32 Side = -static_cast<f32>(Direction);
+            SetP(&State, Ball, V2(Side*(30.0f + 0.5f*kWallThickness), 3.0f));
+            body BallBody = GetBody(&State, Ball);
+            BallBody.dP = V2(static_cast<f32>(Direction)*kSpeed, 0.0f);
+            if (Continuous)
+            {
+                BallBody.Flags |= BodyFlag_Continuous;
+            }
+            
+            u32 CollisionCount = 0;
+            for (u32 Step = 0; Step < 10; ++Step)
+            {
+                Simulate(&State, State.Timestep.StepTime);
+                CollisionCount += static_cast<u32>(State.Collisions.size());
+            }
+            
+            // Restitution 1, it leaves the way it came at the speed it came with
+            b32 OnItsSide = (BallBody.P.x * Side) > 0.0f;
+            if (Continuous)
+            {
+                Check(OnItsSide);
+                Check(CollisionCount == 1);
+                Check(fabsf(BallBody.dP.x + static_cast<f32>(Direction)*kSpeed) < 0.01f*kSpeed);
+            }
+            else
+            {
+                Check(!OnItsSide);
+                Check(CollisionCount == 0);
+            }
+            
+            Shutdown(&State);
+        }
+    }
+}
+
+
+
+//
+// Integration kernels
+//
+
+// The SIMD kernels do the operations in the same order as the scalar one, so they agree to the
+// bit. A compiler that contracts a multiply and add into an FMA in one of them shows up here.
+u32 constexpr kMaxIntegrationUlps = 0;
+
+static u32 GetUlpDifference(f32 a, f32 b)
+{
+    s32 x;
+    s32 y;
+    memcpy(&x, &a, sizeof(x));
+    memcpy(&y, &b, sizeof(y));
+    
+    // Maps the sign and magnitude onto one line of integers, -0 and +0 both become 0
+    s64 X = (x < 0) ? (s64(INT32_MIN) - x) : x;
+    s64 Y = (y < 0) ? (s64(INT32_MIN) - y) : y;
+    
+    u32 Result = static_cast<u32>((X > Y) ? (X - Y) : (Y - X));
+    return Result;
+}
+
+static u32 GetUlpDifference(std::vector<v2> const& A, std::vector<v2> const& B)
+{
+    u32 Result = (A.size() == B.size()) ? 0 : u32Max;
+    for (size_t Index = 0; (Index < A.size()) && (Index < B.size()); ++Index)
+    {
+        Result = Max(Result, GetUlpDifference(A[Index].x, B[Index].x));
+        Result = Max(Result, GetUlpDifference(A[Index].y, B[Index].y));
+    }
+    return Result;
+}
+
+// The largest difference of what the integration writes
+static u32 GetUlpDifference(body_arrays const *A, body_arrays const *B)
+{
+    u32 Result = GetUlpDifference(A->P, B->P);
+    Result = Max(Result, GetUlpDifference(A->PrevP, B->PrevP));
+    Result = Max(Result, GetUlpDifference(A->dP, B->dP));
+    Result = Max(Result, GetUlpDifference(A->F, B->F));
+    return Result;
+}
+
+// Count bodies with everything that the integration reads set at random, including immovable
+// bodies, masked axes and speed limits
+static void AddRandomBodies(dynamics_state *State, u32 Count, u32 Seed)
+{
+    test_random Random;
+    Random.State = Seed;
+    
+    for (u32 Index = 0; Index < Count; ++Index)
+    {
+        body_handle Handle = (Index & 1) ? NewCircleBody(State, RandomBetween(&Random, 1.0f, 10.0f)) :
+                                           NewRectangleBody(State, V2(RandomBetween(&Random, 1.0f, 10.0f), RandomBetween(&Random, 1.0f, 10.0f)));
+        SetP(State, Handle, V2(RandomBetween(&Random, -1000.0f, 1000.0f), RandomBetween(&Random, -1000.0f, 1000.0f)));
+        
+        body Body = GetBody(State, Handle);
+        Body.dP = V2(RandomBetween(&Random, -2000.0f, 2000.0f), RandomBetween(&Random, -2000.0f, 2000.0f));
+        Body.F = V2(RandomBetween(&Random, -30000.0f, 30000.0f), RandomBetween(&Random, -30000.0f, 30000.0f));
+        Body.Damping = RandomBetween(&Random, 0.0f, 1.0f);
+        Body.InverseMass = (Index % 7 == 0) ? 0.0f : RandomBetween(&Random, 0.0f, 2.0f);
+        Body.dPMask = (Index % 5 == 0) ? V2(0.0f, 1.0f) : ((Index % 11 == 0) ? v2_zero : V2(1.0f, 1.0f));
+        Body.dPMax = (Index % 3 == 0) ? V2(1500.0f, 1500.0f) : V2(f32Max, f32Max);
+    }
+}
+
+// Each kernel the CPU supports against the scalar one, on random bodies and random ranges of
+// them so that the tails that don't fill a register are covered. Then the same through Update()
+// with State->Integrate forced to each kernel in turn.
+static void TestIntegrationKernelsMatchScalar()
+{
+    f32 const dt = 1.0f / 60.0f;
+    simd_level Supported = GetSupportedSimdLevel();
+    test_random Random;
+    
+    for (u32 Level = SimdLevel_Scalar + 1; Level <= static_cast<u32>(Supported); ++Level)
+    {
+        integrate_function *Integrate = GetIntegrateFunction(static_cast<simd_level>(Level));
+        u32 MaxUlps = 0;
+        
+        for (u32 Trial = 0; Trial < 200; ++Trial)
+        {
+            u32 BodyCount = 1 + NextU32(&Random) % 300;
+            u32 First = NextU32(&Random) % BodyCount;
+            u32 Count = NextU32(&Random) % (BodyCount - First + 1);
+            u32 Seed = NextU32(&Random) | 1;
+            
+            dynamics_state Expected;
+            dynamics_state State;
+            Init(&Expected);
+            Init(&State);
+            AddRandomBodies(&Expected, BodyCount, Seed);
+            AddRandomBodies(&State, BodyCount, Seed);
+            
+            for (u32 Step = 0; Step < 5; ++Step)
+            {
+                IntegrateScalar(&Expected.Bodies, First, Count, dt);
+                Integrate(&State.Bodies, First, Count, dt);
+            }
+            
+            MaxUlps = Max(MaxUlps, GetUlpDifference(&Expected.Bodies, &State.Bodies));
+        }
+        Check(MaxUlps <= kMaxIntegrationUlps);
+        
+        // Through the dispatch in Update()
+        dynamics_state Expected;
+        dynamics_state State;
+        Init(&Expected);
+        Init(&State);
+        Expected.Integrate = IntegrateScalar;
+        State.Integrate = Integrate;
+        AddRandomBodies(&Expected, 1000, 7);
+        AddRandomBodies(&State, 1000, 7);
+        
+        for (u32 Step = 0; Step < 10; ++Step)
+        {
+            Update(&Expected, dt);
+            Update(&State, dt);
+        }
+        Check(GetUlpDifference(&Expected.Bodies, &State.Bodies) <= kMaxIntegrationUlps);
+    }
+    
+    // Nothing to compare against without SIMD, but the scalar kernel is still what Init() picks
+    dynamics_state State;
+    Init(&State);
+    Check((Supported != SimdLevel_Scalar) || (State.Integrate == IntegrateScalar));
+}
+
+// The fixed point kernel can't match to the bit, each product is truncated to 2^-16 and so are the
+// dampings and the inverse masses. With the velocities of up to about 3000 and forces of up to
+// 30000 of AddRandomBodies() that is a few hundredths per step, a bit over 2^-14 of the velocity.
+f32 constexpr kMaxFixedIntegrationError = 0.5f;
+
+static f32 GetLargestDifference(std::vector<v2> const& A, std::vector<v2> const& B)
+{
+    f32 Result = (A.size() == B.size()) ? 0.0f : f32Max;
+    for (size_t Index = 0; (Index < A.size()) && (Index < B.size()); ++Index)
+    {
+        Result = Max(Result, Abs(A[Index].x - B[Index].x));
+        Result = Max(Result, Abs(A[Index].y - B[Index].y));
+    }
+    return Result;
+}
+
+static f32 GetLargestDifference(body_arrays const *A, body_arrays const *B)
+{
+    f32 Result = GetLargestDifference(A->P, B->P);
+    Result = Max(Result, GetLargestDifference(A->PrevP, B->PrevP));
+    Result = Max(Result, GetLargestDifference(A->dP, B->dP));
+    Result = Max(Result, GetLargestDifference(A->F, B->F));
+    return Result;
+}
+
+// IntegrateFixed, the DYNAMICS_FIXED_POINT experiment, against the scalar kernel on the same
+// random bodies, directly and through Update(). dt is 1/60 quantized to 2^-16 like the fixed
+// kernel does, the error of that alone would grow with the speed of the bodies.
+static void TestFixedIntegrationCloseToScalar()
+{
+    f32 const dt = ToF32(Fixed(1.0f / 60.0f));
+    test_random Random;
+    f32 LargestDifference = 0.0f;
+    
+    for (u32 Trial = 0; Trial < 200; ++Trial)
+    {
+        u32 BodyCount = 1 + NextU32(&Random) % 300;
+        u32 Seed = NextU32(&Random) | 1;
+        
+        dynamics_state Expected;
+        dynamics_state State;
+        Init(&Expected);
+        Init(&State);
+        AddRandomBodies(&Expected, BodyCount, Seed);
+        AddRandomBodies(&State, BodyCount, Seed);
+        
+        for (u32 Step = 0; Step < 5; ++Step)
+        {
+            IntegrateScalar(&Expected.Bodies, 0, BodyCount, dt);
+            IntegrateFixed(&State.Bodies, 0, BodyCount, dt);
+        }
+        
+        LargestDifference = Max(LargestDifference, GetLargestDifference(&Expected.Bodies, &State.Bodies));
+    }
+    Check(LargestDifference <= kMaxFixedIntegrationError);
+    
+    dynamics_state Expected;
+    dynamics_state State;
+    Init(&Expected);
+    Init(&State);
+    Expected.Integrate = IntegrateScalar;
+    State.Integrate = IntegrateFixed;
+    AddRandomBodies(&Expected, 1000, 7);
+    AddRandomBodies(&State, 1000, 7);
+    
+    for (u32 Step = 0; Step < 10; ++Step)
+    {
+        Update(&Expected, dt);
+        Update(&State, dt);
+    }
+    Check(GetLargestDifference(&Expected.Bodies, &State.Bodies) <= kMaxFixedIntegrationError);
+}
+
+
+
+//
+// Threads
+//
+
+// A box packed with small bodies, enough of them that the integration, the sweep, the narrowphase
+// and the contact batches are all split into more than one chunk
+static void AddCrowd(dynamics_state *State, u32 Count, u32 Seed)
+{
+    test_random Random;
+    Random.State = Seed;
+    
+    AddBox(State);
+    
+    u32 const kColumnCount = 80;
+    for (u32 Index = 0; Index < Count; ++Index)
+    {
+        body_handle Handle = (Index & 1) ? NewCircleBody(State, 4.0f) : NewRectangleBody(State, V2(7.0f, 7.0f));
+        
+        f32 x = 50.0f + 14.5f*static_cast<f32>(Index % kColumnCount);
+        f32 y = 50.0f + 10.5f*static_cast<f32>(Index / kColumnCount);
+        SetP(State, Handle, V2(x, y));
+        GetBody(State, Handle).dP = V2(RandomBetween(&Random, -200.0f, 200.0f), RandomBetween(&Random, -200.0f, 200.0f));
+    }
+}
+
+// The work is split into chunks of a fixed size whatever the number of threads, so the same
+// scene stepped with 0, 1, 2 and 7 workers must have the same checksum after every step
+static void TestSameChecksumForAnyWorkerCount()
+{
+    u32 const kWorkerCounts[] = { 0, 1, 2, 7 };
+    u32 const kBodyCount = 4400;
+    u32 const kStepCount = 40;
+    
+    u64 Expected[kStepCount] = {};
+    u32 LargestCollisionCount = 0;
+    
+    for (u32 Run = 0; Run < ArrayCount(kWorkerCounts); ++Run)
+    {
+        worker_pool Workers;
+        Init(&Workers, kWorkerCounts[Run]);
+        
+        dynamics_state State;
+        Init(&State);
+        State.Workers = &Workers;
+        AddCrowd(&State, kBodyCount, 17);
+        
+        for (u32 Step = 0; Step < kStepCount; ++Step)
+        {
+            Check(Simulate(&State, State.Timestep.StepTime) == 1);
+            LargestCollisionCount = Max(LargestCollisionCount, static_cast<u32>(State.Collisions.size()));
+            
+            u64 Hash = Checksum(&State);
+            if (Run == 0)
+            {
+                Expected[Step] = Hash;
+            }
+            Check(Hash == Expected[Step]);
+        }
+        
+        Shutdown(&State);
+        Shutdown(&Workers);
+    }
+    
+    // More than one chunk in every parallel phase
+    Check(kBodyCount > 4096);
+    Check(LargestCollisionCount > 256);
+}
+
+
+
+//
+// Snapshots
+//
+
+// Random pushes and rewinds of snapshots of random sizes, checked against a plain copy of each
+// snapshot after every operation. The small storage makes the ring drop the oldest deltas and
+// wrap around often.
+static void TestSnapshotRingRoundTrip()
+{
+    test_random Random;
+    
+    for (u32 Trial = 0; Trial < 200; ++Trial)
+    {
+        u32 Capacity = 1 + NextU32(&Random) % 8;
+        size_t MaxWordCount = 1 + NextU32(&Random) % 64;
+        size_t StorageSize = (NextU32(&Random) & 1) ? 64 : 4096;
+        
+        snapshot_ring Ring;
+        Init(&Ring, Capacity, MaxWordCount*sizeof(u32), StorageSize);
+        
+        std::vector<std::vector<u32>> History; // The oldest first
+        std::vector<u32> Snapshot(MaxWordCount);
+        
+        for (u32 Step = 0; Step < 300; ++Step)
+        {
+            if (NextU32(&Random) % 10 < 8)
+            {
+                // A new snapshot that differs from the last one in about a quarter of the words
+                Snapshot.resize(1 + NextU32(&Random) % MaxWordCount);
+                for (u32& Word : Snapshot)
+                {
+                    if (NextU32(&Random) % 4 == 0)
+                    {
+                        Word = NextU32(&Random);
+                    }
+                }
+                
+                if (!Push(&Ring, Snapshot.data(), Snapshot.size()*sizeof(u32)))
+                {
+                    History.clear();
+                }
+                History.push_back(Snapshot);
+            }
+            else if (GetCount(&Ring) > 1)
+            {
+                u32 Age = NextU32(&Random) % GetCount(&Ring);
+                Check(Rewind(&Ring, Age));
+                History.resize(History.size() - Age);
+                Snapshot = History.back();
+            }
+            
+            u32 Count = GetCount(&Ring);
+            Check((Count >= (History.empty() ? 0u : 1u)) && (Count <= Capacity) && (Count <= History.size()));
+            for (u32 Age = 0; (Age < Count) && (Age < History.size()); ++Age)
+            {
+                std::vector<u32> const& Expected = History[History.size() - 1 - Age];
+                
+                size_t Size = 0;
+                void const *Restored = Get(&Ring, Age, &Size);
+                Check((Size == Expected.size()*sizeof(u32)) && (memcmp(Restored, Expected.data(), Size) == 0));
+            }
+        }
+        
+        Shutdown(&Ring);
+    }
+}
+
+// Snapshots of a running simulation through the ring: restoring the one N steps back and
+// stepping again gives the same checksums as the first time
+static void TestSnapshotRingRollback()
+{
+    dynamics_state State;
+    Init(&State);
+    AddBox(&State);
+    
+    u32 const kCapacity = 16;
+    u32 const kStepCount = 100;
+    f32 const dt = 1.0f / 60.0f;
+    
+    snapshot_ring Ring;
+    Init(&Ring, kCapacity, 2*GetSnapshotSize(&State), 1024*1024);
+    
+    std::vector<u8> Snapshot;
+    std::vector<u64> Checksums;
+    for (u32 Step = 0; Step < kStepCount; ++Step)
+    {
+        Snapshot.resize(GetSnapshotSize(&State));
+        Check(SaveSnapshot(&State, Snapshot.data(), Snapshot.size()) == Snapshot.size());
+        Check(Push(&Ring, Snapshot.data(), Snapshot.size()));
+        
+        Simulate(&State, dt);
+        Checksums.push_back(Checksum(&State));
+    }
+    
+    // The latest snapshot is from before the last step. The replay pushes the snapshots again, so
+    // every rewind starts from the end.
+    for (u32 Age = kCapacity - 1; Age > 0; Age /= 2)
+    {
+        Check(Rewind(&Ring, Age));
+        
+        size_t Size = 0;
+        void const *Restored = Get(&Ring, 0, &Size);
+        Check(RestoreSnapshot(&State, Restored, Size));
+        
+        u32 FirstStep = kStepCount - 1 - Age;
+        for (u32 Step = FirstStep; Step < kStepCount; ++Step)
+        {
+            if (Step > FirstStep)
+            {
+                Snapshot.resize(GetSnapshotSize(&State));
+                Check(SaveSnapshot(&State, Snapshot.data(), Snapshot.size()) == Snapshot.size());
+                Check(Push(&Ring, Snapshot.data(), Snapshot.size()));
+            }
+            
+            Simulate(&State, dt);
+            Check(Checksum(&State) == Checksums[Step]);
+        }
+    }
+    
+    Shutdown(&Ring);
+    Shutdown(&State);
+}
+
+// A box falls on the floor and rests on it. Rolling back to before it landed gives the Begin again
+// when it lands the second time, and rolling back while it rests gives Stay, not another Begin.
+static void TestSnapshotKeepsContactEvents()
+{
+    dynamics_state State;
+    Init(&State);
+    f32 const dt = State.Timestep.StepTime;
+    AddFloor(&State, 0.0f, 0.5f);
+    
+    body_handle Box = NewRectangleBody(&State, V2(20.0f, 20.0f));
+    SetP(&State, Box, V2(0.0f, 40.0f));
+    GetBody(&State, Box).Restitution = 0.0f;
+    gravity_bodies Gravity = {&Box, 1};
+    
+    std::vector<u8> Falling(GetSnapshotSize(&State));
+    Check(SaveSnapshot(&State, Falling.data(), Falling.size()) == Falling.size());
+    
+    for (u32 Pass = 0; Pass < 2; ++Pass)
+    {
+        u32 BeginCount = 0;
+        for (u32 Step = 0; Step < 120; ++Step)
+        {
+            Simulate(&State, dt, ApplyGravity, nullptr, &Gravity);
+            BeginCount += FindEvent(&State, ContactEvent_Begin, Box) ? 1 : 0;
+        }
+        Check(BeginCount == 1);
+        Check(FindEvent(&State, ContactEvent_Stay, Box) != nullptr);
+        
+        Check(RestoreSnapshot(&State, Falling.data(), Falling.size()));
+    }
+    
+    for (u32 Step = 0; Step < 120; ++Step)
+    {
+        Simulate(&State, dt, ApplyGravity, nullptr, &Gravity);
+    }
+    
+    std::vector<u8> Resting(GetSnapshotSize(&State));
+    Check(SaveSnapshot(&State, Resting.data(), Resting.size()) == Resting.size());
+    for (u32 Rollback = 0; Rollback < 3; ++Rollback)
+    {
+        Simulate(&State, dt, ApplyGravity, nullptr, &Gravity);
+        Check(FindEvent(&State, ContactEvent_Stay, Box) != nullptr);
+        Check(FindEvent(&State, ContactEvent_Begin, Box) == nullptr);
+        Check(State.ContactEvents.Events.size() == 1);
+        
+        Check(RestoreSnapshot(&State, Resting.data(), Resting.size()));
+    }
+    
+    Shutdown(&State);
+}
+
+
+
+//
+// Queries
+//
+
+// A ray or cast that ends exactly on the surface of a body hits it at t = 1
+static void TestQueryHitAtEnd()
+{
+    dynamics_state State;
+    Init(&State);
+    
+    body_handle Wall = NewRectangleBody(&State, V2(10.0f, 10.0f));
+    SetP(&State, Wall, V2(15.0f, 0.0f));
+    SetType(&State, Wall, BodyType_Static);
+    
+    query_hit Hit;
+    Check(!RayCast(&State, v2_zero, V2(9.0f, 0.0f), &Hit));
+    Check(RayCast(&State, v2_zero, V2(10.0f, 0.0f), &Hit));
+    Check(Hit.Handle == Wall);
+    Check(Hit.t == 1.0f);
+    
+    // The batched ray cast keeps the closest hit the same way
+    ray_query Ray = { v2_zero, V2(10.0f, 0.0f) };
+    RayCast(&State, &Ray, 1, &Hit);
+    Check(Hit.Hit && (Hit.t == 1.0f));
+    
+    shape Circle;
+    Circle.Type = ShapeType_Circle;
+    Circle.Radius = 2.0f;
+    Check(ShapeCast(&State, &Circle, v2_zero, V2(8.0f, 0.0f), &Hit));
+    Check(Hit.Handle == Wall);
+    Check(Hit.t == 1.0f);
+    
+    Shutdown(&State);
+}
+
+
+
+int main()
+{
+    RunTest(TestNoAllocationsPerStep);
+    RunTest(TestDestroyedBodyHandles);
+    RunTest(TestEPAIterationCap);
+    RunTest(TestClosedFormMatchesGJK);
+    RunTest(TestRestitution);
+    RunTest(TestFriction);
+    RunTest(TestRestingStack);
+    RunTest(TestContinuousNoTunnelling);
+    RunTest(TestIntegrationKernelsMatchScalar);
+    RunTest(TestFixedIntegrationCloseToScalar);
+    RunTest(TestSameChecksumForAnyWorkerCount);
+    RunTest(TestSnapshotRingRoundTrip);
+    RunTest(TestSnapshotRingRollback);
+    RunTest(TestSnapshotKeepsContactEvents);
+    RunTest(TestQueryHitAtEnd);
+    
+    return GetTestResult();
+}
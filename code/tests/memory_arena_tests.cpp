@@ -0,0 +1,542 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+//
+// Tests of the memory arenas, built and run with the Makefile in this directory (make test), not
+// by build.bat. They are built with DEBUG, so the asserts in the arenas are on as well.
+//
+
+#include "test.h"
+#include "../memory_arena.h"
+#include <algorithm>
+#include <stdio.h>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+
+//
+// Alignment
+//
+
+struct alignas(64) cache_line
+{
+    u8 Bytes[64];
+};
+
+static b32 IsAligned(void const *Ptr, size_t Alignment)
+{
+    b32 Result = (reinterpret_cast<uintptr_t>(Ptr) & (Alignment - 1)) == 0;
+    return Result;
+}
+
+// Every push is aligned as asked for, the padding counts as used and a push that doesn't fit
+// fails without changing the arena
+static void TestPushAlignment()
+{
+    memory_arena Memory;
+    Check(Init(&Memory, 1 << 16));
+    Check(IsAligned(Memory.Ptr, kMaxArenaAlignment));
+    
+    test_random Random;
+    for (u32 Index = 0; Index < 1000; ++Index)
+    {
+        size_t Alignment = size_t(1) << (NextU32(&Random) % 7);
+        size_t Size = NextU32(&Random) % 37;
+        
+        size_t Used = Memory.Used;
+        u8 *Ptr = PushAligned(&Memory, Size, Alignment);
+        if (!Ptr)
+        {
+            Check(Memory.Used == Used);
+            break;
+        }
+        
+        Check(IsAligned(Ptr, Alignment));
+        Check(Memory.Used == static_cast<size_t>(Ptr - Memory.Ptr) + Size);
+        Check(Memory.Used - Used < Size + Alignment);
+    }
+    
+    Clear(&Memory);
+    Push(&Memory, 3);
+    cache_line *Line = PushStruct<cache_line>(&Memory);
+    Check(IsAligned(Line, 64));
+    Check(Memory.Used == 128);
+    
+    double *Doubles = PushArray<double>(&Memory, 3);
+    Check(IsAligned(Doubles, alignof(double)));
+    
+    u64 FailedPushCount = Memory.Stats.FailedPushCount;
+    size_t Used = Memory.Used;
+    Check(PushArray<cache_line>(&Memory, 100000) == nullptr);
+    Check(Memory.Used == Used);
+    Check(Memory.Stats.FailedPushCount == FailedPushCount + 1);
+    
+    // Resize() moves the memory, but keeps it aligned and keeps what was pushed
+    Line->Bytes[0] = 0xAB;
+    Check(Resize(&Memory, 1 << 17));
+    Check(IsAligned(Memory.Ptr, kMaxArenaAlignment));
+    Check(Memory.Used == Used);
+    Check(Memory.Ptr[64] == 0xAB);
+    
+    Free(&Memory);
+}
+
+
+
+//
+// Virtual memory
+//
+
+// A virtual arena grows in place: pointers from before a Resize() stay valid and keep what was
+// written through them. Shrinking and growing again gives zeroed memory.
+static void TestVirtualGrowthKeepsPointers()
+{
+    memory_arena Memory;
+    Check(InitVirtual(&Memory, size_t(1) << 30, 100));
+    Check(Memory.Size == GetPageSize());
+    
+    u8 *Base = Memory.Ptr;
+    u32 const kArrayCount = 2000;
+    u32 const kArraySize = 1000;
+    static u32 *Arrays[kArrayCount];
+    
+    for (u32 Index = 0; Index < kArrayCount; ++Index)
+    {
+        if (RemainingSize(&Memory) < kArraySize*sizeof(u32))
+        {
+            Check(Resize(&Memory, 2*Memory.Size));
+        }
+        
+        Arrays[Index] = PushArray<u32>(&Memory, kArraySize);
+        Check(Arrays[Index] != nullptr);
+        for (u32 Word = 0; Word < kArraySize; ++Word)
+        {
+            Arrays[Index][Word] = Index;
+        }
+    }
+    Check(Memory.Ptr == Base);
+    Check(Memory.Stats.ResizeCount > 5);
+    
+    u32 LostCount = 0;
+    for (u32 Index = 0; Index < kArrayCount; ++Index)
+    {
+        for (u32 Word = 0; Word < kArraySize; ++Word)
+        {
+            LostCount += (Arrays[Index][Word] != Index) ? 1 : 0;
+        }
+    }
+    Check(LostCount == 0);
+    
+    // Not past what was reserved
+    Check(!Resize(&Memory, size_t(2) << 30));
+    Check(Memory.Ptr == Base);
+    
+    size_t Size = Memory.Size;
+    Check(Resize(&Memory, Size / 2));
+    Check(Memory.Size == Size / 2);
+    Check(Resize(&Memory, Size));
+    Check((Memory.Ptr[Size / 2] == 0) && (Memory.Ptr[Size - 1] == 0));
+    
+    Free(&Memory);
+    Check((Memory.Ptr == nullptr) && (Memory.Reserved == 0));
+}
+
+
+
+//
+// Temporary memory
+//
+
+// Nested scopes each pop what was pushed after they began, the inner one first, and the arena
+// counts the open ones. Clear() is only allowed once they are all closed.
+static void TestTemporaryMemory()
+{
+    memory_arena Memory;
+    Check(Init(&Memory, 1 << 12));
+    
+    Push(&Memory, 100);
+    u64 PushCount = Memory.Stats.PushCount;
+    
+    temporary_memory Outer = BeginTemporaryMemory(&Memory);
+    Check(Memory.TemporaryCount == 1);
+    Check(Outer.Used == 100);
+    u8 *OuterPtr = Push(&Memory, 200);
+    
+    temporary_memory Inner = BeginTemporaryMemory(&Memory);
+    Check(Memory.TemporaryCount == 2);
+    Check(Inner.Used == 300);
+    PushArray<u64>(&Memory, 50);
+    Check(Memory.Used > 300);
+    
+    EndTemporaryMemory(Inner);
+    Check(Memory.TemporaryCount == 1);
+    Check(Memory.Used == 300);
+    
+    // The next push reuses what the inner scope popped
+    Check(Push(&Memory, 1) == Memory.Ptr + 300);
+    
+    EndTemporaryMemory(Outer);
+    Check(Memory.TemporaryCount == 0);
+    Check(Memory.Used == 100);
+    Check(Push(&Memory, 200) == OuterPtr);
+    
+    // The pushes in the scopes still count, and so does the peak
+    Check(Memory.Stats.PushCount == PushCount + 4);
+    Check(Memory.Stats.PeakUsed >= 700);
+    
+    Clear(&Memory);
+    Check((Memory.Used == 0) && (Memory.TemporaryCount == 0));
+    
+    // A scope on an empty arena
+    temporary_memory Empty = BeginTemporaryMemory(&Memory);
+    Push(&Memory, 10);
+    EndTemporaryMemory(Empty);
+    Check(Memory.Used == 0);
+    Clear(&Memory);
+    
+    Free(&Memory);
+}
+
+
+
+//
+// Allocator
+//
+
+// A container on a virtual arena grows the arena, one on a heap arena gets std::bad_alloc when
+// the arena is full, the arena is left as it was
+static void TestArenaAllocator()
+{
+    static_assert(!std::is_convertible<memory_arena *, arena_allocator<u32>>::value, "The constructor is explicit");
+    
+    memory_arena Virtual;
+    Check(InitVirtual(&Virtual, size_t(1) << 26, 1));
+    {
+        std::vector<u32, arena_allocator<u32>> Array{arena_allocator<u32>(&Virtual)};
+        for (u32 Index = 0; Index < 100000; ++Index)
+        {
+            Array.push_back(Index);
+        }
+        Check(Array[99999] == 99999);
+        Check(Virtual.Size > GetPageSize());
+    }
+    Free(&Virtual);
+    
+    memory_arena Heap;
+    Check(Init(&Heap, 1024));
+    b32 Threw = false;
+    try
+    {
+        std::vector<u32, arena_allocator<u32>> Array{arena_allocator<u32>(&Heap)};
+        Array.resize(1000);
+    }
+    catch (std::bad_alloc const&)
+    {
+        Threw = true;
+    }
+    Check(Threw);
+    Check(Heap.Used == 0);
+    Free(&Heap);
+}
+
+
+
+//
+// Stats and report
+//
+
+struct arena_report_line
+{
+    unsigned long long Size;
+    unsigned long long Used;
+    unsigned long long Peak;
+    unsigned long long Reserved;
+    u32 Resizes;
+    unsigned long long Pushes;
+    unsigned long long FailedPushes;
+};
+
+// Parses the line of the arena named Name out of the report, false if there is none
+static b32 FindReportLine(char const *Report, char const *Name, arena_report_line *Line)
+{
+    char Key[64];
+    snprintf(Key, sizeof(Key), "arena=%s ", Name);
+    
+    char const *At = strstr(Report, Key);
+    b32 Result = At && (sscanf(At + strlen(Key), "size=%llu used=%llu peak=%llu reserved=%llu resizes=%u pushes=%llu failed_pushes=%llu",
+                               &Line->Size, &Line->Used, &Line->Peak, &Line->Reserved, &Line->Resizes,
+                               &Line->Pushes, &Line->FailedPushes) == 7);
+    return Result;
+}
+
+// The stats follow the pushes, the failed pushes and the resizes, and the report has them on the
+// line of the arena for as long as it is registered. A buffer that is too small gets as much of
+// the report as fits, and the length of all of it is returned.
+static void TestArenaReport()
+{
+    memory_arena Memory;
+    Check(Init(&Memory, 256));
+    Register(&Memory, "report_test");
+    
+    Push(&Memory, 100);
+    PushAligned(&Memory, 10, 64);
+    Check(Push(&Memory, 200) == nullptr);
+    Check(Resize(&Memory, 512));
+    Push(&Memory, 200);
+    Clear(&Memory);
+    Push(&Memory, 50);
+    
+    Check(Memory.Stats.PushCount == 4);
+    Check(Memory.Stats.FailedPushCount == 1);
+    Check(Memory.Stats.ResizeCount == 1);
+    Check(Memory.Stats.PeakUsed == 128 + 10 + 200);
+    
+    char Report[4096];
+    size_t Length = FormatArenaReport(Report, sizeof(Report));
+    Check(Length == strlen(Report));
+    
+    arena_report_line Line = {};
+    Check(FindReportLine(Report, "report_test", &Line));
+    Check((Line.Size == 512) && (Line.Used == 50) && (Line.Peak == 338) && (Line.Reserved == 0));
+    Check((Line.Resizes == 1) && (Line.Pushes == 4) && (Line.FailedPushes == 1));
+    
+    // Registering again only renames it
+    Register(&Memory, "report_renamed");
+    Check(FormatArenaReport(Report, sizeof(Report)) == Length + strlen("_renamed") - strlen("_test"));
+    Check(!FindReportLine(Report, "report_test", &Line));
+    Check(FindReportLine(Report, "report_renamed", &Line));
+    Length = strlen(Report);
+    
+    // Truncated, but still terminated and with the full length returned
+    char Small[16];
+    Check(FormatArenaReport(Small, sizeof(Small)) == Length);
+    Check(strlen(Small) == sizeof(Small) - 1);
+    Check(strncmp(Small, Report, sizeof(Small) - 1) == 0);
+    Check(FormatArenaReport(nullptr, 0) == Length);
+    
+    // Init() and Free() keep the stats, the report only has registered arenas
+    Free(&Memory);
+    Check(Memory.Stats.PushCount == 4);
+    Unregister(&Memory);
+    FormatArenaReport(Report, sizeof(Report));
+    Check(!FindReportLine(Report, "report_renamed", &Line));
+}
+
+
+
+//
+// Shared arena
+//
+
+struct shared_push
+{
+    u8 *Ptr;
+    size_t Size;
+};
+
+// Threads push at the same time with random sizes and alignments, each fills what it got with its
+// own number. Every push is aligned, in the arena, and nothing overlaps or gets overwritten.
+static void TestSharedArenaPushes()
+{
+    u32 const kThreadCount = 8;
+    u32 const kPushCount = 2000;
+    
+    shared_arena Arena;
+    Check(Init(&Arena, size_t(16) << 20));
+    
+    std::vector<shared_push> Pushes[kThreadCount];
+    u32 MisalignedCount[kThreadCount] = {};
+    
+    std::vector<std::thread> Threads;
+    for (u32 Thread = 0; Thread < kThreadCount; ++Thread)
+    {
+        Threads.emplace_back([&, Thread]()
+        {
+            test_random Random;
+            Random.State = 1 + Thread;
+            
+            for (u32 Index = 0; Index < kPushCount; ++Index)
+            {
+                size_t Alignment = size_t(1) << (NextU32(&Random) % 7);
+                size_t Size = 1 + NextU32(&Random) % 100;
+                
+                u8 *Ptr = PushAtomic(&Arena, Size, Alignment);
+                if (Ptr)
+                {
+                    MisalignedCount[Thread] += IsAligned(Ptr, Alignment) ? 0 : 1;
+                    memset(Ptr, static_cast<int>(Thread + 1), Size);
+                    Pushes[Thread].push_back({Ptr, Size});
+                }
+            }
+        });
+    }
+    for (std::thread& Thread : Threads)
+    {
+        Thread.join();
+    }
+    
+    std::vector<shared_push> All;
+    u32 OverwrittenCount = 0;
+    for (u32 Thread = 0; Thread < kThreadCount; ++Thread)
+    {
+        Check(Pushes[Thread].size() == kPushCount);
+        Check(MisalignedCount[Thread] == 0);
+        
+        for (shared_push const& Push : Pushes[Thread])
+        {
+            for (size_t Byte = 0; Byte < Push.Size; ++Byte)
+            {
+                OverwrittenCount += (Push.Ptr[Byte] != Thread + 1) ? 1 : 0;
+            }
+            All.push_back(Push);
+        }
+    }
+    Check(OverwrittenCount == 0);
+    
+    std::sort(All.begin(), All.end(), [](shared_push const& A, shared_push const& B) { return A.Ptr < B.Ptr; });
+    u32 OverlapCount = 0;
+    for (size_t Index = 1; Index < All.size(); ++Index)
+    {
+        OverlapCount += (All[Index - 1].Ptr + All[Index - 1].Size > All[Index].Ptr) ? 1 : 0;
+    }
+    Check(OverlapCount == 0);
+    Check(All.front().Ptr >= Arena.Memory.Ptr);
+    Check(All.back().Ptr + All.back().Size <= Arena.Memory.Ptr + Arena.Memory.Size);
+    
+    // Alignments over kSharedArenaGranularity are padded within the push
+    Clear(&Arena);
+    PushAtomic(&Arena, 1);
+    u8 *Line = PushAtomic(&Arena, 64, 64);
+    Check(IsAligned(Line, 64));
+    Check(Arena.Used == kSharedArenaGranularity + 64 + 64 - kSharedArenaGranularity);
+    
+    Free(&Arena);
+}
+
+// The pushes that don't fit are counted, and Clear() folds the count and the peak into the stats
+// of the arena before it starts over. Free() resets the counts.
+static void TestSharedArenaStats()
+{
+    shared_arena Arena;
+    Check(Init(&Arena, GetPageSize()));
+    size_t const Size = Arena.Memory.Size;
+    
+    u32 PushedCount = 0;
+    while (PushAtomic(&Arena, 100))
+    {
+        ++PushedCount;
+    }
+    Check(PushedCount == Size / 112);
+    Check(!PushAtomic(&Arena, 16));
+    Check(Arena.FailedPushCount == 2);
+    
+    Clear(&Arena);
+    Check(Arena.Used == 0);
+    Check(Arena.FailedPushCount == 0);
+    Check(Arena.Memory.Stats.FailedPushCount == 2);
+    Check(Arena.Memory.Stats.PeakUsed == Size);
+    
+    // Usable again, and the peak stays the highest one
+    Check(PushAtomic(&Arena, 100) == Arena.Memory.Ptr);
+    Clear(&Arena);
+    Check(Arena.Memory.Stats.PeakUsed == Size);
+    Check(Arena.Memory.Stats.FailedPushCount == 2);
+    
+    Check(!PushAtomic(&Arena, 2*Size));
+    Free(&Arena);
+    Check((Arena.Used == 0) && (Arena.FailedPushCount == 0));
+    Check(Arena.Memory.Ptr == nullptr);
+}
+
+
+
+//
+// Thread arenas
+//
+
+// Each thread gets an arena of its own, it keeps what was pushed until the next frame and is
+// cleared the first time it is asked for in the new frame. It grows in place to fit what is asked
+// for, up to the reservation.
+static void TestThreadArenas()
+{
+    memory_arena *Arena = GetThreadArena();
+    Check(Arena != nullptr);
+    Check(Arena->Reserved == kThreadArenaReservedSize);
+    
+    u8 *Ptr = Push(Arena, 100);
+    Check(Ptr != nullptr);
+    Ptr[0] = 0xCD;
+    Check(GetThreadArena() == Arena);
+    Check(Arena->Used == 100);
+    
+    // Grows without moving what is already pushed
+    size_t const kLarge = size_t(1) << 20;
+    Check(GetThreadArena(kLarge) == Arena);
+    Check(RemainingSize(Arena) >= kLarge);
+    Check(Push(Arena, kLarge) != nullptr);
+    Check(Ptr[0] == 0xCD);
+    
+    // Nothing grows past the reservation
+    GetThreadArena(kThreadArenaReservedSize);
+    Check(Push(Arena, kThreadArenaReservedSize) == nullptr);
+    
+    // Another thread, another arena, even in the same frame
+    memory_arena *Other = nullptr;
+    size_t OtherUsed = 1;
+    std::thread Thread([&]()
+    {
+        Other = GetThreadArena();
+        OtherUsed = Other->Used;
+        Push(Other, 10);
+    });
+    Thread.join();
+    Check((Other != nullptr) && (Other != Arena));
+    Check(OtherUsed == 0);
+    
+    // The new frame clears it when it is asked for
+    BeginArenaFrame();
+    Check(Arena->Used > 0);
+    Check(GetThreadArena() == Arena);
+    Check(Arena->Used == 0);
+    Check(Arena->Stats.PeakUsed > kLarge);
+}
+
+
+
+int main()
+{
+    RunTest(TestPushAlignment);
+    RunTest(TestVirtualGrowthKeepsPointers);
+    RunTest(TestTemporaryMemory);
+    RunTest(TestArenaAllocator);
+    RunTest(TestArenaReport);
+    RunTest(TestSharedArenaPushes);
+    RunTest(TestSharedArenaStats);
+    RunTest(TestThreadArenas);
+    
+    return GetTestResult();
+}
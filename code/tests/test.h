@@ -0,0 +1,149 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+//
+// Shared by the tests. Each test executable is a single translation unit that includes this
+// file once, it replaces the global operator new so that the tests can count allocations.
+// A failed Check() prints where it failed and the executable returns non-zero, the tests after
+// it still run.
+//
+
+#ifndef test__h
+#define test__h
+
+#include "../types.h"
+#include <atomic>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+//
+// Allocation counting
+//
+
+static std::atomic<u64> GAllocationCount(0);
+
+void *operator new(size_t Size)
+{
+    GAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    
+    void *Result = malloc(Size ? Size : 1);
+    if (!Result)
+    {
+        throw std::bad_alloc();
+    }
+    return Result;
+}
+
+void operator delete(void *Memory) noexcept
+{
+    free(Memory);
+}
+
+void operator delete(void *Memory, size_t) noexcept
+{
+    free(Memory);
+}
+
+inline u64 GetAllocationCount()
+{
+    u64 Result = GAllocationCount.load(std::memory_order_relaxed);
+    return Result;
+}
+
+
+
+//
+// Checks
+//
+
+static u32 GCheckCount = 0;
+static u32 GFailureCount = 0;
+
+#define Check(Expression) CheckImpl((Expression) ? true : false, #Expression, __FILE__, __LINE__)
+
+inline void CheckImpl(bool Passed, char const *Expression, char const *File, int Line)
+{
+    ++GCheckCount;
+    if (!Passed)
+    {
+        ++GFailureCount;
+        fprintf(stderr, "%s(%d): check failed: %s\n", File, Line, Expression);
+    }
+}
+
+typedef void test_function();
+
+inline void RunTestImpl(test_function *Test, char const *Name)
+{
+    u32 FailureCount = GFailureCount;
+    Test();
+    printf("%s %s\n", (GFailureCount == FailureCount) ? "passed" : "FAILED", Name);
+    fflush(stdout);
+}
+
+#define RunTest(Test) RunTestImpl(Test, #Test)
+
+// The exit code of main()
+inline int GetTestResult()
+{
+    printf("%u checks, %u failed\n", GCheckCount, GFailureCount);
+    int Result = GFailureCount ? 1 : 0;
+    return Result;
+}
+
+
+
+//
+// Random numbers, the same sequence on every platform so that a failure can be reproduced
+//
+
+struct test_random
+{
+    u32 State = 0x12345678;
+};
+
+inline u32 NextU32(test_random *Random)
+{
+    // xorshift32
+    u32 x = Random->State;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    Random->State = x;
+    return x;
+}
+
+inline f32 RandomBetween(test_random *Random, f32 Min, f32 Max)
+{
+    f32 t = static_cast<f32>(NextU32(Random) >> 8) / static_cast<f32>(1 << 24);
+    f32 Result = Min + t*(Max - Min);
+    return Result;
+}
+
+
+
+#endif
@@ -0,0 +1,210 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "trajectory.h"
+
+#ifdef DEBUG
+#include <assert.h>
+#else
+#define assert(x)
+#endif
+
+
+
+
+//
+// Forward declarations of "private" functions
+//
+
+body_handle CopyBody(dynamics_state *Destination, dynamics_state *Source, body_handle Handle);
+
+
+
+
+//
+// "Public" functions (declared in the header file).
+//
+
+void Init(trajectory_predictor *Predictor, dynamics_state *Source, body_handle Body, body_handle const *Obstacles, u32 ObstacleCount)
+{
+    assert(Predictor);
+    assert(Source);
+    assert(Obstacles || (ObstacleCount == 0));
+    
+    dynamics_state *World = &Predictor->World;
+    Init(World);
+    
+    // A handful of bodies, not worth any threads
+    World->Workers = nullptr;
+    
+    Predictor->Body = CopyBody(World, Source, Body);
+    
+    for (u32 Index = 0; Index < ObstacleCount; ++Index)
+    {
+        assert(GetType(Source, Obstacles[Index]) == BodyType_Static);
+        CopyBody(World, Source, Obstacles[Index]);
+    }
+    
+    Predictor->Valid = false;
+    Predictor->PredictionCount = 0;
+}
+
+
+void Shutdown(trajectory_predictor *Predictor)
+{
+    assert(Predictor);
+    
+    Shutdown(&Predictor->World);
+    Predictor->Valid = false;
+}
+
+
+void Invalidate(trajectory_predictor *Predictor)
+{
+    assert(Predictor);
+    Predictor->Valid = false;
+}
+
+
+trajectory_prediction const *Predict(trajectory_predictor *Predictor, dynamics_state *Source, body_handle Body,
+                                     f32 MinX, f32 MaxX, collisions_function *OnCollisions, void *Data)
+{
+    assert(Predictor);
+    assert(Source);
+    assert(MinX < MaxX);
+    
+    if (Predictor->Valid)
+    {
+        return &Predictor->Prediction;
+    }
+    
+    dynamics_state *World = &Predictor->World;
+    
+    //
+    // Start from the current state of the body, including the force for the coming step
+    {
+        body From = GetBody(Source, Body);
+        body To = GetBody(World, Predictor->Body);
+        
+        SetP(World, Predictor->Body, From.P);
+        To.PrevP = From.PrevP;
+        To.dP = From.dP;
+        To.F = From.F;
+        WakeUp(World, Predictor->Body);
+    }
+    
+    World->Timestep = Source->Timestep;
+    f32 const StepTime = World->Timestep.StepTime;
+    
+    trajectory_prediction Prediction;
+    
+    for (u32 Step = 0; Step < Predictor->MaxStepCount; ++Step)
+    {
+        Update(World, StepTime);
+        
+        World->Collisions.clear();
+        DetectCollisions(World, World->Collisions);
+        
+        if (OnCollisions)
+        {
+            OnCollisions(World, World->Collisions, Data);
+        }
+        
+        ResolveCollisions(World, World->Collisions, StepTime);
+        
+        body Copy = GetBody(World, Predictor->Body);
+        if ((Copy.P.x <= MinX) || (Copy.P.x >= MaxX))
+        {
+            Prediction.Reached = true;
+            Prediction.Side = Copy.P.x <= MinX ? -1 : 1;
+            Prediction.P = Copy.P;
+            Prediction.dP = Copy.dP;
+            Prediction.Time = (Step + 1) * StepTime;
+            break;
+        }
+    }
+    
+    Predictor->Prediction = Prediction;
+    Predictor->Valid = true;
+    ++Predictor->PredictionCount;
+    
+    return &Predictor->Prediction;
+}
+
+
+
+
+//
+// Misc.
+//
+
+body_handle CopyBody(dynamics_state *Destination, dynamics_state *Source, body_handle Handle)
+{
+    body From = GetBody(Source, Handle);
+    
+    body_handle Result;
+    switch (From.Shape.Type)
+    {
+        case ShapeType_Circle:
+        {
+            Result = NewCircleBody(Destination, From.Shape.Radius, From.UserData);
+        } break;
+        
+        case ShapeType_Rectangle:
+        {
+            Result = NewRectangleBody(Destination, 2.0f * From.Shape.HalfSize, From.UserData);
+        } break;
+        
+        // Still owned by Source, which outlives the predictor
+        case ShapeType_Convex:
+        {
+            Result = NewConvexBody(Destination, From.Shape.Convex, From.UserData);
+        } break;
+        
+        default:
+        {
+            assert(0);
+            Result = NewCircleBody(Destination, 1.0f, From.UserData);
+        } break;
+    }
+    
+    SetP(Destination, Result, From.P);
+    
+    body To = GetBody(Destination, Result);
+    To.Shape = From.Shape;
+    To.PrevP = From.PrevP;
+    To.dP = From.dP;
+    To.dPMax = From.dPMax;
+    To.dPMask = From.dPMask;
+    To.Damping = From.Damping;
+    To.InverseMass = From.InverseMass;
+    To.Restitution = From.Restitution;
+    To.Friction = From.Friction;
+    To.Flags = From.Flags & ~BodyFlag_Sleeping;
+    
+    SetType(Destination, Result, GetType(Source, Handle));
+    SetCollisionFilter(Destination, Result, GetCollisionLayer(Source, Handle), GetCollisionMask(Source, Handle));
+    
+    return Result;
+}
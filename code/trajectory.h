@@ -0,0 +1,77 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef trajectory__h
+#define trajectory__h
+
+#include "types.h"
+#include "dynamics.h"
+
+
+
+//
+// Predicts where a body will be by stepping a copy of it, and of the static bodies it can bounce
+// off, in a dynamics_state of its own. The prediction is kept until Invalidate() is called, which
+// should be done whenever something that isn't in the copy changes the velocity of the body.
+//
+
+struct trajectory_prediction
+{
+    b32 Reached = false; // False if the body didn't get to MinX or MaxX within MaxStepCount steps
+    s32 Side = 0;        // -1 if it got to MinX, +1 if it got to MaxX
+    v2 P = v2_zero;      // Where it got there
+    v2 dP = v2_zero;
+    f32 Time = 0.0f;     // From when the prediction was made
+};
+
+
+struct trajectory_predictor
+{
+    dynamics_state World;
+    body_handle Body; // The copy in World
+    
+    u32 MaxStepCount = 600;
+    
+    b32 Valid = false;
+    trajectory_prediction Prediction;
+    
+    u32 PredictionCount = 0; // How many times the body has been stepped forward, for profiling
+};
+
+
+// Copies the shape and the properties of Body and the static Obstacles from Source
+void Init(trajectory_predictor *Predictor, dynamics_state *Source, body_handle Body, body_handle const *Obstacles, u32 ObstacleCount);
+void Shutdown(trajectory_predictor *Predictor);
+
+void Invalidate(trajectory_predictor *Predictor);
+
+// Where the body in Source first gets to x <= MinX or x >= MaxX, stepped with the StepTime of
+// Source. OnCollisions is called with the collisions of each step, as by Simulate(). Only steps
+// the body forward if the last prediction has been invalidated.
+trajectory_prediction const *Predict(trajectory_predictor *Predictor, dynamics_state *Source, body_handle Body,
+                                     f32 MinX, f32 MaxX, collisions_function *OnCollisions = nullptr, void *Data = nullptr);
+
+
+
+#endif
@@ -651,6 +651,7 @@ void ProcessDrawCalls(dx_state *State, draw_calls *DrawCalls)
          )
     {
         draw_call_header *Header = reinterpret_cast<draw_call_header *>(CurrAddress);
+        assert((reinterpret_cast<size_t>(CurrAddress) & (alignof(draw_call_header) - 1)) == 0);
         
         switch (Header->Type)
         {
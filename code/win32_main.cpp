@@ -43,6 +43,7 @@
 
 f32 constexpr kFrameTime = 1.0f / 60.0f;
 f32 constexpr kFrameTimeMicroSeconds = 1000000.0f * kFrameTime;
+f32 constexpr kMaxFrameTime = 0.25f; // Don't try to catch up after a breakpoint or a window drag
 
 
 
@@ -110,7 +111,7 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             LONG_PTR Ptr = GetWindowLongPtr(hWnd, GWLP_USERDATA);
             app_state *State = reinterpret_cast<app_state *>(Ptr);
             
-            ++State->GameState.PressedKeys[(u8)wParam];
+            State->GameState.PressedKeys[(u8)wParam] = 1;
         } break;
         
         case WM_KEYUP: 
@@ -118,10 +119,7 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             LONG_PTR Ptr = GetWindowLongPtr(hWnd, GWLP_USERDATA);
             app_state *State = reinterpret_cast<app_state *>(Ptr);
             
-            if (State->GameState.PressedKeys.count((u8)wParam) > 0)
-            {
-                State->GameState.PressedKeys.erase((u8)wParam);
-            }
+            State->GameState.PressedKeys[(u8)wParam] = 0;
         } break;
         
         case WM_RBUTTONDOWN: 
@@ -350,6 +348,9 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
     RunTime.QuadPart = 0;
     u32 FrameCount = 0;
     
+    // The measured length of the last frame, the physics catches up on it in fixed steps
+    f32 dt = kFrameTime;
+    
     
     
     //
@@ -382,7 +383,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
         
         //
         // Update
-        Update(&AppState.GameState, kFrameTime);
+        Update(&AppState.GameState, dt);
         
         //
         // Process draw calls
@@ -409,6 +410,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
         
         ++FrameCount;
         
+        dt = Min((f32)ElapsedMicroseconds.QuadPart / 1000000.0f, kMaxFrameTime);
+        
         RunTime.QuadPart += ElapsedMicroseconds.QuadPart;
         if (RunTime.QuadPart > 1000000)
         {
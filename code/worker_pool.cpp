@@ -0,0 +1,199 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "worker_pool.h"
+#include "mathematics.h"
+
+#ifdef DEBUG
+#include <assert.h>
+#else
+#define assert(x)
+#endif
+
+
+
+//
+// Workers
+//
+
+static void RunChunks(worker_pool *Pool, parallel_job *Job)
+{
+    u32 Chunk = Pool->NextChunk.fetch_add(1);
+    
+    while (Chunk < Job->ChunkCount)
+    {
+        u32 First = Chunk * Job->ChunkSize;
+        u32 Count = Min(Job->ChunkSize, Job->Count - First);
+        Job->Function(Job->Data, First, Count);
+        
+        Chunk = Pool->NextChunk.fetch_add(1);
+    }
+}
+
+
+static void WorkerThread(worker_pool *Pool)
+{
+    u64 SeenGeneration = 0;
+    
+    while (1)
+    {
+        parallel_job Job;
+        
+        {
+            std::unique_lock<std::mutex> Lock(Pool->Mutex);
+            Pool->WorkAvailable.wait(Lock, [&] { return Pool->Quit || (Pool->Generation != SeenGeneration); });
+            
+            if (Pool->Quit)
+            {
+                return;
+            }
+            
+            SeenGeneration = Pool->Generation;
+            Job = Pool->Job;
+            ++Pool->ActiveWorkers;
+        }
+        
+        RunChunks(Pool, &Job);
+        
+        {
+            std::lock_guard<std::mutex> Lock(Pool->Mutex);
+            --Pool->ActiveWorkers;
+        }
+        
+        Pool->WorkDone.notify_all();
+    }
+}
+
+
+
+
+//
+// Init and shutdown
+//
+
+void Init(worker_pool *Pool, u32 WorkerCount)
+{
+    assert(Pool);
+    assert(Pool->Threads.empty());
+    
+    Pool->Generation = 0;
+    Pool->ActiveWorkers = 0;
+    Pool->Quit = false;
+    Pool->NextChunk = 0;
+    
+    for (u32 Index = 0; Index < WorkerCount; ++Index)
+    {
+        Pool->Threads.emplace_back(WorkerThread, Pool);
+    }
+}
+
+
+void Shutdown(worker_pool *Pool)
+{
+    assert(Pool);
+    
+    {
+        std::lock_guard<std::mutex> Lock(Pool->Mutex);
+        Pool->Quit = true;
+    }
+    
+    Pool->WorkAvailable.notify_all();
+    
+    for (auto& Thread : Pool->Threads)
+    {
+        Thread.join();
+    }
+    
+    Pool->Threads.clear();
+}
+
+
+u32 GetThreadCount(worker_pool *Pool)
+{
+    u32 Result = 1;
+    
+    if (Pool)
+    {
+        Result += static_cast<u32>(Pool->Threads.size());
+    }
+    
+    return Result;
+}
+
+
+
+
+//
+// Work
+//
+
+void ParallelFor(worker_pool *Pool, u32 Count, u32 ChunkSize, parallel_function *Function, void *Data)
+{
+    assert(Function);
+    assert(ChunkSize > 0);
+    
+    if (Count == 0)
+    {
+        return;
+    }
+    
+    parallel_job Job;
+    Job.Function = Function;
+    Job.Data = Data;
+    Job.Count = Count;
+    Job.ChunkSize = ChunkSize;
+    Job.ChunkCount = (Count + ChunkSize - 1) / ChunkSize;
+    
+    if (!Pool || Pool->Threads.empty() || (Job.ChunkCount == 1))
+    {
+        for (u32 Chunk = 0; Chunk < Job.ChunkCount; ++Chunk)
+        {
+            u32 First = Chunk * ChunkSize;
+            Function(Data, First, Min(ChunkSize, Count - First));
+        }
+        
+        return;
+    }
+    
+    {
+        // Workers that are still finishing up the previous job must be done before the chunk
+        // counter is reset, otherwise they could pick up a chunk of this job.
+        std::unique_lock<std::mutex> Lock(Pool->Mutex);
+        Pool->WorkDone.wait(Lock, [&] { return Pool->ActiveWorkers == 0; });
+        
+        Pool->Job = Job;
+        Pool->NextChunk = 0;
+        ++Pool->Generation;
+    }
+    
+    Pool->WorkAvailable.notify_all();
+    
+    RunChunks(Pool, &Job);
+    
+    {
+        // Every chunk that we did not run ourselves is run by an active worker
+        std::unique_lock<std::mutex> Lock(Pool->Mutex);
+        Pool->WorkDone.wait(Lock, [&] { return Pool->ActiveWorkers == 0; });
+    }
+}
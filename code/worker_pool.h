@@ -0,0 +1,84 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef worker_pool__h
+#define worker_pool__h
+
+#include "types.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+
+//
+// A small pool of worker threads that runs data-parallel loops. The work is split into chunks
+// of a fixed size, so which thread runs a chunk can vary but how the work is split never does.
+// The calling thread takes part in the work and ParallelFor() returns when all chunks are done.
+//
+
+typedef void parallel_function(void *Data, u32 First, u32 Count);
+
+struct parallel_job
+{
+    parallel_function *Function = nullptr;
+    void *Data = nullptr;
+    u32 Count = 0;
+    u32 ChunkSize = 1;
+    u32 ChunkCount = 0;
+};
+
+struct worker_pool
+{
+    std::vector<std::thread> Threads;
+    
+    std::mutex Mutex;
+    std::condition_variable WorkAvailable;
+    std::condition_variable WorkDone;
+    
+    parallel_job Job;
+    u64 Generation = 0;
+    u32 ActiveWorkers = 0;
+    b32 Quit = false;
+    
+    std::atomic<u32> NextChunk;
+};
+
+
+// WorkerCount is the number of threads in addition to the calling thread, 0 runs everything
+// on the calling thread.
+void Init(worker_pool *Pool, u32 WorkerCount);
+void Shutdown(worker_pool *Pool);
+
+u32 GetThreadCount(worker_pool *Pool);
+
+// Calls Function(Data, First, Count) for every chunk of [0, Count), Pool may be null.
+void ParallelFor(worker_pool *Pool, u32 Count, u32 ChunkSize, parallel_function *Function, void *Data);
+
+
+
+#endif